@@ -0,0 +1,56 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+
+/**
+ * arena object, hands out memory from a few large
+ * blocks which are all freed together. Not safe to
+ * allocate from on more than one thread at a time.
+ */
+struct arena;
+
+
+/**
+ * Creates an arena
+ * @param block_size, the size of each block (larger allocations get their own)
+ * @return arena, arena object pointer
+ */
+struct arena* arena_create(size_t block_size);
+
+
+/**
+ * Allocates memory from an arena, aligned for any type.
+ * The memory lives until the arena is destroyed
+ * @param arena, pointer to arena object
+ * @param size, the number of bytes to allocate
+ * @return pointer to the memory
+ */
+void* arena_alloc(struct arena* arena, size_t size);
+
+
+/**
+ * Allocates zeroed memory from an arena
+ * @param arena, pointer to arena object
+ * @param size, the number of bytes to allocate
+ * @return pointer to the memory
+ */
+void* arena_calloc(struct arena* arena, size_t size);
+
+
+/**
+ * Returns the number of bytes handed out by an arena
+ * @param arena, pointer to arena object
+ */
+size_t arena_used(struct arena* arena);
+
+
+/**
+ * Deallocates an arena and everything allocated from it
+ * @param arena, pointer to arena object (NULL is ignored)
+ */
+void arena_destroy(struct arena* arena);
+
+
+#endif
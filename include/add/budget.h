@@ -0,0 +1,53 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * budget object, a count of bytes shared between threads.
+ * A thread takes bytes before it reads and gives them back
+ * afterwards, blocking while too few are left, which caps
+ * the bytes being read at once by every thread together.
+ */
+struct io_budget;
+
+
+/**
+ * Creates a budget
+ * @param capacity, the most bytes that can be taken at once
+ * @return budget, budget object pointer
+ */
+struct io_budget* budget_create(uint64_t capacity);
+
+
+/**
+ * Takes bytes from a budget, blocking until enough are
+ * free. A request larger than the whole budget waits for
+ * all of it instead, so it still runs on its own.
+ * A NULL budget never blocks
+ * @param budget, pointer to budget object
+ * @param bytes, the number of bytes to take
+ * @return the number of bytes taken, to be given back
+ */
+uint64_t budget_acquire(struct io_budget* budget, uint64_t bytes);
+
+
+/**
+ * Gives bytes back to a budget and wakes the threads
+ * waiting for them
+ * @param budget, pointer to budget object
+ * @param bytes, the number returned by budget_acquire()
+ */
+void budget_release(struct io_budget* budget, uint64_t bytes);
+
+
+/**
+ * Deallocates a budget
+ * @param budget, pointer to budget object
+ */
+void budget_destroy(struct io_budget* budget);
+
+
+#endif
@@ -1,17 +1,78 @@
 #ifndef INPUTS_H
 #define INPUTS_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #define COMMAND_LEN 5521
 
+struct digest;
+
+
+/**
+ * scanner object, a cursor over the contents of
+ * a bpkg file held in memory.
+ */
+struct scanner {
+	const char* pos;
+	const char* end;
+};
+
+
+/**
+ * Matches an exact piece of text, such as a label
+ * @param sc, pointer to scanner object
+ * @param text, the text expected at the cursor
+ * @return 1 and moves passed the text if it matches, 0 otherwise
+ */
+int scan_literal(struct scanner* sc, const char* text);
+
+
+/**
+ * Copies a value of 1 to max characters up to the end
+ * of the line (without the newline) and null terminates it
+ * @param sc, pointer to scanner object
+ * @param out, buffer of at least max + 1 characters
+ * @param max, the most characters the value may have
+ * @return 1 if a value was copied, 0 otherwise
+ */
+int scan_field(struct scanner* sc, char* out, size_t max);
+
+
+/**
+ * Reads an unsigned decimal number of up to 64 bits
+ * @param sc, pointer to scanner object
+ * @param out, stores the number
+ * @return 1 if there's at least one digit and it fits, 0 otherwise
+ */
+int scan_u64(struct scanner* sc, uint64_t* out);
+
 
 /**
- * Reads through a label when reading from bpkg
- * files (allows us to ignore the label)
- * @param fp, pointer to file object
+ * Reads an unsigned decimal number
+ * @param sc, pointer to scanner object
+ * @param out, stores the number
+ * @return 1 if there's at least one digit and it fits, 0 otherwise
  */
-void read_label(FILE *fp);
+int scan_u32(struct scanner* sc, uint32_t* out);
+
+
+/**
+ * Decodes a 64 character hexadecimal hash straight
+ * into a binary digest
+ * @param sc, pointer to scanner object
+ * @param out, digest to store the result in
+ * @return 1 if the hash is valid, 0 otherwise
+ */
+int scan_digest(struct scanner* sc, struct digest* out);
+
+
+/**
+ * Returns the number of characters left to scan
+ * @param sc, pointer to scanner object
+ */
+size_t scan_remaining(struct scanner* sc);
 
 
 /**
@@ -32,6 +93,23 @@ int is_valid_ident(char* ident);
 int is_valid_hash(char* hash);
 
 
+/**
+ * Converts a hexadecimal hash into a binary digest
+ * @param hash, the hash to be converted
+ * @param out, digest to store the result in
+ * @return 1 if the hash is valid, 0 otherwise
+ */
+int hash_to_digest(const char* hash, struct digest* out);
+
+
+/**
+ * Converts a binary digest into a hexadecimal hash
+ * @param in, the digest to be converted
+ * @param hash, buffer of at least 64 characters (not null terminated)
+ */
+void digest_to_hash(const struct digest* in, char* hash);
+
+
 /**
  * Checks to see if data contains characters
  * @param data, the data to be checked
@@ -40,7 +118,8 @@ int is_empty(char *data);
 
 
 /**
- * Checks if a bpkg file has a valid format
+ * Checks if a bpkg file has a valid format, with the
+ * same rules bpkg_load() applies
  * @param path, path to bpkg file
  */
 int is_valid_bpkg(const char* path);
@@ -7,9 +7,10 @@
 /**
  * Converts integer into binary string
  * @param num, integer number
- * @return bin, the binary conversion as a string
+ * @param height, the number of binary digits
+ * @param bin, buffer of at least height + 1 characters to store the result
  */
-char* int_to_bin(int num, int height);
+void int_to_bin(int num, int height, char* bin);
 
 
 /**
@@ -17,9 +18,9 @@ char* int_to_bin(int num, int height);
  * the key of either left or right child and
  * omitting the last bit e.g. 01010 -> 0101
  * @param child_key, string containing a child's key
- * @return key, newly generated non-leaf node key
+ * @param key, buffer of at least strlen(child_key) characters to store the result
  */
-char* gen_hash_key(char* child_key, int height);
+void gen_hash_key(const char* child_key, char* key);
 
 
-#endif
\ No newline at end of file
+#endif
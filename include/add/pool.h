@@ -0,0 +1,64 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * A task run by the pool over a range of items
+ * @param arg, the argument passed to pool_parallel_for()
+ * @param start, index of the first item in the range
+ * @param end, index one past the last item in the range
+ * @param worker, index of the thread running the range (0 is the caller)
+ */
+typedef void (*pool_task)(void* arg, size_t start, size_t end, uint32_t worker);
+
+
+/**
+ * thread pool object, holds a fixed set of worker
+ * threads that cooperate on one job at a time.
+ */
+struct thread_pool;
+
+
+/**
+ * Creates a thread pool. The calling thread takes part in
+ * every job, so nthreads - 1 worker threads are spawned
+ * @param nthreads, total number of threads (0 uses all online CPUs)
+ * @return pool, thread pool object pointer
+ */
+struct thread_pool* pool_create(uint32_t nthreads);
+
+
+/**
+ * Returns the total number of threads of a pool
+ * including the calling thread
+ * @param pool, pointer to thread pool object
+ */
+uint32_t pool_size(struct thread_pool* pool);
+
+
+/**
+ * Runs a task over items [0, n) split into ranges of grain
+ * items. Threads grab the next range as they become free, so
+ * uneven ranges balance themselves. Blocks until all items are done.
+ * A NULL pool runs every range on the calling thread
+ * @param pool, pointer to thread pool object
+ * @param n, the number of items
+ * @param grain, the number of items in each range
+ * @param task, the task to run on each range
+ * @param arg, argument passed through to the task
+ */
+void pool_parallel_for(struct thread_pool* pool, size_t n, size_t grain,
+    pool_task task, void* arg);
+
+
+/**
+ * Stops and joins the worker threads and deallocates the pool
+ * @param pool, pointer to thread pool object
+ */
+void pool_destroy(struct thread_pool* pool);
+
+
+#endif
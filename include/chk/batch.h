@@ -0,0 +1,75 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "add/budget.h"
+#include "add/pool.h"
+#include "chk/pkgchk.h"
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * The outcome of verifying one package of a batch.
+ */
+enum batch_status {
+	BATCH_SUCCESS, // the data file matches the package
+	BATCH_FAILED, // a chunk or the root hash doesn't match
+	BATCH_NO_DATA, // the data file can't be opened
+	BATCH_INVALID, // the bpkg file can't be loaded
+};
+
+
+/**
+ * batch result object, holds the outcome of
+ * verifying one package of a batch.
+ */
+struct batch_result {
+	const char* path; // the bpkg file
+	enum batch_status status;
+	int64_t first_mismatch; // with BATCH_FAILED, the first chunk that differs or -1
+	uint64_t first_offset; // where that chunk starts in the data file
+};
+
+
+/**
+ * batch object, holds the bpkg files to be verified
+ * together and a result for each of them.
+ */
+struct batch {
+	size_t n_packages;
+	struct batch_result* results; // one per package, in the order given
+	struct arena* arena; // holds the batch, its paths and results
+};
+
+
+/**
+ * Loads the list of bpkg files to verify, either from a
+ * manifest with one path per line (blank lines and lines
+ * starting with # are skipped) or from a directory, taking
+ * every .bpkg and .bpkg2 file in it in name order
+ * @param source, path of the manifest or directory
+ * @return batch, batch object pointer or NULL if source can't be read
+ */
+struct batch* batch_load(const char* source);
+
+
+/**
+ * Verifies every package of a batch, spreading the packages
+ * over the threads of a pool. Each package is streamed by
+ * one thread, and every read takes its bytes from the shared
+ * budget so the threads together stay within it
+ * @param batch, batch object to fill in the results of
+ * @param pool, thread pool to verify with (NULL verifies on the calling thread)
+ * @param budget, budget shared by every read (NULL for none)
+ */
+void batch_run(struct batch* batch, struct thread_pool* pool, struct io_budget* budget);
+
+
+/**
+ * Deallocates a batch and all of its results
+ * @param batch, pointer to batch object
+ */
+void batch_destroy(struct batch* batch);
+
+
+#endif
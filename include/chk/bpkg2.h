@@ -0,0 +1,70 @@
+#ifndef BPKG2_H
+#define BPKG2_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BPKG2_MAGIC "\x89" "BPKG2\r\n"
+#define BPKG2_MAGIC_SIZE 8
+#define BPKG2_VERSION 1
+#define BPKG2_UNIFORM 0x1 // chunk i spans [i * chunk_size, (i + 1) * chunk_size)
+
+struct bpkg_obj;
+
+
+/**
+ * bpkg2 header object, the fixed start of a binary bpkg
+ * file. Every field is little-endian. It's followed by
+ * ident_len bytes of ident and filename_len bytes of
+ * filename (padded with zeros to a multiple of 8), then
+ * nhashes digests, nchunks chunk digests and, without the
+ * BPKG2_UNIFORM flag, nchunks 64-bit offsets followed by
+ * nchunks 64-bit sizes.
+ */
+struct bpkg2_header {
+	char magic[BPKG2_MAGIC_SIZE];
+	uint32_t version;
+	uint32_t flags;
+	uint32_t nhashes;
+	uint32_t nchunks;
+	uint64_t size;
+	uint64_t chunk_size; // only with BPKG2_UNIFORM
+	uint16_t ident_len;
+	uint16_t filename_len;
+	uint32_t reserved;
+};
+
+
+/**
+ * Indicates whether the contents of a file start
+ * with the bpkg2 magic
+ * @param data, the contents of the file
+ * @param size, the size of the file
+ */
+int bpkg2_is_binary(const char* data, size_t size);
+
+
+/**
+ * Loads a bpkg object from the contents of a bpkg2 file.
+ * The sections are copied straight into the object after
+ * checking the header and that the file is exactly the size
+ * the header describes
+ * @param data, the contents of the file
+ * @param size, the size of the file
+ * @return obj, bpkg object pointer or NULL if the file is invalid
+ */
+struct bpkg_obj* bpkg2_parse(const char* data, size_t size);
+
+
+/**
+ * Writes a bpkg object as a bpkg2 file, leaving out the
+ * offset and size arrays when the chunks are evenly sized
+ * and back to back
+ * @param bpkg, constructed bpkg object
+ * @param path, path of the file to write
+ * @return 0 on success, -1 if the file can't be written
+ */
+int bpkg2_save(struct bpkg_obj* bpkg, const char* path);
+
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "chk/pkgchk.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define CACHE_MAGIC "\x89" "BPKGC\r\n"
+#define CACHE_MAGIC_SIZE 8
+#define CACHE_VERSION 1
+#define CACHE_SUFFIX ".bpkgcache"
+
+
+/**
+ * cache key object, the header of a sidecar cache file.
+ * A cache only applies while every field matches the data
+ * file and package it was written for. It's followed by
+ * nchunks computed leaf digests. The cache is only read on
+ * the machine that wrote it, so fields are in host order.
+ */
+struct cache_key {
+	char magic[CACHE_MAGIC_SIZE];
+	uint32_t version;
+	uint32_t nchunks;
+	uint64_t size;
+	uint64_t dev;
+	uint64_t ino;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	int64_t ctime_sec;
+	int64_t ctime_nsec;
+	struct digest layout; // hash of every chunk's offset and size
+};
+
+
+/**
+ * Fills in the cache key for the current state of a data
+ * file opened for the package
+ * @param bpkg, constructed bpkg object
+ * @param fd, file descriptor of the data file
+ * @param key, cache key object to fill in
+ * @return 0 on success, -1 if the file can't be examined
+ */
+int cache_key_init(struct bpkg_obj* bpkg, int fd, struct cache_key* key);
+
+
+/**
+ * Loads the leaf digests from the sidecar cache of the
+ * data file when the cache was written under the same key
+ * @param bpkg, constructed bpkg object
+ * @param key, cache key of the data file
+ * @param digests, array of nchunks digests to fill in
+ * @return 0 if the digests were loaded, -1 otherwise
+ */
+int cache_load(struct bpkg_obj* bpkg, const struct cache_key* key, struct digest* digests);
+
+
+/**
+ * Writes the leaf digests to the sidecar cache of the data
+ * file, unless the file changed while it was being hashed or
+ * so recently that a change might not show in its mtime.
+ * The cache is replaced with a rename so readers never see
+ * half of one, and a cache that can't be written is skipped
+ * @param bpkg, constructed bpkg object
+ * @param key, cache key taken before hashing
+ * @param fd, file descriptor of the data file
+ * @param digests, array of nchunks computed leaf digests
+ */
+void cache_save(struct bpkg_obj* bpkg, const struct cache_key* key, int fd,
+    const struct digest* digests);
+
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef FLAT_H
+#define FLAT_H
+
+#include "chk/pkgchk.h"
+#include <stddef.h>
+#include <sys/types.h>
+
+
+/**
+ * flat merkle tree object, holds every node of a merkle
+ * tree in heap order (root at 0, children of node i at
+ * 2i + 1 and 2i + 2, chunks last) as binary digests, all
+ * in a single allocation.
+ */
+struct merkle_flat {
+	size_t n_nodes;
+	size_t n_leaves;
+	struct digest* expected;
+	struct digest* computed;
+};
+
+
+/**
+ * Builds a flat merkle tree using a bpkg object
+ * @param bpkg, constructed bpkg object
+ * @return flat, merkle_flat object pointer, or NULL if
+ * 		the data file can't be read
+ */
+struct merkle_flat* merkle_flat_build(struct bpkg_obj* bpkg);
+
+
+/**
+ * Finds all completed chunks of a flat merkle tree
+ * @param flat, pointer to flat merkle tree object
+ * @param hashes, an array to store completed chunk hashes
+ * @param len, stores the total number of completed chunk hashes
+ */
+void flat_get_completed_chunks(struct merkle_flat* flat, struct digest* hashes, int* len);
+
+
+/**
+ * A recursive function that finds the minimum completed
+ * hashes below a node of a flat merkle tree, in the same
+ * order as get_completed_hashes()
+ * @param flat, pointer to flat merkle tree object
+ * @param index, initially 0 (the root), the current node
+ * @param hashes, an array to store completed hashes
+ * @param len, stores the total number of completed hashes
+ * @return 1 if every chunk below the node is completed
+ */
+int flat_get_completed_hashes(struct merkle_flat* flat, size_t index,
+    struct digest* hashes, int* len);
+
+
+/**
+ * Deallocates the memory for a flat merkle tree
+ * @param flat, pointer to flat merkle tree object
+ */
+void merkle_flat_destroy(struct merkle_flat* flat);
+
+
+#endif
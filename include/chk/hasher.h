@@ -0,0 +1,153 @@
+#ifndef HASHER_H
+#define HASHER_H
+
+#include "add/pool.h"
+#include "chk/pkgchk.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Alignment of O_DIRECT reads, their buffers, offsets and sizes
+#define DIRECT_ALIGN 4096
+
+
+/**
+ * Creates the thread pool used to build a tree, sized by
+ * the nthreads build option. No pool is created when a
+ * single thread is requested or there's too little work
+ * @param nitems, the number of leaves to be hashed
+ * @return pool, thread pool object pointer or NULL
+ */
+struct thread_pool* hasher_pool_create(size_t nitems);
+
+
+/**
+ * Reads up to size bytes at offset, retrying short
+ * reads. Bytes past the end of the file are zeroed
+ * @param fd, file descriptor of the data file
+ * @param buffer, buffer to read into
+ * @param size, the number of bytes to read
+ * @param offset, the position in the file to read from
+ */
+void read_block(int fd, char* buffer, size_t size, off_t offset);
+
+
+/**
+ * Reads up to size bytes at offset from a file opened with
+ * O_DIRECT, which bypasses the page cache. The read is
+ * widened to whole DIRECT_ALIGN blocks, so it lands a little
+ * way into the buffer. Bytes past the end of the file are
+ * zeroed, and a read O_DIRECT refuses is made through fd
+ * @param direct_fd, file descriptor opened with O_DIRECT
+ * @param fd, file descriptor of the same file opened normally
+ * @param bounce, DIRECT_ALIGN aligned buffer of size + 2 * DIRECT_ALIGN bytes
+ * @param size, the number of bytes to read
+ * @param offset, the position in the file to read from
+ * @return pointer to the size bytes read
+ */
+const char* read_block_direct(int direct_fd, int fd, char* bounce, size_t size, off_t offset);
+
+
+/**
+ * Evicts a range of a file from the page cache, for the
+ * PAGES_DROP page mode once the range has been hashed
+ * @param fd, file descriptor of the data file
+ * @param offset, the start of the range
+ * @param length, the size of the range
+ */
+void drop_pages(int fd, uint64_t offset, uint64_t length);
+
+
+/**
+ * Hashes every data block of a bpkg data file into an array
+ * of digests, each block being the bytes [offset, offset + size)
+ * of its chunk. When leaf nodes are given, each one also gets
+ * the hash and records the block's offset and length (keeping
+ * a copy of the block in value only with the retain_values
+ * build option). Ranges of blocks are spread over a pool of
+ * worker threads which each read their blocks with pread, so
+ * no file position is shared. With the READ_MMAP read mode
+ * the blocks are hashed straight from the mapped file instead.
+ * With the use_cache build option the digests come from the
+ * data file's sidecar cache while the file is unchanged.
+ * Hashing on a single thread, the ring_slots build option
+ * hands the reads to a reader thread filling a ring ahead.
+ * Blocks in holes of a sparse data file aren't read at all
+ * @param bpkg, constructed bpkg object
+ * @param digests, array of nchunks digests to fill in
+ * @param leaf_nodes, array of nchunks allocated leaf nodes, or NULL
+ * @param pool, thread pool to hash with (NULL hashes on the calling thread)
+ * @return 0 on success, -1 if the data file can't be opened
+ */
+int hash_leaves(struct bpkg_obj* bpkg, struct digest* digests,
+    struct merkle_tree_node** leaf_nodes, struct thread_pool* pool);
+
+
+/**
+ * Hashes some of the data blocks of a bpkg data file, such as
+ * the chunks a write has touched, the same way as hash_leaves()
+ * but without the sidecar cache
+ * @param bpkg, constructed bpkg object
+ * @param indices, the chunks to hash in ascending order
+ * @param count, the number of chunks to hash
+ * @param digests, array of count digests to fill in
+ * @param leaf_nodes, array of nchunks leaf nodes indexed by chunk, or NULL
+ * @param pool, thread pool to hash with (NULL hashes on the calling thread)
+ * @return 0 on success, -1 if the data file can't be opened
+ */
+int hash_leaves_of(struct bpkg_obj* bpkg, const uint32_t* indices, size_t count,
+    struct digest* digests, struct merkle_tree_node** leaf_nodes, struct thread_pool* pool);
+
+
+/**
+ * Hashes a batch of same-sized whole blocks into their digests.
+ * Blocks that are all zeros get the kept digest of zeros of
+ * their size, only the rest go through the SHA-256 lanes
+ * @param blocks, the blocks
+ * @param size, the size of each block
+ * @param count, the number of blocks
+ * @param outs, array of count digests to store the results in
+ */
+void hash_blocks(const void** blocks, size_t size, size_t count, struct digest* outs);
+
+
+/**
+ * Hashes up to SHA256_MAX_LANES pairs of child digests side
+ * by side, each parent being the hash of the hexadecimal forms
+ * of its two children joined together. The parent of two
+ * all-zero subtrees comes from the kept digests of zeros
+ * @param lefts, digests of the left children
+ * @param rights, digests of the right children
+ * @param outs, digests to store the results in
+ * @param count, the number of pairs
+ */
+void hash_pairs(const struct digest** lefts, const struct digest** rights,
+    struct digest** outs, uint32_t count);
+
+
+/**
+ * Hashes one level of non-leaf nodes from the computed hashes
+ * of their children. The nodes of a level are independent, so
+ * ranges of them are spread over the threads of the pool
+ * @param nodes, array of non-leaf nodes on the same level
+ * @param count, the number of nodes
+ * @param pool, thread pool to hash with (NULL hashes on the calling thread)
+ */
+void hash_non_leaves(struct merkle_tree_node** nodes, size_t count,
+    struct thread_pool* pool);
+
+
+
+/**
+ * Hashes the non-leaf digests of a heap-ordered array
+ * (children of i at 2i + 1 and 2i + 2) from the leaf digests
+ * stored after them, one level at a time from the bottom up.
+ * Each level is split into ranges across the pool
+ * @param digests, array of 2 * nhashes + 1 digests, non-leaf then leaf
+ * @param nhashes, the number of non-leaf digests
+ * @param pool, thread pool to hash with (NULL hashes on the calling thread)
+ */
+void hash_levels(struct digest* digests, size_t nhashes, struct thread_pool* pool);
+
+
+#endif
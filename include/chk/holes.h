@@ -0,0 +1,59 @@
+#ifndef HOLES_H
+#define HOLES_H
+
+#include "chk/pkgchk.h"
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * hole map object, the ranges of a sparse data file
+ * that hold data, in order. Everything else (including
+ * anything past the end of the file) reads as zeros.
+ */
+struct hole_map {
+	size_t n_extents;
+	struct byte_range* extents;
+};
+
+
+/**
+ * Finds the data ranges of a file with SEEK_DATA and
+ * SEEK_HOLE. Files without holes, and filesystems that
+ * can't report them, get no map
+ * @param fd, file descriptor of the data file
+ * @return map, hole map object pointer or NULL
+ */
+struct hole_map* hole_map_load(int fd);
+
+
+/**
+ * Indicates whether a range of the file lies wholly
+ * in holes, so it's known to read as zeros
+ * @param map, pointer to hole map object (NULL for none)
+ * @param offset, start of the range
+ * @param length, size of the range
+ */
+int hole_map_is_hole(const struct hole_map* map, uint64_t offset, uint64_t length);
+
+
+/**
+ * Indicates whether a range of the file lies wholly in
+ * holes by asking the file directly, for when only a few
+ * ranges are wanted and walking the whole file would cost
+ * more than it saves
+ * @param fd, file descriptor of the data file
+ * @param offset, start of the range
+ * @param length, size of the range
+ */
+int hole_probe(int fd, uint64_t offset, uint64_t length);
+
+
+/**
+ * Deallocates a hole map
+ * @param map, pointer to hole map object (NULL does nothing)
+ */
+void hole_map_destroy(struct hole_map* map);
+
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include "chk/pkgchk.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+
+/**
+ * hash index object, an open-addressing table from the
+ * expected hashes of a bpkg object to their positions in
+ * heap order (non-leaf hashes then chunks, the same order
+ * as the nodes of a merkle tree). A slot holds a position
+ * plus one, so zero marks an empty slot. Slots are 64-bit,
+ * since a package of many terabytes can have 2^32 nodes.
+ */
+struct hash_index {
+	size_t mask; // the number of slots minus one
+	uint64_t* slots;
+};
+
+
+/**
+ * Gets the hash index of a bpkg object, building it the
+ * first time it's asked for. The index is kept with the
+ * object and freed along with it
+ * @param bpkg, constructed bpkg object
+ * @return index, hash index object pointer
+ */
+struct hash_index* bpkg_hash_index(struct bpkg_obj* bpkg);
+
+
+/**
+ * Finds the node with a given expected hash. When several
+ * nodes share a hash the first in heap order is returned
+ * @param bpkg, constructed bpkg object
+ * @param index, hash index of the bpkg object
+ * @param hash, the expected hash of the node being searched for
+ * @return the heap position of the node, or -1 if there's no such node
+ */
+ssize_t hash_index_find(struct bpkg_obj* bpkg, const struct hash_index* index,
+    const struct digest* hash);
+
+
+#endif
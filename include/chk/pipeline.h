@@ -0,0 +1,110 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "chk/holes.h"
+#include "chk/pkgchk.h"
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * read step object, one read of a plan that walks the
+ * chunks in order. Runs of up to max_count chunks of the
+ * same size are read together, a piece of each at a time,
+ * so chunks larger than a piece take several steps. A run
+ * of chunks lying wholly in holes is one step with nothing
+ * to read.
+ */
+struct read_step {
+	size_t first; // position of the first chunk of the run
+	size_t count; // the number of chunks in the run
+	uint64_t done; // offset of the piece within each chunk
+	size_t len; // size of the piece
+	int contiguous; // the run's chunks sit back to back in the file
+	int hole; // every chunk of the run reads as zeros, so none is read
+};
+
+
+/**
+ * A function run on the reader thread of a pipeline to
+ * fill the next slot of the ring
+ * @param arg, the argument passed to pipeline_start()
+ * @param buffer, the slot to fill
+ * @return 1 if the slot was filled, 0 once there's nothing left to read
+ */
+typedef int (*pipeline_fill)(void* arg, char* buffer);
+
+
+/**
+ * read pipeline object, a reader thread filling a bounded
+ * ring of buffers (slots) in order while the hashing thread
+ * drains them, so reading and hashing overlap.
+ */
+struct read_pipeline;
+
+
+/**
+ * Moves a read step on to the next piece of the plan. A
+ * zeroed step moves to the start of the first chunk
+ * @param chunks, the chunks of the bpkg object
+ * @param indices, the chunks to read in order, or NULL for every chunk
+ * @param n, the number of chunks to read
+ * @param max_count, the most chunks of a run
+ * @param piece, the most bytes of each chunk read in one step
+ * @param holes, hole map of the data file (NULL for none)
+ * @param step, read step object to move on
+ * @return 1 if there's a next step, 0 once every chunk has been read
+ */
+int read_step_next(const struct chunk* chunks, const uint32_t* indices, size_t n,
+    size_t max_count, size_t piece, const struct hole_map* holes, struct read_step* step);
+
+
+/**
+ * Indicates whether a read step holds the last piece
+ * of its run's chunks
+ * @param chunks, the chunks of the bpkg object
+ * @param indices, the chunks being read, or NULL for every chunk
+ * @param step, read step object
+ */
+int read_step_last(const struct chunk* chunks, const uint32_t* indices, const struct read_step* step);
+
+
+/**
+ * Starts a pipeline, whose reader thread begins filling the
+ * ring straight away
+ * @param ring_size, the number of slots
+ * @param slot_size, the size of each slot
+ * @param fill, the function filling each slot, run on the reader thread
+ * @param arg, argument passed through to fill
+ * @return pipeline, read pipeline object pointer
+ */
+struct read_pipeline* pipeline_start(uint32_t ring_size, size_t slot_size,
+    pipeline_fill fill, void* arg);
+
+
+/**
+ * Takes the next filled slot of a pipeline, waiting for
+ * the reader when it's behind. The slot must be given back
+ * before the next one is taken
+ * @param pipeline, pointer to read pipeline object
+ * @return the slot, or NULL once the reader has nothing left
+ */
+const char* pipeline_take(struct read_pipeline* pipeline);
+
+
+/**
+ * Gives the slot last taken back to the reader to refill
+ * @param pipeline, pointer to read pipeline object
+ */
+void pipeline_give_back(struct read_pipeline* pipeline);
+
+
+/**
+ * Stops the reader thread, even when it has more to read,
+ * and deallocates the pipeline
+ * @param pipeline, pointer to read pipeline object
+ */
+void pipeline_stop(struct read_pipeline* pipeline);
+
+
+#endif
@@ -13,19 +13,34 @@
 #define FILENAME_READ "%256[^\n]"
 #define HASH_SIZE 65
 #define HASH_READ "%64[^\n]"
+#define DIGEST_SIZE 32
 #define PACKAGES_MAX 50
 
+struct arena;
+struct hash_index;
+
+
+/**
+ * digest object, holds a SHA256 hash in binary
+ * form (half the size of its hexadecimal string).
+ */
+struct digest {
+	uint8_t bytes[DIGEST_SIZE];
+};
+
 
 /**
- * Query object, allows you to assign
- * hash strings to it.
- * Typically: malloc N number of strings for hashes
- *    after malloc the space for each string
+ * Query object, holds the results of a query.
+ * Hash queries fill digests with len binary hashes
+ * (formatted as hexadecimal only when printed), while
+ * status queries fill hashes with len strings.
  *    Make sure you deallocate in the destroy function
  */
 struct bpkg_query {
 	char** hashes;
+	struct digest* digests;
 	size_t len;
+	struct arena* arena; // holds hashes and digests
 };
 
 
@@ -36,12 +51,24 @@ struct bpkg_query {
 struct bpkg_obj {
 	char ident[IDENT_SIZE];
 	char filename[FILENAME_SIZE];
-	uint32_t size;
+	uint64_t size;
 	uint32_t nhashes;
-	char **hashes;
+	struct digest* hashes;
 	uint32_t nchunks;
-	struct chunk **chunks;
+	struct chunk *chunks; // nchunks chunks in one array
+	struct arena* arena; // holds the object and both arrays
+	struct hash_index* index; // built on first lookup, also in the arena
+
+};
 
+
+/**
+ * byte range object, holds a run of bytes
+ * of a data file.
+ */
+struct byte_range {
+	uint64_t offset;
+	uint64_t length;
 };
 
 
@@ -50,9 +77,9 @@ struct bpkg_obj {
  * a single chunk from a bpkg file/object.
  */
 struct chunk {
-	char hash[HASH_SIZE];
-	uint32_t offset;
-	uint32_t size;
+	struct digest hash;
+	uint64_t offset;
+	uint64_t size;
 };
 
 
@@ -62,12 +89,14 @@ struct chunk {
  */
 struct merkle_tree_node {
 	void* key;
-	void* value;
+	void* value; // NULL unless the retain_values build option is set
 	struct merkle_tree_node* left;
 	struct merkle_tree_node* right;
 	int is_leaf;
-	char expected_hash[HASH_SIZE]; //Refer to SHA256 Hexadecimal size
-	char computed_hash[HASH_SIZE];
+	struct digest expected_hash;
+	struct digest computed_hash;
+	uint64_t offset; // position of a leaf's chunk in the data file
+	uint64_t length; // size of a leaf's chunk
 };
 
 
@@ -79,9 +108,78 @@ struct merkle_tree_node {
 struct merkle_tree {
 	struct merkle_tree_node* root;
 	size_t n_nodes;
+	struct merkle_tree_node* nodes; // all n_nodes nodes in heap order, leaves last
+	struct merkle_tree_node** leaves; // the leaf of each chunk
+	int ordered; // chunks are sorted by offset without overlapping
+	uint8_t* hashed; // per node flags in a lazy tree, NULL once every hash is computed
+	struct arena* arena; // holds the tree, its nodes, keys and values
+};
+
+
+/**
+ * How the data file is read when hashing chunks.
+ */
+enum bpkg_read_mode {
+	READ_PREAD, // pread each block into a buffer
+	READ_MMAP,  // hash straight from the mapped file
+	READ_URING, // keep many reads in flight with io_uring, pread where it's unavailable
+};
+
+
+/**
+ * Which tree engine answers the chunk and hash queries.
+ */
+enum bpkg_tree_engine {
+	TREE_LINKED, // merkle_tree of pointer-linked nodes
+	TREE_FLAT,   // merkle_flat array in heap order
+};
+
+
+/**
+ * How far the streaming verifier goes once a chunk fails.
+ */
+enum bpkg_verify_mode {
+	VERIFY_ROOT,       // hash everything, report the root and first failure
+	VERIFY_FAIL_FAST,  // stop at the first chunk that fails
+	VERIFY_REPORT_ALL, // hash everything, collect every failing byte range
+};
+
+
+/**
+ * What reading the data file leaves in the page cache.
+ */
+enum bpkg_page_mode {
+	PAGES_KEEP,   // leave the pages cached, as a normal read does
+	PAGES_DROP,   // evict the pages of each range once it's hashed
+	PAGES_DIRECT, // read with O_DIRECT, dropping pages where it can't be used
+};
+
+
+/**
+ * build options object, holds the tunables used when
+ * hashing the data file of a bpkg object.
+ */
+struct bpkg_opts {
+	uint32_t nthreads; // 0 uses all online CPUs
+	enum bpkg_read_mode read_mode;
+	int retain_values; // keep a copy of each chunk in its leaf's value
+	enum bpkg_tree_engine engine;
+	enum bpkg_verify_mode verify_mode;
+	int use_cache; // reuse leaf digests from a sidecar cache while the data file is unchanged
+	enum bpkg_page_mode page_mode;
+	uint32_t ring_slots; // buffers a reader thread fills ahead of hashing, 0 reads on the hashing thread
+	size_t ring_slot_bytes; // bytes per ring buffer, 0 for the default
 };
 
 
+/**
+ * Returns the process-wide build options, which
+ * callers may modify before building a tree
+ * @return opts, pointer to build options object
+ */
+struct bpkg_opts* bpkg_get_opts(void);
+
+
 /**
  * Loads the package for when a value path is given
  * @param path, path to bpkg file
@@ -109,6 +207,72 @@ struct bpkg_query bpkg_file_check(struct bpkg_obj* bpkg);
 struct merkle_tree* merkle_tree_build(struct bpkg_obj* bpkg);
 
 
+/**
+ * Builds a lazy merkle tree using a bpkg object. Only the
+ * structure and expected hashes are filled in, nothing is
+ * read from the data file until merkle_tree_compute() asks
+ * for the computed hash of a node
+ * @param bpkg, constructed bpkg object
+ * @return tree, merkle_tree object pointer
+ */
+struct merkle_tree* merkle_tree_build_lazy(struct bpkg_obj* bpkg);
+
+
+/**
+ * Finds the node of a tree with a given expected hash
+ * through the hash index of the bpkg object, without
+ * computing any hashes
+ * @param bpkg, the bpkg object the tree was built from
+ * @param tree, merkle tree object to search
+ * @param hash, the expected hash of the node being searched for
+ * @return node, merkle tree node pointer or NULL if there's no such node
+ */
+struct merkle_tree_node* merkle_tree_find(struct bpkg_obj* bpkg, struct merkle_tree* tree,
+    const struct digest* hash);
+
+
+/**
+ * Fills in the computed hash of a node of a lazy tree,
+ * hashing only the chunks below it that haven't been
+ * hashed yet and then the nodes between them and it.
+ * Nodes of a fully built tree are left as they are
+ * @param bpkg, the bpkg object the tree was built from
+ * @param tree, merkle tree object the node belongs to
+ * @param node, the node whose computed hash is needed
+ * @return 0 on success, -1 if the data file can't be opened
+ */
+int merkle_tree_compute(struct bpkg_obj* bpkg, struct merkle_tree* tree,
+    struct merkle_tree_node* node);
+
+
+/**
+ * Refreshes a merkle tree after parts of its data file were
+ * written to. Only the leaves whose chunks overlap a modified
+ * range are rehashed, followed by their ancestors a level at
+ * a time, so k dirty chunks cost O(k log n) hashes. In a
+ * lazy tree they're marked to be hashed on demand instead
+ * @param bpkg, the bpkg object the tree was built from
+ * @param tree, merkle tree object to update
+ * @param ranges, the modified byte ranges of the data file
+ * @param n_ranges, the number of ranges
+ * @return the number of leaves affected, or -1 if the data file can't be opened
+ */
+ssize_t merkle_tree_update(struct bpkg_obj* bpkg, struct merkle_tree* tree,
+    const struct byte_range* ranges, size_t n_ranges);
+
+
+/**
+ * Reads the data block of a leaf node from the data file,
+ * for hash-only trees which don't keep the block in value
+ * @param bpkg, constructed bpkg object
+ * @param node, a leaf node of a tree built from bpkg
+ * @param buffer, buffer of at least node->length bytes
+ * @return the number of bytes read, or -1 on error
+ */
+ssize_t merkle_node_read(struct bpkg_obj* bpkg, struct merkle_tree_node* node,
+    void* buffer);
+
+
 /**
  * Retrieves a list of all hashes within the package/tree
  * @param bpkg, constructed bpkg object
@@ -162,7 +326,7 @@ struct bpkg_query bpkg_get_all_chunk_hashes_from_hash(struct bpkg_obj* bpkg, cha
  * it holds the current node of the in-order traversal
  * @param len, stores the total number of completed chunk hashes
  */
-void get_completed_chunks(char** hashes, struct merkle_tree_node* node, int* len);
+void get_completed_chunks(struct digest* hashes, struct merkle_tree_node* node, int* len);
 
 
 /**
@@ -173,30 +337,7 @@ void get_completed_chunks(char** hashes, struct merkle_tree_node* node, int* len
  * it holds the current node of the in-order traversal
  * @param len, stores the total number of completed chunk hashes
  */
-int get_completed_hashes(char** hashes, struct merkle_tree_node* node, int* len);
-
-
-/**
- * A recursive function that uses in-order traversal
- * find a node with a corresponding hash in a merkle tree
- * @param curr_node, initally the root node of the tree, 
- * it holds the current node of the in-order traversal
- * @param node, allocated memory used to store the node
- * @param hash, the expected hash of the node being searched for
- */
-void find_node(struct merkle_tree_node* curr_node, struct merkle_tree_node* node, char* hash);
-
-
-/**
- * A recursive function that uses in-order traversal
- * to find all the chunk hashes of an ancestor node
- * in a merkle tree
- * @param hashes, an array to store the chunk hashes
- * @param node, initally the ancestor node, holds the 
- * current node of the in-order traversal
- * @param len, stores the total number of chunk hashes
- */
-void get_chunk_hashes_of_ancestor(char** hashes, struct merkle_tree_node* node, int* len);
+int get_completed_hashes(struct digest* hashes, struct merkle_tree_node* node, int* len);
 
 
 /**
@@ -216,20 +357,13 @@ void bpkg_obj_destroy(struct bpkg_obj* obj);
 
 
 /**
- * Deallocates the memory for a merkle tree
+ * Deallocates the memory for a merkle tree and
+ * all of its nodes at once
  * @param tree, pointer to merkle tree object
  */
 void merkle_tree_destroy(struct merkle_tree *tree);
 
 
-/**
- * Deallocates the memory for all leaf and 
- * non-leaf nodes of a merkle tree
- * @param node, pointer to merkle tree node
- */
-void merkle_nodes_destroy(struct merkle_tree_node *node);
-
-
 int ftruncate(int fd, off_t length);
 int fileno(FILE *stream);
 
@@ -0,0 +1,62 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+
+/**
+ * uring reader object, an io_uring instance with a ring of
+ * registered buffers (slots) that reads of one file are
+ * queued into. Many reads can be in flight at once, each
+ * one filling its own slot. Not safe to use on more than
+ * one thread at a time, so each thread keeps its own.
+ */
+struct uring_reader;
+
+
+/**
+ * Creates a uring reader. Fails where io_uring isn't
+ * available (an old kernel or a sandbox blocking it), in
+ * which case the caller reads with pread instead
+ * @param fd, file descriptor of the file to read
+ * @param depth, the number of slots and most reads in flight
+ * @param slot_size, the size of each slot
+ * @return reader, uring reader object pointer or NULL
+ */
+struct uring_reader* uring_reader_create(int fd, uint32_t depth, size_t slot_size);
+
+
+/**
+ * Queues a read of len bytes at offset into a slot. The
+ * read is submitted along with any others queued the next
+ * time the reader waits
+ * @param reader, pointer to uring reader object
+ * @param slot, the slot to read into, which mustn't have a read in flight
+ * @param offset, the position in the file to read from
+ * @param len, the number of bytes to read (at most slot_size)
+ */
+void uring_reader_queue(struct uring_reader* reader, uint32_t slot, off_t offset, size_t len);
+
+
+/**
+ * Waits for the read of a slot to complete. A short read
+ * is finished with pread, and bytes past the end of the
+ * file are zeroed, the same as read_block()
+ * @param reader, pointer to uring reader object
+ * @param slot, the slot to wait for
+ * @return pointer to the bytes read into the slot
+ */
+const char* uring_reader_wait(struct uring_reader* reader, uint32_t slot);
+
+
+/**
+ * Waits for every read in flight, then unregisters the
+ * buffers, closes the ring and deallocates the reader
+ * @param reader, pointer to uring reader object
+ */
+void uring_reader_destroy(struct uring_reader* reader);
+
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include "chk/pkgchk.h"
+#include <stddef.h>
+#include <stdint.h>
+
+struct io_budget;
+
+
+/**
+ * verify result object, holds the outcome of
+ * streaming a data file against its bpkg object.
+ *    Make sure you deallocate it with bpkg_verify_destroy
+ */
+struct bpkg_verify {
+	int ok; // 1 when the computed root matches the bpkg's root hash
+	int complete; // 0 when VERIFY_FAIL_FAST stopped before the root
+	struct digest root; // root hash computed from the data file
+	int64_t first_mismatch; // index of the first chunk that differs, -1 if none
+	uint64_t first_offset; // where that chunk starts in the data file
+	struct digest expected; // that chunk's hash in the bpkg
+	struct digest actual; // that chunk's hash computed from the data file
+	size_t n_mismatches; // chunks that differ (only the first with VERIFY_FAIL_FAST)
+	struct byte_range* ranges; // failing byte ranges with VERIFY_REPORT_ALL
+	size_t n_ranges;
+};
+
+
+/**
+ * Verifies a data file against its bpkg object in a single
+ * sequential read without building a tree. Chunk hashes are
+ * folded into a stack holding at most one pending subtree per
+ * level, so memory stays at O(log n) digests and one read
+ * buffer however large the file is. The verify_mode build
+ * option can stop at the first failing chunk or collect the
+ * byte ranges of every failing chunk instead. With the
+ * use_cache build option an unchanged data file isn't read
+ * at all, its chunk hashes coming from the sidecar cache
+ * @param bpkg, constructed bpkg object
+ * @param res, verify result object to fill in
+ * @return 0 on success, -1 if the data file can't be opened
+ */
+int bpkg_verify_stream(struct bpkg_obj* bpkg, struct bpkg_verify* res);
+
+
+/**
+ * Verifies a data file like bpkg_verify_stream(), taking the
+ * bytes of each read from a budget shared with other threads
+ * so many packages can be verified at once without every
+ * one of them reading at the same time
+ * @param bpkg, constructed bpkg object
+ * @param res, verify result object to fill in
+ * @param budget, budget to take read bytes from (NULL for none)
+ * @return 0 on success, -1 if the data file can't be opened
+ */
+int bpkg_verify_stream_budget(struct bpkg_obj* bpkg, struct bpkg_verify* res,
+    struct io_budget* budget);
+
+
+/**
+ * Deallocates the failing byte ranges of a verify result
+ * @param res, pointer to verify result object
+ */
+void bpkg_verify_destroy(struct bpkg_verify* res);
+
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef ZEROS_H
+#define ZEROS_H
+
+#include "chk/pkgchk.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define ZERO_SIZES 16 // chunk sizes whose zero digests are kept
+#define ZERO_HEIGHTS 64 // enough levels for any chunk count
+
+
+/**
+ * Indicates whether every byte of a block is zero, using
+ * the widest vector registers the CPU has. Blocks with data
+ * usually stop the scan within their first few bytes
+ * @param bytes, the block
+ * @param size, the size of the block
+ */
+int is_zero_block(const void* bytes, size_t size);
+
+
+/**
+ * Returns the hash of a chunk of size zero bytes. The first
+ * ZERO_SIZES sizes asked for are kept, along with the hash
+ * of an all-zero subtree of their chunks at every height, so
+ * each one is only computed once per process
+ * @param size, the size of the chunk
+ * @param out, digest to store the result in
+ */
+void zero_digest(uint64_t size, struct digest* out);
+
+
+/**
+ * Finds the parent of two copies of a kept all-zero subtree
+ * hash without hashing them
+ * @param child, the hash of both children
+ * @param out, digest to store the parent's hash in
+ * @return 1 if child is a kept all-zero subtree hash, 0 otherwise
+ */
+int zero_parent(const struct digest* child, struct digest* out);
+
+
+#endif
@@ -1,11 +1,13 @@
 #ifndef BTYDE_CRYPT_SHA256
 #define BTYDE_CRYPT_SHA256
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define SHA256_CHUNK_SZ (64)
 #define SHA256_INT_SZ (8)
 #define SHA256_DFTLEN (1024)
+#define SHA256_MAX_LANES (16)
 
 //Original: https://github.com/LekKit/sha256/blob/master/sha256.h
 struct sha256_compute_data {
@@ -15,9 +17,28 @@ struct sha256_compute_data {
 	uint8_t chunk_size;
 };
 
+//Compression backends, SHA256_AUTO picks the fastest one the CPU supports
+enum sha256_backend {
+	SHA256_AUTO,
+	SHA256_SCALAR,
+	SHA256_SHANI,
+	SHA256_AVX2,
+	SHA256_AVX512
+};
+
 void sha256_calculate_chunk(struct sha256_compute_data* data,
 		uint8_t chunk[SHA256_CHUNK_SZ]);
 
+int sha256_backend_supported(enum sha256_backend backend);
+
+int sha256_set_backend(enum sha256_backend backend);
+
+enum sha256_backend sha256_get_backend(void);
+
+uint32_t sha256_multi_lanes(void);
+
+int sha256_self_test(enum sha256_backend backend);
+
 void sha256_compute_data_init(struct sha256_compute_data* data);
 
 void sha256_update(struct sha256_compute_data* data,
@@ -26,6 +47,16 @@ void sha256_update(struct sha256_compute_data* data,
 void sha256_finalize(struct sha256_compute_data* data, 
 		uint8_t hash[SHA256_INT_SZ]);
 
+//Hash n messages side by side, see sha256.c
+void sha256_update_multi(struct sha256_compute_data* data[],
+		const void* bytes[], uint32_t size, uint32_t n);
+
+void sha256_finalize_multi(struct sha256_compute_data* data[],
+		uint32_t n);
+
+
+void sha256_output(struct sha256_compute_data* data,
+		uint8_t* hash);
 
 void sha256_output_hex(struct sha256_compute_data* data, 
 		char hexbuf[SHA256_CHUNK_SZ]);
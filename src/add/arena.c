@@ -0,0 +1,132 @@
+#include "add/arena.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every allocation is rounded up to this alignment
+#define ARENA_ALIGN (sizeof(max_align_t))
+// Allocations over a quarter of a block get a block of their own
+#define ARENA_LARGE_SHIFT 2
+
+
+/**
+ * arena block object, holds one chunk of memory
+ * and how much of it has been handed out.
+ */
+struct arena_block {
+    struct arena_block* next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+};
+
+
+struct arena {
+    struct arena_block* head; // the block being allocated from
+    size_t block_size;
+    size_t used;
+};
+
+
+/**
+ * Allocates a new block of memory
+ * @param size, the number of usable bytes in the block
+ * @return block, arena block object pointer
+ */
+static struct arena_block* block_create(size_t size) {
+    struct arena_block* block = (struct arena_block*) malloc(sizeof(struct arena_block) + size);
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+
+/**
+ * Creates an arena
+ * @param block_size, the size of each block (larger allocations get their own)
+ * @return arena, arena object pointer
+ */
+struct arena* arena_create(size_t block_size) {
+    struct arena* arena = (struct arena*) malloc(sizeof(struct arena));
+    arena->block_size = block_size > 0 ? block_size : ARENA_ALIGN;
+    arena->head = block_create(arena->block_size);
+    arena->used = 0;
+    return arena;
+}
+
+
+/**
+ * Allocates memory from an arena, aligned for any type.
+ * The memory lives until the arena is destroyed
+ * @param arena, pointer to arena object
+ * @param size, the number of bytes to allocate
+ * @return pointer to the memory
+ */
+void* arena_alloc(struct arena* arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+    arena->used += size;
+
+    struct arena_block* block = arena->head;
+
+    if(block->size - block->used < size) {
+        // Large allocations go in a block of their own behind the head, so the head keeps filling
+        if(size > arena->block_size >> ARENA_LARGE_SHIFT) {
+            struct arena_block* large = block_create(size);
+            large->used = size;
+            large->next = block->next;
+            block->next = large;
+            return large->data;
+        }
+
+        block = block_create(arena->block_size);
+        block->next = arena->head;
+        arena->head = block;
+    }
+
+    void* ptr = (char*) block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+
+/**
+ * Allocates zeroed memory from an arena
+ * @param arena, pointer to arena object
+ * @param size, the number of bytes to allocate
+ * @return pointer to the memory
+ */
+void* arena_calloc(struct arena* arena, size_t size) {
+    void* ptr = arena_alloc(arena, size);
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+
+/**
+ * Returns the number of bytes handed out by an arena
+ * @param arena, pointer to arena object
+ */
+size_t arena_used(struct arena* arena) {
+    return arena->used;
+}
+
+
+/**
+ * Deallocates an arena and everything allocated from it
+ * @param arena, pointer to arena object (NULL is ignored)
+ */
+void arena_destroy(struct arena* arena) {
+    if(arena == NULL)
+        return;
+
+    struct arena_block* block = arena->head;
+
+    while(block != NULL) {
+        struct arena_block* next = block->next;
+        free(block);
+        block = next;
+    }
+
+    free(arena);
+}
@@ -0,0 +1,87 @@
+#include "add/budget.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+
+struct io_budget {
+    pthread_mutex_t lock;
+    pthread_cond_t freed; // signalled when bytes are given back
+    uint64_t capacity;
+    uint64_t available;
+};
+
+
+/**
+ * Creates a budget
+ * @param capacity, the most bytes that can be taken at once
+ * @return budget, budget object pointer
+ */
+struct io_budget* budget_create(uint64_t capacity) {
+    struct io_budget* budget = (struct io_budget*) malloc(sizeof(struct io_budget));
+
+    pthread_mutex_init(&budget->lock, NULL);
+    pthread_cond_init(&budget->freed, NULL);
+    budget->capacity = capacity > 0 ? capacity : 1;
+    budget->available = budget->capacity;
+
+    return budget;
+}
+
+
+/**
+ * Takes bytes from a budget, blocking until enough are
+ * free. A request larger than the whole budget waits for
+ * all of it instead, so it still runs on its own.
+ * A NULL budget never blocks
+ * @param budget, pointer to budget object
+ * @param bytes, the number of bytes to take
+ * @return the number of bytes taken, to be given back
+ */
+uint64_t budget_acquire(struct io_budget* budget, uint64_t bytes) {
+    if(budget == NULL)
+        return 0;
+
+    if(bytes > budget->capacity)
+        bytes = budget->capacity;
+
+    pthread_mutex_lock(&budget->lock);
+
+    while(budget->available < bytes)
+        pthread_cond_wait(&budget->freed, &budget->lock);
+
+    budget->available -= bytes;
+    pthread_mutex_unlock(&budget->lock);
+
+    return bytes;
+}
+
+
+/**
+ * Gives bytes back to a budget and wakes the threads
+ * waiting for them
+ * @param budget, pointer to budget object
+ * @param bytes, the number returned by budget_acquire()
+ */
+void budget_release(struct io_budget* budget, uint64_t bytes) {
+    if((budget == NULL) || (bytes == 0))
+        return;
+
+    pthread_mutex_lock(&budget->lock);
+    budget->available += bytes;
+    pthread_cond_broadcast(&budget->freed);
+    pthread_mutex_unlock(&budget->lock);
+}
+
+
+/**
+ * Deallocates a budget
+ * @param budget, pointer to budget object
+ */
+void budget_destroy(struct io_budget* budget) {
+    if(budget == NULL)
+        return;
+
+    pthread_cond_destroy(&budget->freed);
+    pthread_mutex_destroy(&budget->lock);
+    free(budget);
+}
@@ -7,23 +7,6 @@
 #include <string.h>
 
 
-/**
- * Reads through a label when reading from bpkg
- * files (allows us to ignore the label)
- * @param fp, pointer to file object
- */
-void read_label(FILE *fp){
-	while(1) {
-        // Get next character
-        char c = fgetc(fp);
-
-        // If we reach a colon, we've read through the label
-        if(c == ':')
-            break;
-    }
-}
-
-
 /**
  * Indicates whether an ident is valid by checking
  * that each character is a hexadecimal digit and
@@ -64,6 +47,61 @@ int is_valid_hash(char* hash) {
 }
 
 
+// Value of each hexadecimal digit plus one, 0 for any other character
+static const uint8_t hex_table[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+
+/**
+ * Returns the value of a hexadecimal digit, or -1
+ * @param c, the character to be converted
+ */
+static int hex_value(char c) {
+    return hex_table[(uint8_t) c] - 1;
+}
+
+
+/**
+ * Converts a hexadecimal hash into a binary digest
+ * @param hash, the hash to be converted
+ * @param out, digest to store the result in
+ * @return 1 if the hash is valid, 0 otherwise
+ */
+int hash_to_digest(const char* hash, struct digest* out) {
+    for(int i = 0; i < DIGEST_SIZE; i++) {
+        int hi = hex_value(hash[i * 2]);
+        // Don't look past a null terminator
+        int lo = hi < 0 ? -1 : hex_value(hash[i * 2 + 1]);
+
+        if((hi < 0) | (lo < 0))
+            return 0;
+
+        out->bytes[i] = (uint8_t) (hi << 4 | lo);
+    }
+
+    return 1;
+}
+
+
+/**
+ * Converts a binary digest into a hexadecimal hash
+ * @param in, the digest to be converted
+ * @param hash, buffer of at least 64 characters (not null terminated)
+ */
+void digest_to_hash(const struct digest* in, char* hash) {
+    static const char* const lut = "0123456789abcdef";
+
+    for(int i = 0; i < DIGEST_SIZE; i++) {
+        hash[i * 2] = lut[in->bytes[i] >> 4];
+        hash[i * 2 + 1] = lut[in->bytes[i] & 15];
+    }
+}
+
+
 /**
  * Checks to see if data contains characters
  * @param data, the data to be checked
@@ -88,264 +126,123 @@ int is_empty(char *data) {
 
 
 /**
- * Checks if a bpkg file has a valid format
- * @param path, path to bpkg file
+ * Matches an exact piece of text, such as a label
+ * @param sc, pointer to scanner object
+ * @param text, the text expected at the cursor
+ * @return 1 and moves passed the text if it matches, 0 otherwise
  */
-int is_valid_bpkg(const char* path) {
-    FILE *fp = fopen(path, "r");
-    
-    if(fp == NULL)
-        return 0;
-    // Check if file empty
-    else {
-        // Go to the end of the file and read the size in bytes
-        fseek(fp, 0, SEEK_END);
-        
-        // If file is empty
-        if (ftell(fp) == 0) {
-            fclose(fp);
-            return 0;
-        // Else go back to beginning of file and continue
-        } else
-            fseek(fp, 0, SEEK_SET);
-    }
-
-    // Allocate memory for bpkg object
-    struct bpkg_obj* obj = (struct bpkg_obj*) malloc(sizeof(struct bpkg_obj));
-
-    char ident[] = "ident:";
-
-    // Check label
-    for(int i = 0; i < 6; i++) {
-        if(fgetc(fp) != ident[i])
-            return 0;
-    }
-
-    // Read in ident and assign to struct field
-    int res = fscanf(fp, IDENT_READ, obj->ident);
-
-    // Check that ident is valid
-    if(!is_valid_ident(obj->ident))
-        return 0;
-
-    // Check newline
-    if(fgetc(fp) != '\n')
-        return 0;
-
-    if(res <= 0) {
-        free(obj);
-        return 0;
-    }
-
-    char filename[] = "filename:";
-
-    for(int i = 0; i < 9; i++) {
-        if(fgetc(fp) != filename[i])
-            return 0;
-    }
-
-    // Read in filename and assign to struct field
-    res = fscanf(fp, FILENAME_READ, obj->filename);
+int scan_literal(struct scanner* sc, const char* text) {
+    size_t len = strlen(text);
 
-    if(res <= 0) {
-        free(obj);
+    if((scan_remaining(sc) < len) || (memcmp(sc->pos, text, len) != 0))
         return 0;
-    }
-
-    if(fgetc(fp) != '\n')
-        return 0;
-
-    char size[] = "size:";
-
-    for(int i = 0; i < 5; i++) {
-        if(fgetc(fp) != size[i])
-            return 0;
-    }
-
-    // Read in size and assign to struct field
-    res = fscanf(fp, "%u", &(obj->size));
-
-    if(res <= 0) {
-        printf("1\n");
-        free(obj);
-        return 0;
-    }
-
-    if(fgetc(fp) != '\n')
-        return 0;
-
-    char nhashes[] = "nhashes:";
 
-    for(int i = 0; i < 8; i++) {
-        if(fgetc(fp) != nhashes[i])
-            return 0;
-    }
-
-    // Read in nhashes and assign to struct field
-    res = fscanf(fp, "%u", &(obj->nhashes));
-
-    if(res <= 0) {
-        free(obj);
-        return 0;
-    }
-
-    if(fgetc(fp) != '\n')
-        return 0;
+    sc->pos += len;
+    return 1;
+}
 
-    char hashes[] = "hashes:";
 
-    for(int i = 0; i < 7; i++) {
-        if(fgetc(fp) != hashes[i])
-            return 0;
-    }
+/**
+ * Copies a value of 1 to max characters up to the end
+ * of the line (without the newline) and null terminates it
+ * @param sc, pointer to scanner object
+ * @param out, buffer of at least max + 1 characters
+ * @param max, the most characters the value may have
+ * @return 1 if a value was copied, 0 otherwise
+ */
+int scan_field(struct scanner* sc, char* out, size_t max) {
+    size_t avail = scan_remaining(sc) < max ? scan_remaining(sc) : max;
+    const char* newline = memchr(sc->pos, '\n', avail);
+    size_t len = newline != NULL ? (size_t) (newline - sc->pos) : avail;
 
-    if(fgetc(fp) != '\n')
+    if(len == 0)
         return 0;
 
-    // Allocate memory for an array of char pointers to store hashes
-    obj->hashes = (char**) malloc(sizeof(char*) * obj->nhashes);
-
-    for(int i = 0; i < obj->nhashes; i++) {
-        // Read passed the tab character
-        if(fgetc(fp) != 9)
-            return 0;
-        
-        // Allocate memory for a single hash, set characters to null, and assign it a hash from file
-        obj->hashes[i] = (char*) malloc(sizeof(char) * HASH_SIZE);
-        memset(obj->hashes[i], '\0', sizeof(char) * HASH_SIZE);
-        res = fscanf(fp, HASH_READ, obj->hashes[i]);
+    memcpy(out, sc->pos, len);
+    out[len] = '\0';
+    sc->pos += len;
+    return 1;
+}
 
-        // Check that data is read and the hash is valid
-        if((res <= 0) | (!is_valid_hash(obj->hashes[i]))) {
-            for(int j = 0; j <= i; j++) 
-                free(obj->hashes[j]);
 
-            free(obj->hashes);
+/**
+ * Reads an unsigned decimal number of up to 64 bits
+ * @param sc, pointer to scanner object
+ * @param out, stores the number
+ * @return 1 if there's at least one digit and it fits, 0 otherwise
+ */
+int scan_u64(struct scanner* sc, uint64_t* out) {
+    uint64_t value = 0;
+    const char* start = sc->pos;
 
-            free(obj);
-            return 0;
-        }
+    while((sc->pos < sc->end) && (*sc->pos >= '0') && (*sc->pos <= '9')) {
+        uint64_t digit = *sc->pos - '0';
 
-        if(fgetc(fp) != '\n')
+        if(value > (UINT64_MAX - digit) / 10)
             return 0;
-    }
-
-    char nchunks[] = "nchunks:";
 
-    for(int i = 0; i < 8; i++) {
-        if(fgetc(fp) != nchunks[i])
-            return 0;
+        value = value * 10 + digit;
+        sc->pos++;
     }
 
-    // Read in nchunks and assign to struct field
-    res = fscanf(fp, "%u", &(obj->nchunks));
+    *out = value;
+    return sc->pos > start;
+}
 
-    if(res <= 0) {
-        for(int i = 0; i <= obj->nhashes; i++) 
-            free(obj->hashes[i]);
 
-        free(obj->hashes);
-        
-        free(obj);
-        return 0;
-    }
+/**
+ * Reads an unsigned decimal number
+ * @param sc, pointer to scanner object
+ * @param out, stores the number
+ * @return 1 if there's at least one digit and it fits, 0 otherwise
+ */
+int scan_u32(struct scanner* sc, uint32_t* out) {
+    uint64_t value;
 
-    if(fgetc(fp) != '\n')
+    if(!scan_u64(sc, &value) || (value > UINT32_MAX))
         return 0;
 
-    char chunks[] = "chunks:";
+    *out = (uint32_t) value;
+    return 1;
+}
 
-    for(int i = 0; i < 7; i++) {
-        if(fgetc(fp) != chunks[i])
-            return 0;
-    }
 
-    if(fgetc(fp) != '\n')
+/**
+ * Decodes a 64 character hexadecimal hash straight
+ * into a binary digest
+ * @param sc, pointer to scanner object
+ * @param out, digest to store the result in
+ * @return 1 if the hash is valid, 0 otherwise
+ */
+int scan_digest(struct scanner* sc, struct digest* out) {
+    if((scan_remaining(sc) < HASH_SIZE - 1) || (!hash_to_digest(sc->pos, out)))
         return 0;
 
-    // Allocate memory for an array of char pointers to store hashes
-    obj->chunks = (struct chunk**) malloc(sizeof(struct chunk*) * obj->nchunks);
-
-    for(int i = 0; i < obj->nchunks; i++) {
-        // Check tab character
-        if(fgetc(fp) != 9)
-            return 0;
-        
-        // Allocate memory for a single hash, read a hash in and store it
-        obj->chunks[i] = (struct chunk*) malloc(sizeof(struct chunk));
-        res = fscanf(fp, HASH_READ, obj->chunks[i]->hash);
-
-        // Check that data is read and the hash is valid
-        if((res <= 0) | (!is_valid_hash(obj->chunks[i]->hash))) {
-            for(int j = 0; j <= i; j++) 
-                free(obj->chunks[j]);
-
-            free(obj->chunks);
-
-            for(int i = 0; i <= obj->nhashes; i++) 
-                free(obj->hashes[i]);
-
-            free(obj->hashes);
-            
-            free(obj);
-            return 0;
-        }
-
-        // Check comma
-        if(fgetc(fp) != ',')
-            return 0;
-        
-        // Read an offset from file and store it
-        res = fscanf(fp, "%u", &(obj->chunks[i]->offset));
-
-        if(res <= 0) {
-            for(int i = 0; i <= obj->nchunks; i++) 
-                free(obj->chunks[i]);
-
-            free(obj->chunks);
-
-            for(int i = 0; i <= obj->nhashes; i++) 
-                free(obj->hashes[i]);
-
-            free(obj->hashes);
-            
-            free(obj);
-            return 0;
-        }
-        
-        if(fgetc(fp) != ',')
-            return 0;
-        
-        // Read a size from file and store it
-        res = fscanf(fp, "%u", &(obj->chunks[i]->size));
+    sc->pos += HASH_SIZE - 1;
+    return 1;
+}
 
-        if(res <= 0) {
-            for(int i = 0; i <= obj->nchunks; i++) 
-                free(obj->chunks[i]);
 
-            free(obj->chunks);
+/**
+ * Returns the number of characters left to scan
+ * @param sc, pointer to scanner object
+ */
+size_t scan_remaining(struct scanner* sc) {
+    return sc->end - sc->pos;
+}
 
-            for(int i = 0; i <= obj->nhashes; i++) 
-                free(obj->hashes[i]);
 
-            free(obj->hashes);
-            
-            free(obj);
-            return 0;
-        }
-        
-        if(fgetc(fp) != '\n')
-            return 0;
-    }
+/**
+ * Checks if a bpkg file has a valid format, with the
+ * same rules bpkg_load() applies
+ * @param path, path to bpkg file
+ */
+int is_valid_bpkg(const char* path) {
+    struct bpkg_obj* obj = bpkg_load(path);
 
-    // If that we've reached end of file
-    if(fgetc(fp) != EOF) {
+    if(obj == NULL)
         return 0;
-    }
 
-    // Free resources
-    fclose(fp);
     bpkg_obj_destroy(obj);
-    
     return 1;
 }
@@ -8,13 +8,11 @@
 /**
  * Converts integer into binary string
  * @param num, integer number
- * @return bin, the binary conversion as a string
+ * @param height, the number of binary digits
+ * @param bin, buffer of at least height + 1 characters to store the result
  */
-char* int_to_bin(int num, int height) {
-    // Allocate memory to store binary number and set values to null
-    char *bin = malloc(sizeof(char) * (height + 1));
-    memset(bin, '\0', sizeof(char) * (height + 1));
-
+void int_to_bin(int num, int height, char* bin) {
+    bin[height] = '\0';
 
     for (int i = height - 1; i >= 0; i--) {
         // Assign binary digit
@@ -22,8 +20,6 @@ char* int_to_bin(int num, int height) {
         // Right shift bits by 1
         num >>= 1;
     }
-
-    return bin;
 }
 
 
@@ -32,21 +28,15 @@ char* int_to_bin(int num, int height) {
  * the key of either left or right child and
  * omitting the last bit e.g. 01010 -> 0101
  * @param child_key, string containing a child's key
- * @return key, newly generated non-leaf node key
+ * @param key, buffer of at least strlen(child_key) characters to store the result
  */
-char* gen_hash_key(char* child_key, int height) {
-    // Allocate memory to store new key, set values to null, and assign it the child_key value
-    char *key = malloc(sizeof(char) * (height + 1));
-    memset(key, '\0', sizeof(char) * (height + 1));
-    strcpy(key, child_key);
+void gen_hash_key(const char* child_key, char* key) {
+    size_t len = strlen(child_key);
 
-    // Remove last bit by making it null
-    for (int i = height - 1; i >= 0; i--) {
-        if(key[i] != '\0') {
-            key[i] = '\0';
-            break;
-        }
-    }
+    // Copy all but the last bit
+    if(len > 0)
+        len--;
 
-    return key;
+    memcpy(key, child_key, len);
+    key[len] = '\0';
 }
@@ -0,0 +1,220 @@
+#include "add/pool.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+struct thread_pool {
+    pthread_t* threads;
+    uint32_t nthreads;
+
+    pthread_mutex_t submit; // only one job runs at a time
+    pthread_mutex_t lock;
+    pthread_cond_t start;   // signalled when a job is posted
+    pthread_cond_t done;    // signalled when the last worker finishes
+    uint64_t generation;    // incremented for every posted job
+    uint32_t active;        // workers still busy with the current job
+    int stop;
+
+    // Current job
+    pool_task task;
+    void* arg;
+    size_t n;
+    size_t grain;
+    atomic_size_t next;
+};
+
+
+/**
+ * Grabs ranges of the current job until none remain
+ * @param pool, pointer to thread pool object
+ * @param worker, index of the calling thread
+ */
+static void run_job(struct thread_pool* pool, uint32_t worker) {
+    while(1) {
+        size_t start = atomic_fetch_add(&pool->next, pool->grain);
+
+        if(start >= pool->n)
+            break;
+
+        size_t end = start + pool->grain;
+
+        if(end > pool->n)
+            end = pool->n;
+
+        pool->task(pool->arg, start, end, worker);
+    }
+}
+
+
+struct worker_arg {
+    struct thread_pool* pool;
+    uint32_t worker;
+};
+
+
+/**
+ * Worker thread loop, waits for a job, runs it
+ * and reports back until the pool is stopped
+ * @param varg, pointer to worker_arg
+ */
+static void* worker_main(void* varg) {
+    struct worker_arg warg = *(struct worker_arg*) varg;
+    struct thread_pool* pool = warg.pool;
+    free(varg);
+
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while(1) {
+        while((pool->generation == seen) & (!pool->stop))
+            pthread_cond_wait(&pool->start, &pool->lock);
+
+        if(pool->stop)
+            break;
+
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_job(pool, warg.worker);
+
+        pthread_mutex_lock(&pool->lock);
+
+        // The last worker out wakes the caller
+        if(--pool->active == 0)
+            pthread_cond_signal(&pool->done);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+
+/**
+ * Creates a thread pool. The calling thread takes part in
+ * every job, so nthreads - 1 worker threads are spawned
+ * @param nthreads, total number of threads (0 uses all online CPUs)
+ * @return pool, thread pool object pointer
+ */
+struct thread_pool* pool_create(uint32_t nthreads) {
+    if(nthreads == 0) {
+        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpus > 0 ? (uint32_t) ncpus : 1;
+    }
+
+    struct thread_pool* pool = (struct thread_pool*) calloc(1, sizeof(struct thread_pool));
+
+    pthread_mutex_init(&pool->submit, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    atomic_init(&pool->next, 0);
+
+    pool->threads = (pthread_t*) malloc(sizeof(pthread_t) * nthreads);
+    pool->nthreads = 1;
+
+    // Spawn the workers, keeping however many could be started
+    for(uint32_t i = 1; i < nthreads; i++) {
+        struct worker_arg* warg = (struct worker_arg*) malloc(sizeof(struct worker_arg));
+        warg->pool = pool;
+        warg->worker = i;
+
+        if(pthread_create(&pool->threads[i], NULL, worker_main, warg) != 0) {
+            free(warg);
+            break;
+        }
+
+        pool->nthreads++;
+    }
+
+    return pool;
+}
+
+
+/**
+ * Returns the total number of threads of a pool
+ * including the calling thread
+ * @param pool, pointer to thread pool object
+ */
+uint32_t pool_size(struct thread_pool* pool) {
+    return pool == NULL ? 1 : pool->nthreads;
+}
+
+
+/**
+ * Runs a task over items [0, n) split into ranges of grain
+ * items. Threads grab the next range as they become free, so
+ * uneven ranges balance themselves. Blocks until all items are done.
+ * A NULL pool runs every range on the calling thread
+ * @param pool, pointer to thread pool object
+ * @param n, the number of items
+ * @param grain, the number of items in each range
+ * @param task, the task to run on each range
+ * @param arg, argument passed through to the task
+ */
+void pool_parallel_for(struct thread_pool* pool, size_t n, size_t grain,
+    pool_task task, void* arg) {
+
+    if(grain == 0)
+        grain = 1;
+
+    // Nothing to share, run inline
+    if((pool == NULL) || (pool->nthreads == 1) || (n <= grain)) {
+        for(size_t start = 0; start < n; start += grain)
+            task(arg, start, start + grain > n ? n : start + grain, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->submit);
+
+    // Post the job and wake the workers
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->arg = arg;
+    pool->n = n;
+    pool->grain = grain;
+    atomic_store(&pool->next, 0);
+    pool->active = pool->nthreads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_job(pool, 0);
+
+    // Wait for the workers to finish their last ranges
+    pthread_mutex_lock(&pool->lock);
+    while(pool->active > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_mutex_unlock(&pool->submit);
+}
+
+
+/**
+ * Stops and joins the worker threads and deallocates the pool
+ * @param pool, pointer to thread pool object
+ */
+void pool_destroy(struct thread_pool* pool) {
+    if(pool == NULL)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(uint32_t i = 1; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_mutex_destroy(&pool->submit);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+
+    free(pool->threads);
+    free(pool);
+}
@@ -0,0 +1,246 @@
+#define _GNU_SOURCE
+#include "add/arena.h"
+#include "add/budget.h"
+#include "add/pool.h"
+#include "chk/batch.h"
+#include "chk/pkgchk.h"
+#include "chk/verify.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Room for the paths of a typical batch before the arena needs another block
+#define BATCH_ARENA_BLOCK (64 * 1024)
+
+
+struct batch_job {
+    struct batch* batch;
+    struct io_budget* budget;
+};
+
+
+/**
+ * Adds a path to the growing list of a batch being loaded
+ * @param arena, arena of the batch to copy the path into
+ * @param paths, pointer to the list of paths
+ * @param count, pointer to the number of paths
+ * @param path, the path to add
+ * @param len, the length of the path
+ */
+static void add_path(struct arena* arena, char*** paths, size_t* count,
+    const char* path, size_t len) {
+
+    // Grow the list by doubling
+    if((*count & (*count - 1)) == 0)
+        *paths = (char**) realloc(*paths, sizeof(char*) * (*count ? *count * 2 : 1));
+
+    char* copy = (char*) arena_alloc(arena, len + 1);
+    memcpy(copy, path, len);
+    copy[len] = '\0';
+
+    (*paths)[(*count)++] = copy;
+}
+
+
+/**
+ * Indicates whether a directory entry names a package
+ * @param name, the name of the entry
+ */
+static int is_package_name(const char* name) {
+    size_t len = strlen(name);
+
+    return ((len > 5) && (strcmp(name + len - 5, ".bpkg") == 0))
+        || ((len > 6) && (strcmp(name + len - 6, ".bpkg2") == 0));
+}
+
+
+/**
+ * Orders paths by name for qsort
+ * @param a, pointer to the first path
+ * @param b, pointer to the second path
+ */
+static int compare_path(const void* a, const void* b) {
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+
+/**
+ * Lists the packages of a directory in name order
+ * @param arena, arena of the batch to copy the paths into
+ * @param paths, pointer to the list of paths
+ * @param count, pointer to the number of paths
+ * @param source, path of the directory
+ * @return 0 on success, -1 if the directory can't be read
+ */
+static int list_directory(struct arena* arena, char*** paths, size_t* count, const char* source) {
+    DIR* dir = opendir(source);
+
+    if(dir == NULL)
+        return -1;
+
+    struct dirent* entry;
+    char path[FILENAME_SIZE * 2];
+
+    while((entry = readdir(dir)) != NULL) {
+        if(!is_package_name(entry->d_name))
+            continue;
+
+        int len = snprintf(path, sizeof(path), "%s/%s", source, entry->d_name);
+
+        if((len > 0) && ((size_t) len < sizeof(path)))
+            add_path(arena, paths, count, path, len);
+    }
+
+    closedir(dir);
+
+    // readdir() gives no order, so sort for results that are the same every run
+    if(*count > 0)
+        qsort(*paths, *count, sizeof(char*), compare_path);
+
+    return 0;
+}
+
+
+/**
+ * Lists the packages of a manifest in the order given
+ * @param arena, arena of the batch to copy the paths into
+ * @param paths, pointer to the list of paths
+ * @param count, pointer to the number of paths
+ * @param source, path of the manifest
+ * @return 0 on success, -1 if the manifest can't be read
+ */
+static int list_manifest(struct arena* arena, char*** paths, size_t* count, const char* source) {
+    FILE* fp = fopen(source, "r");
+
+    if(fp == NULL)
+        return -1;
+
+    char* line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+
+    while((len = getline(&line, &cap, fp)) >= 0) {
+        // Trim the line ending and any trailing spaces
+        while((len > 0) && ((line[len - 1] == '\n') || (line[len - 1] == '\r')
+            || (line[len - 1] == ' ') || (line[len - 1] == '\t')))
+            len--;
+
+        if((len == 0) || (line[0] == '#'))
+            continue;
+
+        add_path(arena, paths, count, line, len);
+    }
+
+    free(line);
+    fclose(fp);
+
+    return 0;
+}
+
+
+/**
+ * Loads the list of bpkg files to verify, either from a
+ * manifest with one path per line (blank lines and lines
+ * starting with # are skipped) or from a directory, taking
+ * every .bpkg and .bpkg2 file in it in name order
+ * @param source, path of the manifest or directory
+ * @return batch, batch object pointer or NULL if source can't be read
+ */
+struct batch* batch_load(const char* source) {
+    struct stat st;
+
+    if(stat(source, &st) != 0)
+        return NULL;
+
+    struct arena* arena = arena_create(BATCH_ARENA_BLOCK);
+    char** paths = NULL;
+    size_t count = 0;
+
+    int res = S_ISDIR(st.st_mode) ? list_directory(arena, &paths, &count, source)
+        : list_manifest(arena, &paths, &count, source);
+
+    if(res != 0) {
+        free(paths);
+        arena_destroy(arena);
+        return NULL;
+    }
+
+    struct batch* batch = (struct batch*) arena_alloc(arena, sizeof(struct batch));
+    batch->n_packages = count;
+    batch->results = (struct batch_result*) arena_calloc(arena, sizeof(struct batch_result) * count);
+    batch->arena = arena;
+
+    for(size_t i = 0; i < count; i++) {
+        batch->results[i].path = paths[i];
+        batch->results[i].first_mismatch = -1;
+    }
+
+    free(paths);
+
+    return batch;
+}
+
+
+/**
+ * Verifies a range of the packages of a batch, run by the
+ * threads of the pool
+ * @param arg, pointer to batch_job
+ * @param start, index of the first package in the range
+ * @param end, index one past the last package in the range
+ * @param worker, index of the thread running the range
+ */
+static void verify_range(void* arg, size_t start, size_t end, uint32_t worker) {
+    struct batch_job* job = (struct batch_job*) arg;
+
+    for(size_t i = start; i < end; i++) {
+        struct batch_result* result = &job->batch->results[i];
+        struct bpkg_obj* bpkg = bpkg_load(result->path);
+
+        if(bpkg == NULL) {
+            result->status = BATCH_INVALID;
+            continue;
+        }
+
+        struct bpkg_verify res;
+
+        if(bpkg_verify_stream_budget(bpkg, &res, job->budget) != 0) {
+            result->status = BATCH_NO_DATA;
+        } else {
+            result->status = res.ok ? BATCH_SUCCESS : BATCH_FAILED;
+            result->first_mismatch = res.first_mismatch;
+            result->first_offset = res.first_offset;
+        }
+
+        bpkg_verify_destroy(&res);
+        bpkg_obj_destroy(bpkg);
+    }
+}
+
+
+/**
+ * Verifies every package of a batch, spreading the packages
+ * over the threads of a pool. Each package is streamed by
+ * one thread, and every read takes its bytes from the shared
+ * budget so the threads together stay within it
+ * @param batch, batch object to fill in the results of
+ * @param pool, thread pool to verify with (NULL verifies on the calling thread)
+ * @param budget, budget shared by every read (NULL for none)
+ */
+void batch_run(struct batch* batch, struct thread_pool* pool, struct io_budget* budget) {
+    struct batch_job job = { batch, budget };
+
+    // Packages vary in size, so hand them out one at a time
+    pool_parallel_for(pool, batch->n_packages, 1, verify_range, &job);
+}
+
+
+/**
+ * Deallocates a batch and all of its results
+ * @param batch, pointer to batch object
+ */
+void batch_destroy(struct batch* batch) {
+    // The batch lives in its own arena, along with its paths and results
+    arena_destroy(batch->arena);
+}
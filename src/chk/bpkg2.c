@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+#include "add/arena.h"
+#include "add/inputs.h"
+#include "chk/bpkg2.h"
+#include "chk/pkgchk.h"
+#include <endian.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The strings after the header are padded so the digests start 8-byte aligned
+#define BPKG2_PAD(n) (((n) + 7) & ~(uint64_t) 7)
+
+
+/**
+ * Indicates whether the contents of a file start
+ * with the bpkg2 magic
+ * @param data, the contents of the file
+ * @param size, the size of the file
+ */
+int bpkg2_is_binary(const char* data, size_t size) {
+    return (size >= BPKG2_MAGIC_SIZE) && (memcmp(data, BPKG2_MAGIC, BPKG2_MAGIC_SIZE) == 0);
+}
+
+
+/**
+ * Reads a little-endian 64-bit value which may not be aligned
+ * @param data, pointer to the value
+ */
+static uint64_t read_u64(const char* data) {
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return le64toh(value);
+}
+
+
+/**
+ * Indicates whether a string from a bpkg2 file could have
+ * been a line of a text bpkg file
+ * @param str, the string
+ * @param len, the length of the string
+ */
+static int is_valid_line(const char* str, size_t len) {
+    return (memchr(str, '\n', len) == NULL) && (memchr(str, '\0', len) == NULL);
+}
+
+
+/**
+ * Loads a bpkg object from the contents of a bpkg2 file.
+ * The sections are copied straight into the object after
+ * checking the header and that the file is exactly the size
+ * the header describes
+ * @param data, the contents of the file
+ * @param size, the size of the file
+ * @return obj, bpkg object pointer or NULL if the file is invalid
+ */
+struct bpkg_obj* bpkg2_parse(const char* data, size_t size) {
+    struct bpkg2_header hdr;
+
+    if(size < sizeof(hdr))
+        return NULL;
+
+    memcpy(&hdr, data, sizeof(hdr));
+
+    uint32_t version = le32toh(hdr.version);
+    uint32_t flags = le32toh(hdr.flags);
+    uint32_t nhashes = le32toh(hdr.nhashes);
+    uint32_t nchunks = le32toh(hdr.nchunks);
+    uint64_t total_size = le64toh(hdr.size);
+    uint64_t chunk_size = le64toh(hdr.chunk_size);
+    uint16_t ident_len = le16toh(hdr.ident_len);
+    uint16_t filename_len = le16toh(hdr.filename_len);
+
+    if(!bpkg2_is_binary(data, size) || (version != BPKG2_VERSION) || (flags & ~BPKG2_UNIFORM)
+        || (ident_len == 0) || (ident_len >= IDENT_SIZE)
+        || (filename_len == 0) || (filename_len >= FILENAME_SIZE))
+        return NULL;
+
+    int uniform = flags & BPKG2_UNIFORM;
+
+    // Every section has a fixed size, so the file must be exactly as long as they add up to
+    uint64_t strings = BPKG2_PAD((uint64_t) ident_len + filename_len);
+    uint64_t digests = ((uint64_t) nhashes + nchunks) * DIGEST_SIZE;
+    uint64_t arrays = uniform ? 0 : (uint64_t) nchunks * 2 * sizeof(uint64_t);
+
+    if(sizeof(hdr) + strings + digests + arrays != size)
+        return NULL;
+
+    const char* idents = data + sizeof(hdr);
+    const char* hashes = idents + strings;
+    const char* chunk_hashes = hashes + (size_t) nhashes * DIGEST_SIZE;
+    const char* offsets = chunk_hashes + (size_t) nchunks * DIGEST_SIZE;
+    const char* sizes = offsets + (size_t) nchunks * sizeof(uint64_t);
+
+    if(!is_valid_line(idents, ident_len + filename_len))
+        return NULL;
+
+    struct arena* arena = arena_create(sizeof(struct bpkg_obj) + digests + sizeof(struct chunk) * nchunks);
+    struct bpkg_obj* obj = (struct bpkg_obj*) arena_calloc(arena, sizeof(struct bpkg_obj));
+    obj->arena = arena;
+
+    memcpy(obj->ident, idents, ident_len);
+    memcpy(obj->filename, idents + ident_len, filename_len);
+    obj->size = total_size;
+    obj->nhashes = nhashes;
+    obj->nchunks = nchunks;
+
+    if(!is_valid_ident(obj->ident)) {
+        bpkg_obj_destroy(obj);
+        return NULL;
+    }
+
+    // Digests are stored exactly as they're held in memory
+    obj->hashes = (struct digest*) arena_alloc(arena, sizeof(struct digest) * nhashes);
+    memcpy(obj->hashes, hashes, (size_t) nhashes * DIGEST_SIZE);
+
+    obj->chunks = (struct chunk*) arena_alloc(arena, sizeof(struct chunk) * nchunks);
+
+    for(uint32_t i = 0; i < nchunks; i++) {
+        memcpy(&obj->chunks[i].hash, chunk_hashes + (size_t) i * DIGEST_SIZE, DIGEST_SIZE);
+        obj->chunks[i].offset = uniform ? i * chunk_size : read_u64(offsets + i * sizeof(uint64_t));
+        obj->chunks[i].size = uniform ? chunk_size : read_u64(sizes + i * sizeof(uint64_t));
+    }
+
+    return obj;
+}
+
+
+/**
+ * Writes a bpkg object as a bpkg2 file, leaving out the
+ * offset and size arrays when the chunks are evenly sized
+ * and back to back
+ * @param bpkg, constructed bpkg object
+ * @param path, path of the file to write
+ * @return 0 on success, -1 if the file can't be written
+ */
+int bpkg2_save(struct bpkg_obj* bpkg, const char* path) {
+    struct bpkg2_header hdr = { 0 };
+    size_t ident_len = strlen(bpkg->ident);
+    size_t filename_len = strlen(bpkg->filename);
+    uint64_t chunk_size = bpkg->nchunks > 0 ? bpkg->chunks[0].size : 0;
+
+    // The offset and size arrays can be left out when every chunk follows the last
+    int uniform = 1;
+    for(uint32_t i = 0; uniform && (i < bpkg->nchunks); i++)
+        uniform = (bpkg->chunks[i].size == chunk_size) && (bpkg->chunks[i].offset == i * chunk_size);
+
+    memcpy(hdr.magic, BPKG2_MAGIC, BPKG2_MAGIC_SIZE);
+    hdr.version = htole32(BPKG2_VERSION);
+    hdr.flags = htole32(uniform ? BPKG2_UNIFORM : 0);
+    hdr.nhashes = htole32(bpkg->nhashes);
+    hdr.nchunks = htole32(bpkg->nchunks);
+    hdr.size = htole64(bpkg->size);
+    hdr.chunk_size = htole64(uniform ? chunk_size : 0);
+    hdr.ident_len = htole16(ident_len);
+    hdr.filename_len = htole16(filename_len);
+
+    FILE* fp = fopen(path, "wb");
+
+    if(fp == NULL)
+        return -1;
+
+    const char padding[8] = { 0 };
+
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    fwrite(bpkg->ident, 1, ident_len, fp);
+    fwrite(bpkg->filename, 1, filename_len, fp);
+    fwrite(padding, 1, BPKG2_PAD(ident_len + filename_len) - (ident_len + filename_len), fp);
+    fwrite(bpkg->hashes, sizeof(struct digest), bpkg->nhashes, fp);
+
+    for(uint32_t i = 0; i < bpkg->nchunks; i++)
+        fwrite(&bpkg->chunks[i].hash, sizeof(struct digest), 1, fp);
+
+    if(!uniform) {
+        for(uint32_t i = 0; i < bpkg->nchunks; i++) {
+            uint64_t offset = htole64(bpkg->chunks[i].offset);
+            fwrite(&offset, sizeof(offset), 1, fp);
+        }
+
+        for(uint32_t i = 0; i < bpkg->nchunks; i++) {
+            uint64_t length = htole64(bpkg->chunks[i].size);
+            fwrite(&length, sizeof(length), 1, fp);
+        }
+    }
+
+    int err = ferror(fp);
+
+    if((fclose(fp) != 0) || err)
+        return -1;
+
+    return 0;
+}
@@ -0,0 +1,170 @@
+#define _GNU_SOURCE
+#include "chk/cache.h"
+#include "chk/hasher.h"
+#include "chk/pkgchk.h"
+#include "crypt/sha256.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Room for the data file name and the suffix
+#define CACHE_PATH_SIZE (FILENAME_SIZE + sizeof(CACHE_SUFFIX))
+// Files modified this recently aren't cached, a write in the same timestamp tick would go unseen
+#define CACHE_RACY_SECONDS 2
+
+
+/**
+ * Hashes the offset and size of every chunk, so a cache is
+ * never used for a package that splits the file differently
+ * @param bpkg, constructed bpkg object
+ * @param layout, digest to store the result in
+ */
+static void hash_layout(struct bpkg_obj* bpkg, struct digest* layout) {
+    struct sha256_compute_data data;
+    sha256_compute_data_init(&data);
+
+    for(uint32_t i = 0; i < bpkg->nchunks; i++) {
+        uint64_t range[2] = { bpkg->chunks[i].offset, bpkg->chunks[i].size };
+        sha256_update(&data, range, sizeof(range));
+    }
+
+    sha256_finalize(&data, NULL);
+    sha256_output(&data, layout->bytes);
+}
+
+
+/**
+ * Writes all size bytes of a buffer, retrying short writes
+ * @param fd, file descriptor to write to
+ * @param buffer, the bytes to write
+ * @param size, the number of bytes to write
+ * @return 0 on success, -1 on error
+ */
+static int write_all(int fd, const void* buffer, size_t size) {
+    size_t done = 0;
+
+    while(done < size) {
+        ssize_t res = write(fd, (const char*) buffer + done, size - done);
+
+        if(res <= 0)
+            return -1;
+
+        done += res;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Fills in the cache key for the current state of a data
+ * file opened for the package
+ * @param bpkg, constructed bpkg object
+ * @param fd, file descriptor of the data file
+ * @param key, cache key object to fill in
+ * @return 0 on success, -1 if the file can't be examined
+ */
+int cache_key_init(struct bpkg_obj* bpkg, int fd, struct cache_key* key) {
+    struct stat st;
+
+    if(fstat(fd, &st) != 0)
+        return -1;
+
+    memset(key, 0, sizeof(struct cache_key));
+    memcpy(key->magic, CACHE_MAGIC, CACHE_MAGIC_SIZE);
+    key->version = CACHE_VERSION;
+    key->nchunks = bpkg->nchunks;
+    key->size = st.st_size;
+    key->dev = st.st_dev;
+    key->ino = st.st_ino;
+    key->mtime_sec = st.st_mtim.tv_sec;
+    key->mtime_nsec = st.st_mtim.tv_nsec;
+    key->ctime_sec = st.st_ctim.tv_sec;
+    key->ctime_nsec = st.st_ctim.tv_nsec;
+    hash_layout(bpkg, &key->layout);
+
+    return 0;
+}
+
+
+/**
+ * Loads the leaf digests from the sidecar cache of the
+ * data file when the cache was written under the same key
+ * @param bpkg, constructed bpkg object
+ * @param key, cache key of the data file
+ * @param digests, array of nchunks digests to fill in
+ * @return 0 if the digests were loaded, -1 otherwise
+ */
+int cache_load(struct bpkg_obj* bpkg, const struct cache_key* key, struct digest* digests) {
+    char path[CACHE_PATH_SIZE];
+    snprintf(path, sizeof(path), "%s%s", bpkg->filename, CACHE_SUFFIX);
+
+    int fd = open(path, O_RDONLY);
+
+    if(fd < 0)
+        return -1;
+
+    struct cache_key stored;
+    struct stat st;
+    size_t size = sizeof(struct digest) * bpkg->nchunks;
+
+    // Any difference in the key, or a cache of the wrong length, means the file must be hashed
+    int res = (pread(fd, &stored, sizeof(stored), 0) == sizeof(stored))
+        && (memcmp(&stored, key, sizeof(stored)) == 0)
+        && (fstat(fd, &st) == 0) && ((size_t) st.st_size == sizeof(stored) + size);
+
+    if(res)
+        read_block(fd, (char*) digests, size, sizeof(stored));
+
+    close(fd);
+
+    return res ? 0 : -1;
+}
+
+
+/**
+ * Writes the leaf digests to the sidecar cache of the data
+ * file, unless the file changed while it was being hashed or
+ * so recently that a change might not show in its mtime.
+ * The cache is replaced with a rename so readers never see
+ * half of one, and a cache that can't be written is skipped
+ * @param bpkg, constructed bpkg object
+ * @param key, cache key taken before hashing
+ * @param fd, file descriptor of the data file
+ * @param digests, array of nchunks computed leaf digests
+ */
+void cache_save(struct bpkg_obj* bpkg, const struct cache_key* key, int fd,
+    const struct digest* digests) {
+
+    struct cache_key after;
+
+    // A file written to while it was hashed may not match the digests
+    if((cache_key_init(bpkg, fd, &after) != 0) || (memcmp(&after, key, sizeof(after)) != 0))
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    if(key->mtime_sec > now.tv_sec - CACHE_RACY_SECONDS)
+        return;
+
+    char path[CACHE_PATH_SIZE];
+    char tmp[CACHE_PATH_SIZE + 32]; // the cache's path, a pid and a thread id
+    snprintf(path, sizeof(path), "%s%s", bpkg->filename, CACHE_SUFFIX);
+    snprintf(tmp, sizeof(tmp), "%s.%d.%d", path, (int) getpid(), (int) gettid());
+
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if(out < 0)
+        return;
+
+    int res = write_all(out, key, sizeof(struct cache_key))
+        | write_all(out, digests, sizeof(struct digest) * bpkg->nchunks);
+
+    if((close(out) != 0) || (res != 0) || (rename(tmp, path) != 0))
+        unlink(tmp);
+}
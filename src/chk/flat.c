@@ -0,0 +1,135 @@
+#include "add/pool.h"
+#include "chk/flat.h"
+#include "chk/hasher.h"
+#include "chk/pkgchk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * Builds a flat merkle tree using a bpkg object
+ * @param bpkg, constructed bpkg object
+ * @return flat, merkle_flat object pointer, or NULL if
+ * 		the data file can't be read
+ */
+struct merkle_flat* merkle_flat_build(struct bpkg_obj* bpkg) {
+    size_t n_nodes = bpkg->nhashes + bpkg->nchunks;
+
+    // Allocate the tree object and both digest arrays in one go
+    struct merkle_flat* flat = (struct merkle_flat*) malloc(sizeof(struct merkle_flat)
+        + sizeof(struct digest) * n_nodes * 2);
+
+    flat->n_nodes = n_nodes;
+    flat->n_leaves = bpkg->nchunks;
+    flat->expected = (struct digest*) (flat + 1);
+    flat->computed = flat->expected + n_nodes;
+
+    // The bpkg already lists its hashes in heap order, non-leaf hashes then chunks
+    memcpy(flat->expected, bpkg->hashes, sizeof(struct digest) * bpkg->nhashes);
+
+    for(size_t i = 0; i < bpkg->nchunks; i++)
+        flat->expected[bpkg->nhashes + i] = bpkg->chunks[i].hash;
+
+    struct thread_pool* pool = hasher_pool_create(bpkg->nchunks);
+
+    // Hash the leaves straight into the end of the array, then the levels above them
+    if(hash_leaves(bpkg, flat->computed + bpkg->nhashes, NULL, pool) != 0) {
+        perror("Unable to open data file");
+        pool_destroy(pool);
+        free(flat);
+        return NULL;
+    }
+
+    hash_levels(flat->computed, bpkg->nhashes, pool);
+
+    pool_destroy(pool);
+
+    return flat;
+}
+
+
+/**
+ * Stores a digest in hashes and increments len
+ * @param hashes, an array to store hashes
+ * @param len, stores the total number of hashes
+ * @param digest, the digest to be stored
+ */
+static void store_hash(struct digest* hashes, int* len, const struct digest* digest) {
+    hashes[*len] = *digest;
+    (*len)++;
+}
+
+
+/**
+ * Checks whether the computed hash of a node matches its expected hash
+ * @param flat, pointer to flat merkle tree object
+ * @param index, the index of the node
+ */
+static int is_completed(struct merkle_flat* flat, size_t index) {
+    return memcmp(&flat->computed[index], &flat->expected[index], sizeof(struct digest)) == 0;
+}
+
+
+/**
+ * Finds all completed chunks of a flat merkle tree
+ * @param flat, pointer to flat merkle tree object
+ * @param hashes, an array to store completed chunk hashes
+ * @param len, stores the total number of completed chunk hashes
+ */
+void flat_get_completed_chunks(struct merkle_flat* flat, struct digest* hashes, int* len) {
+    // The leaves are the last n_leaves nodes, in chunk order
+    for(size_t i = flat->n_nodes - flat->n_leaves; i < flat->n_nodes; i++) {
+        if(is_completed(flat, i))
+            store_hash(hashes, len, &flat->computed[i]);
+    }
+}
+
+
+/**
+ * A recursive function that finds the minimum completed
+ * hashes below a node of a flat merkle tree, in the same
+ * order as get_completed_hashes()
+ * @param flat, pointer to flat merkle tree object
+ * @param index, initially 0 (the root), the current node
+ * @param hashes, an array to store completed hashes
+ * @param len, stores the total number of completed hashes
+ * @return 1 if every chunk below the node is completed
+ */
+int flat_get_completed_hashes(struct merkle_flat* flat, size_t index,
+    struct digest* hashes, int* len) {
+
+    // If a leaf node, return whether it's a completed chunk hash
+    if(index >= flat->n_nodes - flat->n_leaves)
+        return is_completed(flat, index);
+
+    size_t left = 2 * index + 1;
+    size_t right = 2 * index + 2;
+
+    int res_left = flat_get_completed_hashes(flat, left, hashes, len);
+    int res_right = flat_get_completed_hashes(flat, right, hashes, len);
+
+    // If both children are completed hashes, only store the root (we're done)
+    if((res_left) & (res_right)) {
+        if(index == 0)
+            store_hash(hashes, len, &flat->computed[index]);
+        return 1;
+    // If only one child is a completed hash, store it
+    } else if(res_left) {
+        store_hash(hashes, len, &flat->computed[left]);
+    } else if(res_right) {
+        store_hash(hashes, len, &flat->computed[right]);
+    }
+
+    return 0;
+}
+
+
+/**
+ * Deallocates the memory for a flat merkle tree
+ * @param flat, pointer to flat merkle tree object
+ */
+void merkle_flat_destroy(struct merkle_flat* flat) {
+    // The digest arrays share the tree object's allocation
+    free(flat);
+}
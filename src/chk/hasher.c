@@ -0,0 +1,1076 @@
+#define _GNU_SOURCE
+#include "add/inputs.h"
+#include "add/pool.h"
+#include "chk/cache.h"
+#include "chk/hasher.h"
+#include "chk/holes.h"
+#include "chk/pipeline.h"
+#include "chk/pkgchk.h"
+#include "chk/uring.h"
+#include "chk/zeros.h"
+#include "crypt/sha256.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Number of blocks a thread claims at a time
+#define LEAF_GRAIN 16
+// Number of non-leaf nodes a thread claims at a time
+#define NODE_GRAIN 256
+// Most bytes of data blocks a thread holds for one batch of leaves
+#define BATCH_BYTES (1 << 20)
+// Most reads a thread keeps in flight with READ_URING
+#define URING_DEPTH 128
+// Most bytes of a thread's ring of READ_URING buffers
+#define URING_BYTES (4 << 20)
+// How far back each eviction reaches for pages that were still being read last time
+#define DROP_LAG (2 << 20)
+
+
+/**
+ * leaf job object, holds the state shared by
+ * the threads hashing the leaves of a tree.
+ */
+struct leaf_job {
+    int fd;
+    const struct chunk* chunks; // where each leaf's block lives in the data file
+    const uint32_t* indices; // chunks to hash, NULL to hash every chunk in order
+    size_t piece;    // most bytes of a block read at once, larger blocks are hashed in pieces
+    struct digest* digests;
+    struct merkle_tree_node** leaf_nodes; // NULL when only digests are wanted
+    const char* map; // mapped data file, NULL when reading with pread
+    size_t map_size;
+    int retain_values;
+    uint32_t lanes;  // number of leaves hashed side by side
+    char** buffers;  // one buffer of lanes pieces per thread, allocated on first use
+    struct uring_reader** rings; // one reader per thread with READ_URING, otherwise NULL
+    uint32_t depth;  // reads each ring keeps in flight
+    int direct_fd;   // the data file opened with O_DIRECT, or -1
+    size_t bounce;   // bytes of each lane's O_DIRECT buffer
+    int drop_pages;  // evict each range from the page cache once it's hashed
+};
+
+
+/**
+ * Creates the thread pool used to build a tree, sized by
+ * the nthreads build option. No pool is created when a
+ * single thread is requested or there's too little work
+ * @param nitems, the number of leaves to be hashed
+ * @return pool, thread pool object pointer or NULL
+ */
+struct thread_pool* hasher_pool_create(size_t nitems) {
+    // Only spin up threads when there's more than one range to share
+    if((bpkg_get_opts()->nthreads == 1) || (nitems <= LEAF_GRAIN))
+        return NULL;
+
+    return pool_create(bpkg_get_opts()->nthreads);
+}
+
+
+/**
+ * Reads up to size bytes at offset, retrying short
+ * reads. Bytes past the end of the file are zeroed
+ * @param fd, file descriptor of the data file
+ * @param buffer, buffer to read into
+ * @param size, the number of bytes to read
+ * @param offset, the position in the file to read from
+ */
+void read_block(int fd, char* buffer, size_t size, off_t offset) {
+    size_t done = 0;
+
+    while(done < size) {
+        ssize_t res = pread(fd, buffer + done, size - done, offset + done);
+
+        // End of file or read error, the block is incomplete
+        if(res <= 0)
+            break;
+
+        done += res;
+    }
+
+    memset(buffer + done, '\0', size - done);
+}
+
+
+/**
+ * Reads up to size bytes at offset from a file opened with
+ * O_DIRECT, which bypasses the page cache. The read is
+ * widened to whole DIRECT_ALIGN blocks, so it lands a little
+ * way into the buffer. Bytes past the end of the file are
+ * zeroed, and a read O_DIRECT refuses is made through fd
+ * @param direct_fd, file descriptor opened with O_DIRECT
+ * @param fd, file descriptor of the same file opened normally
+ * @param bounce, DIRECT_ALIGN aligned buffer of size + 2 * DIRECT_ALIGN bytes
+ * @param size, the number of bytes to read
+ * @param offset, the position in the file to read from
+ * @return pointer to the size bytes read
+ */
+const char* read_block_direct(int direct_fd, int fd, char* bounce, size_t size, off_t offset) {
+    off_t start = offset / DIRECT_ALIGN * DIRECT_ALIGN;
+    size_t skip = offset - start;
+    size_t span = (skip + size + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+    size_t done = 0;
+
+    while(done < span) {
+        ssize_t res = pread(direct_fd, bounce + done, span - done, start + done);
+
+        // Some filesystems refuse O_DIRECT reads, so read the block the normal way
+        if(res < 0) {
+            read_block(fd, bounce + skip, size, offset);
+            return bounce + skip;
+        }
+
+        done += res;
+
+        // Only the end of the file gives a read that isn't whole blocks
+        if((res == 0) || (done % DIRECT_ALIGN != 0))
+            break;
+    }
+
+    // Zero whatever lies past the end of the file
+    if(done < skip + size) {
+        size_t from = done > skip ? done : skip;
+        memset(bounce + from, '\0', skip + size - from);
+    }
+
+    return bounce + skip;
+}
+
+
+/**
+ * Evicts a range of a file from the page cache, for the
+ * PAGES_DROP page mode once the range has been hashed
+ * @param fd, file descriptor of the data file
+ * @param offset, the start of the range
+ * @param length, the size of the range
+ */
+void drop_pages(int fd, uint64_t offset, uint64_t length) {
+    // Pages still being read in are skipped, so go back over the range before this one too
+    uint64_t from = offset > DROP_LAG ? offset - DROP_LAG : 0;
+
+    posix_fadvise(fd, (off_t) from, (off_t) (offset + length - from), POSIX_FADV_DONTNEED);
+}
+
+
+/**
+ * Returns the index of the chunk hashed at a position of a job
+ * @param job, pointer to leaf_job
+ * @param pos, position in the job's digests
+ */
+static size_t job_chunk(struct leaf_job* job, size_t pos) {
+    return job->indices != NULL ? job->indices[pos] : pos;
+}
+
+
+/**
+ * Drops the mapped pages that lie wholly inside a hashed
+ * range of blocks so the mapping doesn't grow to the size
+ * of the file. Pages shared with neighbouring ranges are kept
+ * @param job, pointer to leaf_job
+ * @param start, position of the first block
+ * @param end, position one past the last block
+ */
+static void drop_mapped_range(struct leaf_job* job, size_t start, size_t end) {
+    const struct chunk* first = &job->chunks[job_chunk(job, start)];
+    const struct chunk* last = &job->chunks[job_chunk(job, end - 1)];
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t from = (first->offset + page - 1) / page * page;
+    size_t to = last->offset + last->size;
+
+    if(to > job->map_size)
+        to = job->map_size;
+
+    to = to / page * page;
+
+    if(to > from)
+        madvise((void*) (job->map + from), to - from, MADV_DONTNEED);
+}
+
+
+/**
+ * Evicts a hashed range of blocks from the page cache, from
+ * the start of its first block to the end of its last
+ * @param job, pointer to leaf_job
+ * @param start, position of the first block
+ * @param end, position one past the last block
+ */
+static void drop_hashed_range(struct leaf_job* job, size_t start, size_t end) {
+    const struct chunk* first = &job->chunks[job_chunk(job, start)];
+    const struct chunk* last = &job->chunks[job_chunk(job, end - 1)];
+
+    if(last->offset + last->size > first->offset)
+        drop_pages(job->fd, first->offset, last->offset + last->size - first->offset);
+}
+
+
+/**
+ * Fetches a piece of a data block for hashing. Pieces wholly
+ * inside the mapped file are hashed in place, others are read
+ * (or copied from the mapping) into the node's value or a slot
+ * of the thread's buffer. Bytes past the end of the file are
+ * zeroed, the same as a short read
+ * @param job, pointer to leaf_job
+ * @param index, index of the block
+ * @param done, offset of the piece within the block
+ * @param len, size of the piece (at most job->piece)
+ * @param value, the node's value to copy the block into (NULL to skip the copy)
+ * @param worker, index of the calling thread
+ * @param lane, slot of the thread's buffer to read into
+ * @return pointer to the len bytes of the piece
+ */
+static const char* load_block(struct leaf_job* job, size_t index, size_t done, size_t len,
+    char* value, uint32_t worker, uint32_t lane) {
+
+    size_t offset = job->chunks[index].offset + done;
+
+    if((job->map != NULL) && (offset + len <= job->map_size)) {
+        if(value != NULL)
+            memcpy(value + done, job->map + offset, len);
+
+        return job->map + offset;
+    }
+
+    // Direct reads land in the lane's aligned buffer and are hashed from there
+    if(job->direct_fd >= 0) {
+        if(job->buffers[worker] == NULL) {
+            void* bounce = NULL;
+            posix_memalign(&bounce, DIRECT_ALIGN, job->bounce * job->lanes);
+            job->buffers[worker] = (char*) bounce;
+        }
+
+        const char* bytes = read_block_direct(job->direct_fd, job->fd,
+            job->buffers[worker] + lane * job->bounce, len, (off_t) offset);
+
+        if(value != NULL)
+            memcpy(value + done, bytes, len);
+
+        return bytes;
+    }
+
+    char* buffer = value != NULL ? value + done : NULL;
+
+    if(buffer == NULL) {
+        if(job->buffers[worker] == NULL)
+            job->buffers[worker] = (char*) malloc(sizeof(char) * job->piece * job->lanes + 1);
+
+        buffer = job->buffers[worker] + lane * job->piece;
+    }
+
+    // Copy what's left of the mapped file, the rest of the piece is zeros
+    if(job->map != NULL) {
+        size_t avail = offset < job->map_size ? job->map_size - offset : 0;
+        avail = avail < len ? avail : len;
+        memcpy(buffer, job->map + offset, avail);
+        memset(buffer + avail, '\0', len - avail);
+    } else {
+        read_block(job->fd, buffer, len, (off_t) offset);
+    }
+
+    return buffer;
+}
+
+
+/**
+ * Records where a leaf's block lives so it can be fetched
+ * again on demand, and finds where to keep a copy of it
+ * @param job, pointer to leaf_job
+ * @param index, index of the block
+ * @return the node's value to copy the block into, or NULL
+ */
+static char* leaf_value(struct leaf_job* job, size_t index) {
+    if(job->leaf_nodes == NULL)
+        return NULL;
+
+    struct merkle_tree_node* node = job->leaf_nodes[index];
+    node->offset = job->chunks[index].offset;
+    node->length = job->chunks[index].size;
+
+    // Only keep a copy of the block when asked to, in the slot the tree set aside
+    if(!job->retain_values || (node->value == NULL))
+        return NULL;
+
+    char* value = (char*) node->value;
+    value[node->length] = '\0';
+
+    return value;
+}
+
+
+/**
+ * Stores the digests of a finished batch of leaves, either
+ * from the finalized hash state of each leaf or, when buffs
+ * is NULL, already in the job's digests
+ * @param job, pointer to leaf_job
+ * @param first, position of the first leaf of the batch
+ * @param buffs, the finalized hash state of each leaf, or NULL
+ * @param count, the number of leaves in the batch
+ */
+static void store_digests(struct leaf_job* job, size_t first,
+    struct sha256_compute_data* buffs, uint32_t count) {
+
+    for(uint32_t j = 0; j < count; j++) {
+        if(buffs != NULL)
+            sha256_output(&buffs[j], job->digests[first + j].bytes);
+
+        // Store the computed hash in node struct
+        if(job->leaf_nodes != NULL)
+            job->leaf_nodes[job_chunk(job, first + j)]->computed_hash = job->digests[first + j];
+    }
+}
+
+
+/**
+ * Pool task that reads and hashes a range of leaves. The
+ * leaves are hashed in batches of job->lanes blocks so the
+ * SHA-256 backend can run them through its lanes together
+ * @param arg, pointer to leaf_job
+ * @param start, position of the first leaf
+ * @param end, position one past the last leaf
+ * @param worker, index of the calling thread
+ */
+static void hash_leaf_range(void* arg, size_t start, size_t end, uint32_t worker) {
+    struct leaf_job* job = (struct leaf_job*) arg;
+
+    for(size_t first = start; first < end; ) {
+        size_t block_size = job->chunks[job_chunk(job, first)].size;
+        uint32_t count = 1;
+
+        // Only blocks of the same size can share the lanes of a batch
+        while((count < job->lanes) && (first + count < end)
+            && (job->chunks[job_chunk(job, first + count)].size == block_size))
+            count++;
+
+        struct sha256_compute_data buffs[SHA256_MAX_LANES];
+        struct sha256_compute_data* data[SHA256_MAX_LANES];
+        const void* blocks[SHA256_MAX_LANES];
+        char* values[SHA256_MAX_LANES];
+
+        for(uint32_t j = 0; j < count; j++) {
+            values[j] = leaf_value(job, job_chunk(job, first + j));
+            sha256_compute_data_init(&buffs[j]);
+            data[j] = &buffs[j];
+        }
+
+        // Blocks read whole can be checked for zeros before they're hashed
+        if(block_size <= job->piece) {
+            for(uint32_t j = 0; j < count; j++)
+                blocks[j] = load_block(job, job_chunk(job, first + j), 0, block_size, values[j], worker, j);
+
+            hash_blocks(blocks, block_size, count, &job->digests[first]);
+            store_digests(job, first, NULL, count);
+
+            first += count;
+            continue;
+        }
+
+        size_t done = 0;
+
+        // Blocks larger than a piece are read and hashed a piece at a time
+        do {
+            size_t len = block_size - done < job->piece ? block_size - done : job->piece;
+
+            for(uint32_t j = 0; j < count; j++)
+                blocks[j] = load_block(job, job_chunk(job, first + j), done, len, values[j], worker, j);
+
+            sha256_update_multi(data, blocks, len, count);
+            done += len;
+        } while(done < block_size);
+
+        sha256_finalize_multi(data, count);
+        store_digests(job, first, buffs, count);
+
+        first += count;
+    }
+
+    if(job->map != NULL)
+        drop_mapped_range(job, start, end);
+
+    if(job->drop_pages)
+        drop_hashed_range(job, start, end);
+}
+
+
+/**
+ * Pool task that hashes a range of leaves like hash_leaf_range(),
+ * but reads them through the thread's io_uring reader. Reads are
+ * queued up to job->depth blocks ahead of the leaves being hashed,
+ * so the device always has a queue of them to work on rather than
+ * one read at a time. Every block fits in a slot of the ring
+ * @param arg, pointer to leaf_job
+ * @param start, position of the first leaf
+ * @param end, position one past the last leaf
+ * @param worker, index of the calling thread
+ */
+static void hash_leaf_range_uring(void* arg, size_t start, size_t end, uint32_t worker) {
+    struct leaf_job* job = (struct leaf_job*) arg;
+    struct uring_reader* ring = job->rings[worker];
+    size_t queued = start; // the next leaf to queue a read for
+
+    for(size_t first = start; first < end; ) {
+        size_t block_size = job->chunks[job_chunk(job, first)].size;
+        uint32_t count = 1;
+
+        // Only blocks of the same size can share the lanes of a batch
+        while((count < job->lanes) && (first + count < end)
+            && (job->chunks[job_chunk(job, first + count)].size == block_size))
+            count++;
+
+        // Top the ring up, a slot is only reused once its leaf has been hashed
+        while((queued < end) && (queued - first < job->depth)) {
+            const struct chunk* chunk = &job->chunks[job_chunk(job, queued)];
+            uring_reader_queue(ring, queued % job->depth, (off_t) chunk->offset, chunk->size);
+            queued++;
+        }
+
+        const void* blocks[SHA256_MAX_LANES];
+
+        for(uint32_t j = 0; j < count; j++) {
+            char* value = leaf_value(job, job_chunk(job, first + j));
+            blocks[j] = uring_reader_wait(ring, (first + j) % job->depth);
+
+            if(value != NULL)
+                memcpy(value, blocks[j], block_size);
+        }
+
+        hash_blocks(blocks, block_size, count, &job->digests[first]);
+        store_digests(job, first, NULL, count);
+
+        first += count;
+    }
+
+    if(job->drop_pages)
+        drop_hashed_range(job, start, end);
+}
+
+
+/**
+ * leaf reader object, the reader thread's place
+ * in a pipelined job.
+ */
+struct leaf_reader {
+    struct leaf_job* job;
+    size_t count;          // the number of leaves in the job
+    struct read_step step; // the next batch of pieces to read
+};
+
+
+/**
+ * Reads the next batch of pieces of a pipelined job into a
+ * slot, one lane after another. Run on the reader thread
+ * @param arg, pointer to leaf_reader
+ * @param buffer, the slot to fill
+ * @return 1 if the slot was filled, 0 once every leaf has been read
+ */
+static int fill_leaf_step(void* arg, char* buffer) {
+    struct leaf_reader* reader = (struct leaf_reader*) arg;
+    struct leaf_job* job = reader->job;
+    struct read_step* step = &reader->step;
+
+    if(!read_step_next(job->chunks, job->indices, reader->count, job->lanes, job->piece, NULL, step))
+        return 0;
+
+    const struct chunk* first = &job->chunks[job_chunk(job, step->first)];
+
+    if(step->contiguous) {
+        read_block(job->fd, buffer, step->len * step->count, (off_t) (first->offset + step->done));
+    } else {
+        for(size_t j = 0; j < step->count; j++)
+            read_block(job->fd, buffer + j * step->len, step->len,
+                (off_t) (job->chunks[job_chunk(job, step->first + j)].offset + step->done));
+    }
+
+    return 1;
+}
+
+
+/**
+ * Hashes every leaf of a job like hash_leaf_range(), while a
+ * reader thread reads ahead into a ring of ring_slots buffers,
+ * so reading the next batch overlaps hashing this one instead
+ * of the two taking turns on one thread
+ * @param job, pointer to leaf_job
+ * @param count, the number of leaves in the job
+ * @param slots, the number of buffers in the ring
+ */
+static void hash_leaf_pipeline(struct leaf_job* job, size_t count, uint32_t slots) {
+    struct leaf_reader reader = { job, count, { 0 } };
+    struct read_pipeline* pipeline = pipeline_start(slots, job->piece * job->lanes, fill_leaf_step, &reader);
+    struct read_step step = { 0 };
+
+    struct sha256_compute_data buffs[SHA256_MAX_LANES];
+    struct sha256_compute_data* data[SHA256_MAX_LANES];
+    const void* blocks[SHA256_MAX_LANES];
+    char* values[SHA256_MAX_LANES];
+
+    while(read_step_next(job->chunks, job->indices, count, job->lanes, job->piece, NULL, &step)) {
+        if(step.done == 0) {
+            for(size_t j = 0; j < step.count; j++) {
+                values[j] = leaf_value(job, job_chunk(job, step.first + j));
+                sha256_compute_data_init(&buffs[j]);
+                data[j] = &buffs[j];
+            }
+        }
+
+        const char* bytes = pipeline_take(pipeline);
+
+        if(bytes == NULL)
+            break;
+
+        for(size_t j = 0; j < step.count; j++) {
+            blocks[j] = bytes + j * step.len;
+
+            if(values[j] != NULL)
+                memcpy(values[j] + step.done, blocks[j], step.len);
+        }
+
+        // A block read in one piece can be checked for zeros before it's hashed
+        int whole = (step.done == 0) && read_step_last(job->chunks, job->indices, &step);
+
+        if(whole)
+            hash_blocks(blocks, step.len, step.count, &job->digests[step.first]);
+        else
+            sha256_update_multi(data, blocks, step.len, step.count);
+
+        pipeline_give_back(pipeline);
+
+        if(!read_step_last(job->chunks, job->indices, &step))
+            continue;
+
+        if(!whole)
+            sha256_finalize_multi(data, step.count);
+
+        store_digests(job, step.first, whole ? NULL : buffs, step.count);
+
+        if(job->drop_pages)
+            drop_hashed_range(job, step.first, step.first + step.count);
+    }
+
+    pipeline_stop(pipeline);
+}
+
+
+/**
+ * Creates an io_uring reader for each thread of a job. When
+ * io_uring isn't available none are kept and the job falls
+ * back to reading with pread
+ * @param job, pointer to leaf_job, with its piece and lanes set
+ * @param nthreads, the number of threads hashing the job
+ */
+static void start_rings(struct leaf_job* job, uint32_t nthreads) {
+    // Enough reads in flight to cover a batch, within URING_BYTES of slots
+    job->depth = URING_BYTES / job->piece;
+    job->depth = job->depth > URING_DEPTH ? URING_DEPTH : job->depth;
+    job->depth = job->depth < job->lanes ? job->lanes : job->depth;
+
+    job->rings = (struct uring_reader**) calloc(nthreads, sizeof(struct uring_reader*));
+
+    for(uint32_t i = 0; i < nthreads; i++) {
+        job->rings[i] = uring_reader_create(job->fd, job->depth, job->piece);
+
+        if(job->rings[i] == NULL) {
+            for(uint32_t j = 0; j < i; j++)
+                uring_reader_destroy(job->rings[j]);
+
+            free(job->rings);
+            job->rings = NULL;
+            return;
+        }
+    }
+}
+
+
+/**
+ * Reads and hashes a set of data blocks over a pool of threads
+ * @param bpkg, constructed bpkg object
+ * @param fd, file descriptor of the data file
+ * @param indices, the chunks to hash in order, or NULL for every chunk
+ * @param count, the number of chunks to hash
+ * @param digests, array of count digests to fill in
+ * @param leaf_nodes, array of nchunks leaf nodes indexed by chunk, or NULL
+ * @param retain_values, whether to copy each block into its leaf's value
+ * @param pool, thread pool to hash with (NULL hashes on the calling thread)
+ */
+static void read_leaf_job(struct bpkg_obj* bpkg, int fd, const uint32_t* indices, size_t count,
+    struct digest* digests, struct merkle_tree_node** leaf_nodes, int retain_values,
+    struct thread_pool* pool) {
+
+    struct leaf_job job = { 0 };
+    job.fd = fd;
+    job.direct_fd = -1;
+    job.chunks = bpkg->chunks;
+    job.indices = indices;
+    job.digests = digests;
+    job.leaf_nodes = leaf_nodes;
+
+    struct stat st;
+
+    // Map the data file when asked to, reading with pread if it can't be mapped
+    if((bpkg_get_opts()->read_mode == READ_MMAP) && (fstat(fd, &st) == 0) && (st.st_size > 0)) {
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+        if(map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            job.map = map;
+            job.map_size = st.st_size;
+        }
+    }
+
+    job.retain_values = retain_values;
+
+    // Size the buffers for the largest block
+    size_t block_size = 0;
+
+    for(size_t i = 0; i < count; i++) {
+        if(bpkg->chunks[job_chunk(&job, i)].size > block_size)
+            block_size = bpkg->chunks[job_chunk(&job, i)].size;
+    }
+
+    // A lone hashing thread can hand its reads to a reader thread, which reads into ring slots
+    const struct bpkg_opts* opts = bpkg_get_opts();
+    int pipelined = (pool == NULL) && (opts->ring_slots > 0) && (job.map == NULL) && (opts->read_mode == READ_PREAD)
+        && (opts->page_mode != PAGES_DIRECT);
+    size_t batch_bytes = pipelined && (opts->ring_slot_bytes > 0) ? opts->ring_slot_bytes : BATCH_BYTES;
+
+    // Batch as many blocks as the backend has lanes, within batch_bytes per thread
+    job.lanes = sha256_multi_lanes();
+    job.piece = block_size < batch_bytes ? block_size : batch_bytes;
+
+    if((block_size > 0) && (job.lanes * block_size > batch_bytes))
+        job.lanes = block_size < batch_bytes ? batch_bytes / block_size : 1;
+
+    // Blocks are read into a buffer owned by the thread
+    job.buffers = (char**) calloc(pool_size(pool), sizeof(char*));
+
+    // Give each thread a ring of reads when every block fits in one of its slots
+    if((bpkg_get_opts()->read_mode == READ_URING) && (block_size > 0) && (block_size <= BATCH_BYTES))
+        start_rings(&job, pool_size(pool));
+
+    // Read around the page cache when asked to, or drop what was read where O_DIRECT can't be used
+    enum bpkg_page_mode page_mode = bpkg_get_opts()->page_mode;
+
+    if((page_mode == PAGES_DIRECT) && (job.map == NULL) && (job.rings == NULL)) {
+        job.direct_fd = open(bpkg->filename, O_RDONLY | O_DIRECT);
+        job.bounce = (job.piece + 3 * DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+    }
+
+    job.drop_pages = (page_mode == PAGES_DROP) || ((page_mode == PAGES_DIRECT) && (job.direct_fd < 0));
+
+    if(pipelined)
+        hash_leaf_pipeline(&job, count, opts->ring_slots);
+    else
+        pool_parallel_for(pool, count, LEAF_GRAIN,
+            job.rings != NULL ? hash_leaf_range_uring : hash_leaf_range, &job);
+
+    if(job.direct_fd >= 0)
+        close(job.direct_fd);
+
+    for(uint32_t i = 0; i < pool_size(pool); i++) {
+        free(job.buffers[i]);
+
+        if(job.rings != NULL)
+            uring_reader_destroy(job.rings[i]);
+    }
+
+    free(job.buffers);
+    free(job.rings);
+
+    if(job.map != NULL)
+        munmap((void*) job.map, job.map_size);
+}
+
+
+/**
+ * Hashes a set of data blocks like read_leaf_job(), except that
+ * blocks lying wholly in holes of a sparse data file get the
+ * digest of zeros of their size without being read. Only the
+ * rest of the blocks are read, as a job of their own. Every
+ * chunk maps the holes of the whole file once, while a chosen
+ * few probe just their own ranges
+ * @param bpkg, constructed bpkg object
+ * @param fd, file descriptor of the data file
+ * @param indices, the chunks to hash in order, or NULL for every chunk
+ * @param count, the number of chunks to hash
+ * @param digests, array of count digests to fill in
+ * @param leaf_nodes, array of nchunks leaf nodes indexed by chunk, or NULL
+ * @param retain_values, whether to copy each block into its leaf's value
+ * @param pool, thread pool to hash with (NULL hashes on the calling thread)
+ */
+static void hash_leaf_job(struct bpkg_obj* bpkg, int fd, const uint32_t* indices, size_t count,
+    struct digest* digests, struct merkle_tree_node** leaf_nodes, int retain_values,
+    struct thread_pool* pool) {
+
+    struct hole_map* holes = indices == NULL ? hole_map_load(fd) : NULL;
+
+    if((indices == NULL) && (holes == NULL)) {
+        read_leaf_job(bpkg, fd, indices, count, digests, leaf_nodes, retain_values, pool);
+        return;
+    }
+
+    uint32_t* rest = (uint32_t*) malloc(sizeof(uint32_t) * count + 1);
+    size_t* where = (size_t*) malloc(sizeof(size_t) * count + 1);
+    size_t n_rest = 0;
+
+    for(size_t i = 0; i < count; i++) {
+        uint32_t index = indices != NULL ? indices[i] : i;
+        const struct chunk* chunk = &bpkg->chunks[index];
+
+        int hole = indices == NULL ? hole_map_is_hole(holes, chunk->offset, chunk->size)
+            : hole_probe(fd, chunk->offset, chunk->size);
+
+        if(!hole) {
+            rest[n_rest] = index;
+            where[n_rest++] = i;
+            continue;
+        }
+
+        zero_digest(chunk->size, &digests[i]);
+
+        if(leaf_nodes != NULL) {
+            struct merkle_tree_node* node = leaf_nodes[index];
+            node->offset = chunk->offset;
+            node->length = chunk->size;
+            node->computed_hash = digests[i];
+
+            if(retain_values && (node->value != NULL))
+                memset(node->value, '\0', chunk->size + 1);
+        }
+    }
+
+    // The blocks with data are hashed into their own digests, then put back in place
+    if(n_rest == count) {
+        read_leaf_job(bpkg, fd, indices, count, digests, leaf_nodes, retain_values, pool);
+    } else if(n_rest > 0) {
+        struct digest* rest_digests = (struct digest*) malloc(sizeof(struct digest) * n_rest);
+        read_leaf_job(bpkg, fd, rest, n_rest, rest_digests, leaf_nodes, retain_values, pool);
+
+        for(size_t i = 0; i < n_rest; i++)
+            digests[where[i]] = rest_digests[i];
+
+        free(rest_digests);
+    }
+
+    free(where);
+    free(rest);
+    hole_map_destroy(holes);
+}
+
+
+/**
+ * Hashes every data block of a bpkg data file into an array
+ * of digests, each block being the bytes [offset, offset + size)
+ * of its chunk. When leaf nodes are given, each one also gets
+ * the hash and records the block's offset and length (keeping
+ * a copy of the block in value only with the retain_values
+ * build option). Ranges of blocks are spread over a pool of
+ * worker threads which each read their blocks with pread, so
+ * no file position is shared. With the READ_MMAP read mode
+ * the blocks are hashed straight from the mapped file instead.
+ * With the use_cache build option the digests come from the
+ * data file's sidecar cache while the file is unchanged, and
+ * the cache is rewritten whenever the file has to be hashed.
+ * Hashing on a single thread, the ring_slots build option
+ * hands the reads to a reader thread filling a ring ahead.
+ * Blocks in holes of a sparse data file aren't read at all.
+ * Each thread hashes runs of same-sized blocks in batches as
+ * wide as the lanes of the SHA-256 backend
+ * @param bpkg, constructed bpkg object
+ * @param digests, array of nchunks digests to fill in
+ * @param leaf_nodes, array of nchunks allocated leaf nodes, or NULL
+ * @param pool, thread pool to hash with (NULL hashes on the calling thread)
+ * @return 0 on success, -1 if the data file can't be opened
+ */
+int hash_leaves(struct bpkg_obj* bpkg, struct digest* digests,
+    struct merkle_tree_node** leaf_nodes, struct thread_pool* pool) {
+
+    int fd = open(bpkg->filename, O_RDONLY);
+
+    if(fd < 0)
+        return -1;
+
+    struct cache_key key;
+    int retain_values = (leaf_nodes != NULL) && bpkg_get_opts()->retain_values;
+
+    // Kept copies of the blocks can only come from reading them
+    int use_cache = bpkg_get_opts()->use_cache && !retain_values
+        && (cache_key_init(bpkg, fd, &key) == 0);
+
+    // An unchanged data file already has its digests in the cache
+    if(use_cache && (cache_load(bpkg, &key, digests) == 0)) {
+        for(uint32_t i = 0; (leaf_nodes != NULL) && (i < bpkg->nchunks); i++) {
+            leaf_nodes[i]->offset = bpkg->chunks[i].offset;
+            leaf_nodes[i]->length = bpkg->chunks[i].size;
+            leaf_nodes[i]->computed_hash = digests[i];
+        }
+
+        close(fd);
+        return 0;
+    }
+
+    hash_leaf_job(bpkg, fd, NULL, bpkg->nchunks, digests, leaf_nodes, retain_values, pool);
+
+    if(use_cache)
+        cache_save(bpkg, &key, fd, digests);
+
+    close(fd);
+
+    return 0;
+}
+
+
+/**
+ * Hashes some of the data blocks of a bpkg data file, such as
+ * the chunks a write has touched, the same way as hash_leaves()
+ * but without the sidecar cache
+ * @param bpkg, constructed bpkg object
+ * @param indices, the chunks to hash in ascending order
+ * @param count, the number of chunks to hash
+ * @param digests, array of count digests to fill in
+ * @param leaf_nodes, array of nchunks leaf nodes indexed by chunk, or NULL
+ * @param pool, thread pool to hash with (NULL hashes on the calling thread)
+ * @return 0 on success, -1 if the data file can't be opened
+ */
+int hash_leaves_of(struct bpkg_obj* bpkg, const uint32_t* indices, size_t count,
+    struct digest* digests, struct merkle_tree_node** leaf_nodes, struct thread_pool* pool) {
+
+    int fd = open(bpkg->filename, O_RDONLY);
+
+    if(fd < 0)
+        return -1;
+
+    int retain_values = (leaf_nodes != NULL) && bpkg_get_opts()->retain_values;
+    hash_leaf_job(bpkg, fd, indices, count, digests, leaf_nodes, retain_values, pool);
+    close(fd);
+
+    return 0;
+}
+
+
+/**
+ * Hashes a batch of same-sized whole blocks into their digests.
+ * Blocks that are all zeros get the kept digest of zeros of
+ * their size, only the rest go through the SHA-256 lanes
+ * @param blocks, the blocks
+ * @param size, the size of each block
+ * @param count, the number of blocks
+ * @param outs, array of count digests to store the results in
+ */
+void hash_blocks(const void** blocks, size_t size, size_t count, struct digest* outs) {
+    struct sha256_compute_data buffs[SHA256_MAX_LANES];
+    struct sha256_compute_data* data[SHA256_MAX_LANES];
+    const void* lanes[SHA256_MAX_LANES];
+    size_t where[SHA256_MAX_LANES];
+    uint32_t n = 0;
+
+    for(size_t j = 0; j < count; j++) {
+        if(is_zero_block(blocks[j], size)) {
+            zero_digest(size, &outs[j]);
+        } else {
+            sha256_compute_data_init(&buffs[n]);
+            data[n] = &buffs[n];
+            lanes[n] = blocks[j];
+            where[n++] = j;
+        }
+
+        // Hash the blocks with data whenever the lanes fill up, and at the end
+        if((n == SHA256_MAX_LANES) || ((j + 1 == count) && (n > 0))) {
+            sha256_update_multi(data, lanes, size, n);
+            sha256_finalize_multi(data, n);
+
+            for(uint32_t k = 0; k < n; k++)
+                sha256_output(&buffs[k], outs[where[k]].bytes);
+
+            n = 0;
+        }
+    }
+}
+
+
+/**
+ * Hashes up to SHA256_MAX_LANES pairs of child digests side
+ * by side, each parent being the hash of the hexadecimal forms
+ * of its two children joined together. The parent of two
+ * all-zero subtrees comes from the kept digests of zeros
+ * @param lefts, digests of the left children
+ * @param rights, digests of the right children
+ * @param outs, digests to store the results in
+ * @param count, the number of pairs
+ */
+void hash_pairs(const struct digest** lefts, const struct digest** rights,
+    struct digest** outs, uint32_t count) {
+
+    char combined_hash[SHA256_MAX_LANES][(HASH_SIZE - 1) * 2];
+    struct sha256_compute_data buffs[SHA256_MAX_LANES];
+    struct sha256_compute_data* data[SHA256_MAX_LANES];
+    const void* bytes[SHA256_MAX_LANES];
+    uint32_t where[SHA256_MAX_LANES];
+    uint32_t n = 0;
+
+    for(uint32_t j = 0; j < count; j++) {
+        // Only identical siblings can be all-zero subtrees
+        if((memcmp(lefts[j], rights[j], sizeof(struct digest)) == 0) && zero_parent(lefts[j], outs[j]))
+            continue;
+
+        digest_to_hash(lefts[j], combined_hash[n]);
+        digest_to_hash(rights[j], combined_hash[n] + HASH_SIZE - 1);
+        sha256_compute_data_init(&buffs[n]);
+        data[n] = &buffs[n];
+        bytes[n] = combined_hash[n];
+        where[n++] = j;
+    }
+
+    if(n == 0)
+        return;
+
+    sha256_update_multi(data, bytes, sizeof(combined_hash[0]), n);
+    sha256_finalize_multi(data, n);
+
+    for(uint32_t k = 0; k < n; k++)
+        sha256_output(&buffs[k], outs[where[k]]->bytes);
+}
+
+
+/**
+ * Pool task that hashes a range of non-leaf nodes
+ * @param arg, array of non-leaf nodes
+ * @param start, index of the first node
+ * @param end, index one past the last node
+ * @param worker, index of the calling thread (unused)
+ */
+static void hash_node_range(void* arg, size_t start, size_t end, uint32_t worker) {
+    struct merkle_tree_node** nodes = (struct merkle_tree_node**) arg;
+    const struct digest* lefts[SHA256_MAX_LANES];
+    const struct digest* rights[SHA256_MAX_LANES];
+    struct digest* outs[SHA256_MAX_LANES];
+
+    for(size_t first = start; first < end; first += SHA256_MAX_LANES) {
+        uint32_t count = end - first < SHA256_MAX_LANES ? end - first : SHA256_MAX_LANES;
+
+        for(uint32_t j = 0; j < count; j++) {
+            struct merkle_tree_node* node = nodes[first + j];
+            lefts[j] = &node->left->computed_hash;
+            rights[j] = &node->right->computed_hash;
+            outs[j] = &node->computed_hash;
+        }
+
+        hash_pairs(lefts, rights, outs, count);
+    }
+}
+
+
+/**
+ * Hashes one level of non-leaf nodes from the computed hashes
+ * of their children. The nodes of a level are independent, so
+ * ranges of them are spread over the threads of the pool
+ * @param nodes, array of non-leaf nodes on the same level
+ * @param count, the number of nodes
+ * @param pool, thread pool to hash with (NULL hashes on the calling thread)
+ */
+void hash_non_leaves(struct merkle_tree_node** nodes, size_t count,
+    struct thread_pool* pool) {
+
+    pool_parallel_for(pool, count, NODE_GRAIN, hash_node_range, nodes);
+}
+
+
+/**
+ * level job object, holds the state shared by the
+ * threads hashing one level of a heap-ordered tree.
+ */
+struct level_job {
+    struct digest* digests;
+    size_t level_start;
+};
+
+
+/**
+ * Pool task that hashes a range of nodes on one level
+ * of a heap-ordered array of digests
+ * @param arg, pointer to level_job
+ * @param start, index of the first node within the level
+ * @param end, index one past the last node within the level
+ * @param worker, index of the calling thread (unused)
+ */
+static void hash_level_range(void* arg, size_t start, size_t end, uint32_t worker) {
+    struct level_job* job = (struct level_job*) arg;
+    const struct digest* lefts[SHA256_MAX_LANES];
+    const struct digest* rights[SHA256_MAX_LANES];
+    struct digest* outs[SHA256_MAX_LANES];
+
+    for(size_t first = job->level_start + start; first < job->level_start + end; first += SHA256_MAX_LANES) {
+        uint32_t count = job->level_start + end - first < SHA256_MAX_LANES
+            ? job->level_start + end - first : SHA256_MAX_LANES;
+
+        for(uint32_t j = 0; j < count; j++) {
+            size_t i = first + j;
+            lefts[j] = &job->digests[2 * i + 1];
+            rights[j] = &job->digests[2 * i + 2];
+            outs[j] = &job->digests[i];
+        }
+
+        hash_pairs(lefts, rights, outs, count);
+    }
+}
+
+
+/**
+ * Hashes the non-leaf digests of a heap-ordered array
+ * (children of i at 2i + 1 and 2i + 2) from the leaf digests
+ * stored after them, one level at a time from the bottom up.
+ * Each level is split into ranges across the pool
+ * @param digests, array of 2 * nhashes + 1 digests, non-leaf then leaf
+ * @param nhashes, the number of non-leaf digests
+ * @param pool, thread pool to hash with (NULL hashes on the calling thread)
+ */
+void hash_levels(struct digest* digests, size_t nhashes, struct thread_pool* pool) {
+    struct level_job job = { 0 };
+    job.digests = digests;
+
+    // Each level of a perfect tree holds the nodes [2^l - 1, 2^(l+1) - 1)
+    size_t level_size = (nhashes + 1) / 2;
+
+    while(level_size > 0) {
+        job.level_start = level_size - 1;
+        pool_parallel_for(pool, level_size, NODE_GRAIN, hash_level_range, &job);
+        level_size /= 2;
+    }
+}
+
+
+/**
+ * Reads the data block of a leaf node from the data file,
+ * for hash-only trees which don't keep the block in value
+ * @param bpkg, constructed bpkg object
+ * @param node, a leaf node of a tree built from bpkg
+ * @param buffer, buffer of at least node->length bytes
+ * @return the number of bytes read, or -1 on error
+ */
+ssize_t merkle_node_read(struct bpkg_obj* bpkg, struct merkle_tree_node* node,
+    void* buffer) {
+
+    if(!node->is_leaf)
+        return -1;
+
+    int fd = open(bpkg->filename, O_RDONLY);
+
+    if(fd < 0)
+        return -1;
+
+    size_t done = 0;
+
+    while(done < node->length) {
+        ssize_t res = pread(fd, (char*) buffer + done, node->length - done, node->offset + done);
+
+        if(res <= 0)
+            break;
+
+        done += res;
+    }
+
+    close(fd);
+
+    return done;
+}
@@ -0,0 +1,118 @@
+#define _GNU_SOURCE
+#include "chk/holes.h"
+#include "chk/pkgchk.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Finds the data ranges of a file with SEEK_DATA and
+ * SEEK_HOLE. Files without holes, and filesystems that
+ * can't report them, get no map
+ * @param fd, file descriptor of the data file
+ * @return map, hole map object pointer or NULL
+ */
+struct hole_map* hole_map_load(int fd) {
+    struct stat st;
+
+    if((fstat(fd, &st) != 0) || (st.st_size == 0))
+        return NULL;
+
+    struct hole_map* map = (struct hole_map*) calloc(1, sizeof(struct hole_map));
+    off_t offset = 0;
+
+    while(offset < st.st_size) {
+        off_t data = lseek(fd, offset, SEEK_DATA);
+
+        // ENXIO means there's no data past offset, anything else means holes can't be found
+        if((data < 0) && (errno == ENXIO))
+            break;
+
+        off_t hole = data >= 0 ? lseek(fd, data, SEEK_HOLE) : -1;
+
+        if(hole < 0) {
+            hole_map_destroy(map);
+            return NULL;
+        }
+
+        // Grow the array by doubling
+        if((map->n_extents & (map->n_extents - 1)) == 0)
+            map->extents = (struct byte_range*) realloc(map->extents, sizeof(struct byte_range) * (map->n_extents ? map->n_extents * 2 : 1));
+
+        map->extents[map->n_extents].offset = data;
+        map->extents[map->n_extents].length = hole - data;
+        map->n_extents++;
+        offset = hole;
+    }
+
+    // A file that's data from end to end gains nothing from the map
+    if((map->n_extents == 1) && (map->extents[0].offset == 0)
+        && (map->extents[0].length >= (uint64_t) st.st_size)) {
+        hole_map_destroy(map);
+        return NULL;
+    }
+
+    return map;
+}
+
+
+/**
+ * Indicates whether a range of the file lies wholly
+ * in holes, so it's known to read as zeros
+ * @param map, pointer to hole map object (NULL for none)
+ * @param offset, start of the range
+ * @param length, size of the range
+ */
+int hole_map_is_hole(const struct hole_map* map, uint64_t offset, uint64_t length) {
+    if(map == NULL)
+        return 0;
+
+    // Find the first extent ending after offset
+    size_t lo = 0;
+    size_t hi = map->n_extents;
+
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if(map->extents[mid].offset + map->extents[mid].length <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return (lo == map->n_extents) || (map->extents[lo].offset >= offset + length);
+}
+
+
+/**
+ * Indicates whether a range of the file lies wholly in
+ * holes by asking the file directly, for when only a few
+ * ranges are wanted and walking the whole file would cost
+ * more than it saves
+ * @param fd, file descriptor of the data file
+ * @param offset, start of the range
+ * @param length, size of the range
+ */
+int hole_probe(int fd, uint64_t offset, uint64_t length) {
+    off_t data = lseek(fd, (off_t) offset, SEEK_DATA);
+
+    // ENXIO means there's no data past offset, anything else means holes can't be found
+    if(data < 0)
+        return errno == ENXIO;
+
+    return (uint64_t) data >= offset + length;
+}
+
+
+/**
+ * Deallocates a hole map
+ * @param map, pointer to hole map object (NULL does nothing)
+ */
+void hole_map_destroy(struct hole_map* map) {
+    if(map == NULL)
+        return;
+
+    free(map->extents);
+    free(map);
+}
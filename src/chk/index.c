@@ -0,0 +1,92 @@
+#include "add/arena.h"
+#include "chk/index.h"
+#include "chk/pkgchk.h"
+#include <stdint.h>
+#include <string.h>
+
+
+/**
+ * Gets the expected hash of the node at a heap position
+ * @param bpkg, constructed bpkg object
+ * @param pos, the heap position of the node
+ */
+static const struct digest* expected_at(struct bpkg_obj* bpkg, size_t pos) {
+    return pos < bpkg->nhashes ? &bpkg->hashes[pos] : &bpkg->chunks[pos - bpkg->nhashes].hash;
+}
+
+
+/**
+ * Picks the first slot to probe for a hash. SHA256 output
+ * is already evenly spread, so its leading bytes will do
+ * @param index, hash index object
+ * @param hash, the hash being placed or looked up
+ */
+static size_t first_slot(const struct hash_index* index, const struct digest* hash) {
+    uint64_t bits;
+    memcpy(&bits, hash->bytes, sizeof(bits));
+
+    return bits & index->mask;
+}
+
+
+/**
+ * Gets the hash index of a bpkg object, building it the
+ * first time it's asked for. The index is kept with the
+ * object and freed along with it
+ * @param bpkg, constructed bpkg object
+ * @return index, hash index object pointer
+ */
+struct hash_index* bpkg_hash_index(struct bpkg_obj* bpkg) {
+    if(bpkg->index != NULL)
+        return bpkg->index;
+
+    size_t n_nodes = (size_t) bpkg->nhashes + bpkg->nchunks;
+    size_t n_slots = 16;
+
+    // Keep the table at most half full so probe runs stay short
+    while(n_slots < n_nodes * 2)
+        n_slots *= 2;
+
+    struct hash_index* index = (struct hash_index*) arena_alloc(bpkg->arena, sizeof(struct hash_index));
+    index->mask = n_slots - 1;
+    index->slots = (uint64_t*) arena_calloc(bpkg->arena, sizeof(uint64_t) * n_slots);
+
+    for(size_t pos = 0; pos < n_nodes; pos++) {
+        const struct digest* hash = expected_at(bpkg, pos);
+        size_t slot = first_slot(index, hash);
+
+        // Probe until an empty slot, skipping the node if an earlier one has its hash
+        while((index->slots[slot] != 0)
+            && (memcmp(expected_at(bpkg, index->slots[slot] - 1), hash, DIGEST_SIZE) != 0))
+            slot = (slot + 1) & index->mask;
+
+        if(index->slots[slot] == 0)
+            index->slots[slot] = pos + 1;
+    }
+
+    bpkg->index = index;
+
+    return index;
+}
+
+
+/**
+ * Finds the node with a given expected hash. When several
+ * nodes share a hash the first in heap order is returned
+ * @param bpkg, constructed bpkg object
+ * @param index, hash index of the bpkg object
+ * @param hash, the expected hash of the node being searched for
+ * @return the heap position of the node, or -1 if there's no such node
+ */
+ssize_t hash_index_find(struct bpkg_obj* bpkg, const struct hash_index* index,
+    const struct digest* hash) {
+
+    for(size_t slot = first_slot(index, hash); index->slots[slot] != 0; slot = (slot + 1) & index->mask) {
+        size_t pos = index->slots[slot] - 1;
+
+        if(memcmp(expected_at(bpkg, pos), hash, DIGEST_SIZE) == 0)
+            return pos;
+    }
+
+    return -1;
+}
@@ -0,0 +1,231 @@
+#include "chk/pipeline.h"
+#include "chk/pkgchk.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+
+struct read_pipeline {
+    pthread_t reader;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;  // signalled when the reader fills a slot or finishes
+    pthread_cond_t emptied; // signalled when a slot is given back or the pipeline stops
+    char** slots;
+    uint32_t ring_size;
+    uint64_t head; // slots filled so far
+    uint64_t tail; // slots given back so far
+    int finished;  // the reader has nothing left to read
+    int stop;      // the hashing side has stopped taking slots
+
+    pipeline_fill fill;
+    void* arg;
+};
+
+
+/**
+ * Returns the chunk read at a position of a plan
+ * @param chunks, the chunks of the bpkg object
+ * @param indices, the chunks being read, or NULL for every chunk
+ * @param pos, the position in the plan
+ */
+static const struct chunk* step_chunk(const struct chunk* chunks, const uint32_t* indices, size_t pos) {
+    return &chunks[indices != NULL ? indices[pos] : pos];
+}
+
+
+/**
+ * Moves a read step on to the next piece of the plan. A
+ * zeroed step moves to the start of the first chunk
+ * @param chunks, the chunks of the bpkg object
+ * @param indices, the chunks to read in order, or NULL for every chunk
+ * @param n, the number of chunks to read
+ * @param max_count, the most chunks of a run
+ * @param piece, the most bytes of each chunk read in one step
+ * @param holes, hole map of the data file (NULL for none)
+ * @param step, read step object to move on
+ * @return 1 if there's a next step, 0 once every chunk has been read
+ */
+int read_step_next(const struct chunk* chunks, const uint32_t* indices, size_t n,
+    size_t max_count, size_t piece, const struct hole_map* holes, struct read_step* step) {
+
+    // The next piece of the same run
+    if((step->count > 0) && !read_step_last(chunks, indices, step)) {
+        uint64_t size = step_chunk(chunks, indices, step->first)->size;
+
+        step->done += step->len;
+        step->len = size - step->done < piece ? size - step->done : piece;
+        return 1;
+    }
+
+    size_t first = step->first + step->count;
+
+    if(first >= n)
+        return 0;
+
+    const struct chunk* start = step_chunk(chunks, indices, first);
+    int hole = hole_map_is_hole(holes, start->offset, start->size);
+    size_t count = 1;
+    int contiguous = 1;
+
+    // Only chunks of the same size can be hashed side by side, and a run is all holes or none
+    while((count < max_count) && (first + count < n)
+        && (step_chunk(chunks, indices, first + count)->size == start->size)) {
+        const struct chunk* next = step_chunk(chunks, indices, first + count);
+        const struct chunk* prev = step_chunk(chunks, indices, first + count - 1);
+
+        if((holes != NULL) && (hole_map_is_hole(holes, next->offset, next->size) != hole))
+            break;
+
+        contiguous &= next->offset == prev->offset + prev->size;
+        count++;
+    }
+
+    step->first = first;
+    step->count = count;
+    step->contiguous = contiguous;
+    step->hole = hole;
+    step->done = 0;
+    step->len = hole ? 0 : (start->size < piece ? start->size : piece);
+
+    return 1;
+}
+
+
+/**
+ * Indicates whether a read step holds the last piece
+ * of its run's chunks
+ * @param chunks, the chunks of the bpkg object
+ * @param indices, the chunks being read, or NULL for every chunk
+ * @param step, read step object
+ */
+int read_step_last(const struct chunk* chunks, const uint32_t* indices, const struct read_step* step) {
+    return step->hole || (step->done + step->len >= step_chunk(chunks, indices, step->first)->size);
+}
+
+
+/**
+ * Reader thread loop, fills slots while there's room in
+ * the ring until the plan runs out or the pipeline stops
+ * @param varg, pointer to read_pipeline
+ */
+static void* reader_main(void* varg) {
+    struct read_pipeline* pipeline = (struct read_pipeline*) varg;
+
+    while(1) {
+        pthread_mutex_lock(&pipeline->lock);
+
+        while((pipeline->head - pipeline->tail == pipeline->ring_size) && (!pipeline->stop))
+            pthread_cond_wait(&pipeline->emptied, &pipeline->lock);
+
+        int stop = pipeline->stop;
+        char* slot = pipeline->slots[pipeline->head % pipeline->ring_size];
+        pthread_mutex_unlock(&pipeline->lock);
+
+        // The slot is the reader's alone until it's published, so it's filled unlocked
+        int filled = !stop && pipeline->fill(pipeline->arg, slot);
+
+        pthread_mutex_lock(&pipeline->lock);
+
+        if(filled)
+            pipeline->head++;
+        else
+            pipeline->finished = 1;
+
+        pthread_cond_signal(&pipeline->filled);
+        pthread_mutex_unlock(&pipeline->lock);
+
+        if(!filled)
+            return NULL;
+    }
+}
+
+
+/**
+ * Starts a pipeline, whose reader thread begins filling the
+ * ring straight away
+ * @param ring_size, the number of slots
+ * @param slot_size, the size of each slot
+ * @param fill, the function filling each slot, run on the reader thread
+ * @param arg, argument passed through to fill
+ * @return pipeline, read pipeline object pointer
+ */
+struct read_pipeline* pipeline_start(uint32_t ring_size, size_t slot_size,
+    pipeline_fill fill, void* arg) {
+
+    struct read_pipeline* pipeline = (struct read_pipeline*) calloc(1, sizeof(struct read_pipeline));
+
+    pipeline->ring_size = ring_size > 0 ? ring_size : 1;
+    pipeline->fill = fill;
+    pipeline->arg = arg;
+    pipeline->slots = (char**) malloc(sizeof(char*) * pipeline->ring_size);
+
+    for(uint32_t i = 0; i < pipeline->ring_size; i++)
+        pipeline->slots[i] = (char*) malloc(sizeof(char) * slot_size + 1);
+
+    pthread_mutex_init(&pipeline->lock, NULL);
+    pthread_cond_init(&pipeline->filled, NULL);
+    pthread_cond_init(&pipeline->emptied, NULL);
+    pthread_create(&pipeline->reader, NULL, reader_main, pipeline);
+
+    return pipeline;
+}
+
+
+/**
+ * Takes the next filled slot of a pipeline, waiting for
+ * the reader when it's behind. The slot must be given back
+ * before the next one is taken
+ * @param pipeline, pointer to read pipeline object
+ * @return the slot, or NULL once the reader has nothing left
+ */
+const char* pipeline_take(struct read_pipeline* pipeline) {
+    pthread_mutex_lock(&pipeline->lock);
+
+    while((pipeline->head == pipeline->tail) && (!pipeline->finished))
+        pthread_cond_wait(&pipeline->filled, &pipeline->lock);
+
+    const char* slot = pipeline->head > pipeline->tail
+        ? pipeline->slots[pipeline->tail % pipeline->ring_size] : NULL;
+
+    pthread_mutex_unlock(&pipeline->lock);
+
+    return slot;
+}
+
+
+/**
+ * Gives the slot last taken back to the reader to refill
+ * @param pipeline, pointer to read pipeline object
+ */
+void pipeline_give_back(struct read_pipeline* pipeline) {
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->tail++;
+    pthread_cond_signal(&pipeline->emptied);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+
+/**
+ * Stops the reader thread, even when it has more to read,
+ * and deallocates the pipeline
+ * @param pipeline, pointer to read pipeline object
+ */
+void pipeline_stop(struct read_pipeline* pipeline) {
+    if(pipeline == NULL)
+        return;
+
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->stop = 1;
+    pthread_cond_signal(&pipeline->emptied);
+    pthread_mutex_unlock(&pipeline->lock);
+
+    pthread_join(pipeline->reader, NULL);
+
+    for(uint32_t i = 0; i < pipeline->ring_size; i++)
+        free(pipeline->slots[i]);
+
+    free(pipeline->slots);
+    pthread_cond_destroy(&pipeline->emptied);
+    pthread_cond_destroy(&pipeline->filled);
+    pthread_mutex_destroy(&pipeline->lock);
+    free(pipeline);
+}
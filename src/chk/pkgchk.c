@@ -1,214 +1,144 @@
+#define _GNU_SOURCE
+#include "add/arena.h"
 #include "add/inputs.h"
 #include "add/keys.h"
+#include "add/pool.h"
+#include "chk/bpkg2.h"
+#include "chk/flat.h"
+#include "chk/hasher.h"
+#include "chk/index.h"
 #include "chk/pkgchk.h"
 #include "crypt/sha256.h"
 #include <ctype.h>
+#include <fcntl.h>
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <string.h>
 #include <unistd.h>
 
 
-// PART 1
+// Process-wide build options
+static struct bpkg_opts opts = { 1, READ_PREAD, 0, TREE_LINKED, VERIFY_ROOT, 0, PAGES_KEEP, 0, 0 };
 
 
 /**
- * Loads the package for when a valid path is given
- * @param path, path to bpkg file
+ * Returns the process-wide build options, which
+ * callers may modify before building a tree
+ * @return opts, pointer to build options object
  */
-struct bpkg_obj* bpkg_load(const char* path) {
-    FILE *fp = fopen(path, "r");
-    
-    if(fp == NULL)
-        return NULL;
-    // Check if file empty
-    else {
-        // Go to the end of the file and read the size in bytes
-        fseek(fp, 0, SEEK_END);
-        
-        // If file is empty
-        if (ftell(fp) == 0) {
-            fclose(fp);
-            return NULL;
-        // Else go back to beginning of file and continue
-        } else
-            fseek(fp, 0, SEEK_SET);
-    }
-
-    // Allocate memory for bpkg object
-    struct bpkg_obj* obj = (struct bpkg_obj*) malloc(sizeof(struct bpkg_obj));
-
-    // Read passed the label
-    read_label(fp);
-
-    // Read in ident and assign to struct field
-    int res = fscanf(fp, IDENT_READ, obj->ident);
+struct bpkg_opts* bpkg_get_opts(void) {
+    return &opts;
+}
 
-    // Check that data was read and ident is valid
-    if((res <= 0) | (!is_valid_ident(obj->ident))) {
-        free(obj);
-        return NULL;
-    }
 
-    read_label(fp);
+// PART 1
 
-    // Read in filename and assign to struct field
-    res = fscanf(fp, FILENAME_READ, obj->filename);
 
-    if(res <= 0) {
-        free(obj);
-        return NULL;
-    }
+/**
+ * Parses the contents of a bpkg file in a single pass. Each
+ * field must follow its label on its own line, hashes and
+ * chunks are indented by a tab and nothing may follow the last
+ * chunk. Hashes are decoded straight into the hashes and
+ * chunks arrays, which are allocated once up front
+ * @param sc, scanner over the whole bpkg file
+ * @return obj, bpkg object pointer or NULL if the format is invalid
+ */
+static struct bpkg_obj* bpkg_parse(struct scanner* sc) {
+    // The object and its arrays all come from one arena, sized for the whole file
+    struct arena* arena = arena_create(sizeof(struct bpkg_obj) + scan_remaining(sc));
+    struct bpkg_obj* obj = (struct bpkg_obj*) arena_calloc(arena, sizeof(struct bpkg_obj));
+    obj->arena = arena;
+
+    // Read the header fields and check the ident is valid
+    int ok = scan_literal(sc, "ident:") && scan_field(sc, obj->ident, IDENT_SIZE - 1)
+        && is_valid_ident(obj->ident) && scan_literal(sc, "\n")
+        && scan_literal(sc, "filename:") && scan_field(sc, obj->filename, FILENAME_SIZE - 1)
+        && scan_literal(sc, "\n")
+        && scan_literal(sc, "size:") && scan_u64(sc, &obj->size) && scan_literal(sc, "\n")
+        && scan_literal(sc, "nhashes:") && scan_u32(sc, &obj->nhashes)
+        && scan_literal(sc, "\nhashes:\n");
+
+    // Each hash line takes 66 characters, so don't trust a count the file can't hold
+    if(ok && (obj->nhashes <= scan_remaining(sc) / (HASH_SIZE + 1)))
+        obj->hashes = (struct digest*) arena_alloc(arena, sizeof(struct digest) * obj->nhashes);
+    else
+        ok = 0;
 
-    read_label(fp);
+    for(uint32_t i = 0; ok && (i < obj->nhashes); i++)
+        ok = scan_literal(sc, "\t") && scan_digest(sc, &obj->hashes[i]) && scan_literal(sc, "\n");
 
-    // Read in size and assign to struct field
-    res = fscanf(fp, "%u", &(obj->size));
+    ok = ok && scan_literal(sc, "nchunks:") && scan_u32(sc, &obj->nchunks)
+        && scan_literal(sc, "\nchunks:\n");
 
-    if(res <= 0) {
-        free(obj);
-        return NULL;
+    // Each chunk line takes at least 70 characters
+    if(ok && (obj->nchunks <= scan_remaining(sc) / (HASH_SIZE + 5)))
+        obj->chunks = (struct chunk*) arena_alloc(arena, sizeof(struct chunk) * obj->nchunks);
+    else
+        ok = 0;
+
+    for(uint32_t i = 0; ok && (i < obj->nchunks); i++) {
+        struct chunk* chunk = &obj->chunks[i];
+        ok = scan_literal(sc, "\t") && scan_digest(sc, &chunk->hash)
+            && scan_literal(sc, ",") && scan_u64(sc, &chunk->offset)
+            && scan_literal(sc, ",") && scan_u64(sc, &chunk->size)
+            && scan_literal(sc, "\n");
     }
 
-    read_label(fp);
-
-    // Read in nhashes and assign to struct field
-    res = fscanf(fp, "%u", &(obj->nhashes));
-
-    if(res <= 0) {
-        free(obj);
+    // Check that we've reached the end of the file
+    if(!ok || (scan_remaining(sc) != 0)) {
+        bpkg_obj_destroy(obj);
         return NULL;
     }
 
-    // Read passed the label and newline
-    read_label(fp);
-    fgetc(fp);
-
-    // Allocate memory for an array of char pointers to store hashes
-    obj->hashes = (char**) malloc(sizeof(char*) * obj->nhashes);
-
-    for(int i = 0; i < obj->nhashes; i++) {
-        // Read passed the tab character
-        int tab = fgetc(fp);
-        
-        // Allocate memory for a single hash, set characters to null, and assign it a hash from file
-        obj->hashes[i] = (char*) malloc(sizeof(char) * HASH_SIZE);
-        memset(obj->hashes[i], '\0', sizeof(char) * HASH_SIZE);
-        res = fscanf(fp, HASH_READ, obj->hashes[i]);
-
-        // Check that data is read, the hash is valid, and hash is indented by a tab
-        if((res <= 0) | (!is_valid_hash(obj->hashes[i])) | (tab != 9)) {
-            for(int j = 0; j <= i; j++) 
-                free(obj->hashes[j]);
-
-            free(obj->hashes);
+    return obj;
+}
 
-            free(obj);
-            return NULL;
-        }
 
-        // Read passed the newline
-        fgetc(fp);
-    }
-
-    read_label(fp);
+/**
+ * Loads the package for when a valid path is given. The
+ * file is mapped and either copied from the binary bpkg2
+ * format by bpkg2_parse() or parsed in place by bpkg_parse()
+ * @param path, path to bpkg file
+ */
+struct bpkg_obj* bpkg_load(const char* path) {
+    int fd = open(path, O_RDONLY);
 
-    // Read in nchunks and assign to struct field
-    res = fscanf(fp, "%u", &(obj->nchunks));
+    if(fd < 0)
+        return NULL;
 
-    if(res <= 0) {
-        for(int i = 0; i <= obj->nhashes; i++) 
-            free(obj->hashes[i]);
+    struct stat st;
 
-        free(obj->hashes);
-        
-        free(obj);
+    // Check the file isn't empty (an empty file can't be mapped)
+    if((fstat(fd, &st) != 0) || (st.st_size == 0)) {
+        close(fd);
         return NULL;
     }
 
-    // Read passed the label and newline
-    read_label(fp);
-    fgetc(fp);
-
-    // Allocate memory for an array of char pointers to store hashes
-    obj->chunks = (struct chunk**) malloc(sizeof(struct chunk*) * obj->nchunks);
-
-    for(int i = 0; i < obj->nchunks; i++) {
-        // Read passed the tab character
-        int tab = fgetc(fp);
-        
-        // Allocate memory for a single hash, read a hash in and store it
-        obj->chunks[i] = (struct chunk*) malloc(sizeof(struct chunk));
-        res = fscanf(fp, HASH_READ, obj->chunks[i]->hash);
+    char* map = (char*) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
 
-        // Check that data is read, the hash is valid, and hash is indented by a tab
-        if((res <= 0) | (!is_valid_hash(obj->chunks[i]->hash)) | (tab != 9)) {
-            for(int j = 0; j <= i; j++) 
-                free(obj->chunks[j]);
-
-            free(obj->chunks);
-
-            for(int i = 0; i <= obj->nhashes; i++) 
-                free(obj->hashes[i]);
-
-            free(obj->hashes);
-            
-            free(obj);
-            return NULL;
-        }
-
-        // Read passed the comma
-        fgetc(fp);
-        
-        // Read an offset from file and store it
-        res = fscanf(fp, "%u", &(obj->chunks[i]->offset));
-
-        if(res <= 0) {
-            for(int i = 0; i <= obj->nchunks; i++) 
-                free(obj->chunks[i]);
+    if(map == MAP_FAILED)
+        return NULL;
 
-            free(obj->chunks);
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
 
-            for(int i = 0; i <= obj->nhashes; i++) 
-                free(obj->hashes[i]);
+    struct bpkg_obj* obj = NULL;
 
-            free(obj->hashes);
-            
-            free(obj);
-            return NULL;
-        }
-        
-        // Read passed the comma
-        fgetc(fp);
-        
-        // Read a size from file and store it
-        res = fscanf(fp, "%u", &(obj->chunks[i]->size));
-
-        if(res <= 0) {
-            for(int i = 0; i <= obj->nchunks; i++) 
-                free(obj->chunks[i]);
-
-            free(obj->chunks);
-
-            for(int i = 0; i <= obj->nhashes; i++) 
-                free(obj->hashes[i]);
-
-            free(obj->hashes);
-            
-            free(obj);
-            return NULL;
-        }
-        
-        // Read passed the newline
-        fgetc(fp);
+    // Binary packages start with a magic that no text package can
+    if(bpkg2_is_binary(map, st.st_size)) {
+        obj = bpkg2_parse(map, st.st_size);
+    } else {
+        struct scanner sc = { map, map + st.st_size };
+        obj = bpkg_parse(&sc);
     }
 
-    // Close the file
-    fclose(fp);
-    
+    munmap(map, st.st_size);
+
     return obj;
 }
 
@@ -227,11 +157,11 @@ struct bpkg_query bpkg_file_check(struct bpkg_obj* bpkg) {
 
     qry.len = 1;
 
-    qry.hashes = (char**) malloc(sizeof(char*));
+    qry.arena = arena_create(sizeof(char*) + HASH_SIZE);
+    qry.hashes = (char**) arena_alloc(qry.arena, sizeof(char*));
 
     // Allocate memory to store file check result
-    qry.hashes[0] = (char*) malloc(sizeof(char) * HASH_SIZE);
-    memset(qry.hashes[0], '\0', sizeof(char) * HASH_SIZE);
+    qry.hashes[0] = (char*) arena_calloc(qry.arena, sizeof(char) * HASH_SIZE);
 
     FILE *fp = fopen(bpkg->filename, "r");
 
@@ -244,7 +174,7 @@ struct bpkg_query bpkg_file_check(struct bpkg_obj* bpkg) {
         FILE *fp = fopen(bpkg->filename, "w");
 
         // Change the size of the file to match the one specified in bpkg
-        ftruncate(fileno(fp), bpkg->size);
+        ftruncate(fileno(fp), (off_t) bpkg->size);
 
         fclose(fp);
         strcpy(qry.hashes[0], "File Created");
@@ -255,82 +185,95 @@ struct bpkg_query bpkg_file_check(struct bpkg_obj* bpkg) {
 
 
 /**
- * Builds a merkle tree using a bpkg object.
+ * Builds a merkle tree using a bpkg object, either hashing
+ * every node or leaving them to be hashed on demand
  * @param bpkg, constructed bpkg object
+ * @param lazy, whether to skip hashing the data file
  * @return tree, merkle_tree object pointer
  */
-struct merkle_tree* merkle_tree_build(struct bpkg_obj* bpkg) {
+static struct merkle_tree* tree_build(struct bpkg_obj* bpkg, int lazy) {
     // Calculate the height of the tree
     int height = log(bpkg->nchunks) / log(2);
-    // Calculate the size of each data block
-    size_t block_size = bpkg->size / bpkg->nchunks;
 
-    FILE *fp = fopen(bpkg->filename, "r");
+    // Leaf keys hold height bits, non-leaf keys fewer (or "root")
+    size_t key_size = height + 1 < 5 ? 5 : height + 1;
+    size_t n_nodes = bpkg->nhashes + bpkg->nchunks;
 
-    if(fp == NULL) {
-        perror("Unable to open data file");
-        return NULL;
+    // The tree, its nodes and their keys come from one arena, as do the values when kept
+    size_t values_size = 0;
+
+    if(bpkg_get_opts()->retain_values) {
+        for(uint32_t i = 0; i < bpkg->nchunks; i++)
+            values_size += bpkg->chunks[i].size + 1;
     }
 
-    // Create a buffer for incoming data blocks from file
-    char buffer[block_size + 1];
-    memset(buffer, '\0', block_size + 1);
+    struct arena *arena = arena_create(sizeof(struct merkle_tree)
+        + (sizeof(struct merkle_tree_node) + sizeof(struct merkle_tree_node*) + key_size + (lazy ? 1 : 0)) * n_nodes
+        + values_size);
 
-    struct merkle_tree_node *leaf_nodes[bpkg->nchunks];
+    struct merkle_tree_node *nodes = (struct merkle_tree_node*) arena_alloc(arena, sizeof(struct merkle_tree_node) * n_nodes);
+    char *keys = (char*) arena_alloc(arena, key_size * n_nodes);
+    char *values = values_size > 0 ? (char*) arena_alloc(arena, values_size) : NULL;
+    uint8_t *hashed = lazy ? (uint8_t*) arena_calloc(arena, n_nodes) : NULL;
+
+    // Leaves come after the non-leaf nodes, as in the bpkg's hash order
+    struct merkle_tree_node **leaf_nodes = (struct merkle_tree_node**) arena_alloc(arena, sizeof(struct merkle_tree_node*) * n_nodes);
+    struct merkle_tree_node **non_leaf_nodes = leaf_nodes + bpkg->nchunks;
+
+    // Note whether dirty ranges can be matched to chunks by binary search
+    int ordered = 1;
 
     // Iterate over each leaf node and fill in their data
     for(int i = 0; i < bpkg->nchunks; i++) {
-        // Allocate memory for a single node and key
-        leaf_nodes[i] = (struct merkle_tree_node*) malloc(sizeof(struct merkle_tree_node));
-        leaf_nodes[i]->key = malloc(sizeof(char) * (height + 1));
-        memset(leaf_nodes[i]->key, '\0', sizeof(char) * (height + 1));
+        if((i > 0) && (bpkg->chunks[i].offset < bpkg->chunks[i - 1].offset + bpkg->chunks[i - 1].size))
+            ordered = 0;
+
+        leaf_nodes[i] = &nodes[bpkg->nhashes + i];
+        leaf_nodes[i]->key = keys + key_size * (bpkg->nhashes + i);
 
         // Obtain binary value of current leaf node number
-        char *bin = int_to_bin(i, height);
-        strcpy(leaf_nodes[i]->key, bin);
-        free(bin);
+        int_to_bin(i, height, leaf_nodes[i]->key);
 
         leaf_nodes[i]->left = NULL;
         leaf_nodes[i]->right = NULL;
         leaf_nodes[i]->is_leaf = 1;
+        leaf_nodes[i]->offset = bpkg->chunks[i].offset;
+        leaf_nodes[i]->length = bpkg->chunks[i].size;
 
-        // Assign the expected hash value
-        strcpy(leaf_nodes[i]->expected_hash, bpkg->chunks[i]->hash);
+        // Point the leaf at its slot for a copy of the chunk when asked to keep one
+        leaf_nodes[i]->value = values;
 
-        // Calculate the computed hash
-        // Create a sha256 data struct & initialise it
-        struct sha256_compute_data buff;
-        sha256_compute_data_init(&buff);
+        if(values != NULL)
+            values += bpkg->chunks[i].size + 1;
 
-        // Read one data block from the file and hash it
-        fread(buffer, 1, block_size, fp);
+        // Assign the expected hash value
+        leaf_nodes[i]->expected_hash = bpkg->chunks[i].hash;
+    }
 
-        sha256_update(&buff, buffer, block_size);
-        uint8_t hash[HASH_SIZE];
-        memset(hash, '\0', HASH_SIZE);
-        sha256_finalize(&buff, hash);
+    // Share one pool of threads between the leaf and non-leaf levels, a lazy tree needs neither
+    struct thread_pool *pool = lazy ? NULL : hasher_pool_create(bpkg->nchunks);
+    int res = 0;
 
-        // Convert to hexidecimal hash
-        sha256_output_hex(&buff, (char*)hash);
+    // Read each data block from the file and calculate the computed hashes
+    if(!lazy) {
+        struct digest *digests = (struct digest*) malloc(sizeof(struct digest) * bpkg->nchunks);
+        res = hash_leaves(bpkg, digests, leaf_nodes, pool);
+        free(digests);
+    }
 
-        // Store computed hash in node struct
-        strcpy(leaf_nodes[i]->computed_hash, (char*)hash);
+    if(res != 0) {
+        perror("Unable to open data file");
 
-        // Assign data block to value field
-        leaf_nodes[i]->value = malloc(sizeof(char) * block_size + 1);
-        memset(leaf_nodes[i]->value, '\0', block_size + 1);
-        strcpy(leaf_nodes[i]->value, buffer);
+        arena_destroy(arena);
+        pool_destroy(pool);
+        return NULL;
     }
 
-    fclose(fp);
-
     struct merkle_tree *tree = NULL;
 
     // Create a variable to store the number of nodes at each level
     size_t level_size = bpkg->nchunks;
 
-    struct merkle_tree_node *non_leaf_nodes[bpkg->nhashes];
-
     int index = 0; // an index to track non_leaf_nodes
     int offset = 0; // an offset to track child nodes in non_leaf_nodes
 
@@ -338,83 +281,348 @@ struct merkle_tree* merkle_tree_build(struct bpkg_obj* bpkg) {
         // Calculate number of nodes at this level
         level_size = level_size / 2;
 
-        for(int j = 0; j < level_size; j++) {
-            // Allocate memory for a single node and key
-            non_leaf_nodes[index] = (struct merkle_tree_node*) malloc(sizeof(struct merkle_tree_node));
-            non_leaf_nodes[index]->key = malloc(sizeof(char) * (height + 3));
-            memset(non_leaf_nodes[index]->key, '\0', sizeof(char) * (height + 3));
+        // Remember where this level starts so it can be hashed as a whole
+        int level_start = index;
 
-            char *bin = NULL;
+        for(int j = 0; j < level_size; j++) {
+            // Take the node and key in heap order, the same place as its expected hash
+            non_leaf_nodes[index] = &nodes[level_size + j - 1];
+            non_leaf_nodes[index]->key = keys + key_size * (level_size + j - 1);
 
-            // Assign left and right children and obtain key for current node using a child key
+            // Assign left and right children
             // If last non-leaf level
             if(i == height - 1) {
                 non_leaf_nodes[index]->left = leaf_nodes[j * 2];
                 non_leaf_nodes[index]->right = leaf_nodes[j * 2 + 1];
-
-                bin = gen_hash_key(non_leaf_nodes[index]->left->key, height);
             // If any other non-leaf level
             } else {
                 non_leaf_nodes[index]->left = non_leaf_nodes[offset];
                 non_leaf_nodes[index]->right = non_leaf_nodes[offset + 1];
-                
+
                 offset += 2;
+            }
 
-                // If root node set key to "root" and create a merkle tree object
-                if(i == 0) {
-                    bin = malloc(sizeof(char) * 5);
-                    memset(bin, '\0', 5);
-                    memcpy(bin, "root", 5);
-
-                    // Allocate memory for merkle tree object and assign the root node and n_nodes values
-                    tree = (struct merkle_tree*) malloc(sizeof(struct merkle_tree));
-                    tree->root = non_leaf_nodes[index];
-                    tree->n_nodes = bpkg->nhashes + bpkg->nchunks;
-                // If any other non-leaf level than root
-                } else {
-                    bin = gen_hash_key(non_leaf_nodes[index]->left->key, height);
-                }
+            // If root node set key to "root" and create a merkle tree object
+            if(i == 0) {
+                strcpy(non_leaf_nodes[index]->key, "root");
+
+                // Allocate memory for merkle tree object and assign the root node and n_nodes values
+                tree = (struct merkle_tree*) arena_alloc(arena, sizeof(struct merkle_tree));
+                tree->root = non_leaf_nodes[index];
+                tree->n_nodes = n_nodes;
+                tree->nodes = nodes;
+                tree->leaves = leaf_nodes;
+                tree->ordered = ordered;
+                tree->hashed = hashed;
+                tree->arena = arena;
+            // If any other non-leaf level than root, obtain key using a child key
+            } else {
+                gen_hash_key(non_leaf_nodes[index]->left->key, non_leaf_nodes[index]->key);
             }
-            
-            memcpy(non_leaf_nodes[index]->key, bin, strlen(bin));
-            free(bin);
 
             non_leaf_nodes[index]->is_leaf = 0;
+            non_leaf_nodes[index]->value = NULL;
+
+            // A non-leaf node spans the chunks of both children
+            non_leaf_nodes[index]->offset = non_leaf_nodes[index]->left->offset;
+            non_leaf_nodes[index]->length = non_leaf_nodes[index]->left->length + non_leaf_nodes[index]->right->length;
 
             // Assign the expected hash value
-            strcpy(non_leaf_nodes[index]->expected_hash, bpkg->hashes[level_size + j - 1]);
-
-            // Calculate the computed hash using two child computed hashes
-            // Create a sha256 data struct & initialise it
-            struct sha256_compute_data buff;
-            sha256_compute_data_init(&buff);
-
-            // Combine child hashes
-            char combined_hash[HASH_SIZE * 2 - 1];
-            memset(combined_hash, '\0', HASH_SIZE * 2 - 1);
-            strcpy(combined_hash, non_leaf_nodes[index]->left->computed_hash);
-            strcat(combined_hash, non_leaf_nodes[index]->right->computed_hash);
-
-            // Compute the hash of combined child hashes
-            sha256_update(&buff, combined_hash, HASH_SIZE * 2 - 2);
-            uint8_t hash[HASH_SIZE];
-            memset(hash, '\0', HASH_SIZE);
-            sha256_finalize(&buff, hash);
-
-            // Convert to hexidecimal hash
-            sha256_output_hex(&buff, (char*)hash);
-
-            // Store computed hash in node struct
-            strcpy(non_leaf_nodes[index]->computed_hash, (char*)hash);
-            
+            non_leaf_nodes[index]->expected_hash = bpkg->hashes[level_size + j - 1];
+
             index++;
         }
+
+        // Every node of a level only depends on the level below, so hash the level in parallel
+        if(!lazy)
+            hash_non_leaves(non_leaf_nodes + level_start, level_size, pool);
     }
 
+    pool_destroy(pool);
+
+    // Without a root (a single chunk) there's no tree to hand back
+    if(tree == NULL)
+        arena_destroy(arena);
+
     return tree;
 }
 
 
+/**
+ * Builds a merkle tree using a bpkg object.
+ * @param bpkg, constructed bpkg object
+ * @return tree, merkle_tree object pointer
+ */
+struct merkle_tree* merkle_tree_build(struct bpkg_obj* bpkg) {
+    return tree_build(bpkg, 0);
+}
+
+
+/**
+ * Builds a lazy merkle tree using a bpkg object. Only the
+ * structure and expected hashes are filled in, nothing is
+ * read from the data file until merkle_tree_compute() asks
+ * for the computed hash of a node
+ * @param bpkg, constructed bpkg object
+ * @return tree, merkle_tree object pointer
+ */
+struct merkle_tree* merkle_tree_build_lazy(struct bpkg_obj* bpkg) {
+    return tree_build(bpkg, 1);
+}
+
+
+/**
+ * Finds the node of a tree with a given expected hash
+ * through the hash index of the bpkg object, without
+ * computing any hashes
+ * @param bpkg, the bpkg object the tree was built from
+ * @param tree, merkle tree object to search
+ * @param hash, the expected hash of the node being searched for
+ * @return node, merkle tree node pointer or NULL if there's no such node
+ */
+struct merkle_tree_node* merkle_tree_find(struct bpkg_obj* bpkg, struct merkle_tree* tree,
+    const struct digest* hash) {
+
+    // Positions in the index are the same as in the tree's node array
+    ssize_t pos = hash_index_find(bpkg, bpkg_hash_index(bpkg), hash);
+
+    return pos >= 0 ? &tree->nodes[pos] : NULL;
+}
+
+
+/**
+ * Fills in the computed hash of a node of a lazy tree,
+ * hashing only the chunks below it that haven't been
+ * hashed yet and then the nodes between them and it.
+ * Nodes of a fully built tree are left as they are
+ * @param bpkg, the bpkg object the tree was built from
+ * @param tree, merkle tree object the node belongs to
+ * @param node, the node whose computed hash is needed
+ * @return 0 on success, -1 if the data file can't be opened
+ */
+int merkle_tree_compute(struct bpkg_obj* bpkg, struct merkle_tree* tree,
+    struct merkle_tree_node* node) {
+
+    size_t pos = node - tree->nodes;
+
+    if((tree->hashed == NULL) || tree->hashed[pos])
+        return 0;
+
+    size_t first = pos;
+    size_t last = pos;
+
+    // The chunks below the node are the leaves between its leftmost and rightmost descendants
+    while(first < bpkg->nhashes) {
+        first = 2 * first + 1;
+        last = 2 * last + 2;
+    }
+
+    size_t width = last - first + 1;
+    uint32_t *pending = (uint32_t*) malloc(sizeof(uint32_t) * width);
+    size_t count = 0;
+
+    for(size_t i = first; i <= last; i++) {
+        if(!tree->hashed[i])
+            pending[count++] = i - bpkg->nhashes;
+    }
+
+    struct thread_pool *pool = hasher_pool_create(count);
+    struct digest *digests = (struct digest*) malloc(sizeof(struct digest) * (count + 1));
+    int res = count > 0 ? hash_leaves_of(bpkg, pending, count, digests, tree->leaves, pool) : 0;
+
+    free(digests);
+    free(pending);
+
+    if(res != 0) {
+        pool_destroy(pool);
+        return -1;
+    }
+
+    memset(tree->hashed + first, 1, width);
+
+    // Work up a level at a time, hashing the nodes not already computed
+    struct merkle_tree_node **level = (struct merkle_tree_node**) malloc(sizeof(struct merkle_tree_node*) * width);
+
+    while(first != pos) {
+        first = (first - 1) / 2;
+        last = (last - 1) / 2;
+        count = 0;
+
+        for(size_t i = first; i <= last; i++) {
+            if(!tree->hashed[i])
+                level[count++] = &tree->nodes[i];
+        }
+
+        hash_non_leaves(level, count, pool);
+        memset(tree->hashed + first, 1, last - first + 1);
+    }
+
+    free(level);
+    pool_destroy(pool);
+
+    return 0;
+}
+
+
+/**
+ * Orders chunk indices for qsort
+ * @param a, pointer to the first index
+ * @param b, pointer to the second index
+ */
+static int compare_index(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+
+    return (x > y) - (x < y);
+}
+
+
+/**
+ * Refreshes a merkle tree after parts of its data file were
+ * written to. Only the leaves whose chunks overlap a modified
+ * range are rehashed, followed by their ancestors a level at
+ * a time, so k dirty chunks cost O(k log n) hashes. In a
+ * lazy tree they're marked to be hashed on demand instead
+ * @param bpkg, the bpkg object the tree was built from
+ * @param tree, merkle tree object to update
+ * @param ranges, the modified byte ranges of the data file
+ * @param n_ranges, the number of ranges
+ * @return the number of leaves affected, or -1 if the data file can't be opened
+ */
+ssize_t merkle_tree_update(struct bpkg_obj* bpkg, struct merkle_tree* tree,
+    const struct byte_range* ranges, size_t n_ranges) {
+
+    uint32_t* dirty = NULL;
+    size_t count = 0;
+
+    // Collect every chunk that overlaps a modified range
+    for(size_t r = 0; r < n_ranges; r++) {
+        uint64_t start = ranges[r].offset;
+        uint64_t end = ranges[r].offset + ranges[r].length;
+        size_t i = 0;
+
+        if(ranges[r].length == 0)
+            continue;
+
+        // Sorted chunks let the search start at the first chunk ending after the range starts
+        if(tree->ordered) {
+            size_t hi = bpkg->nchunks;
+
+            while(i < hi) {
+                size_t mid = i + (hi - i) / 2;
+
+                if(bpkg->chunks[mid].offset + bpkg->chunks[mid].size <= start)
+                    i = mid + 1;
+                else
+                    hi = mid;
+            }
+        }
+
+        for(; i < bpkg->nchunks; i++) {
+            const struct chunk* chunk = &bpkg->chunks[i];
+
+            if(tree->ordered && (chunk->offset >= end))
+                break;
+
+            if((chunk->offset >= end) || (chunk->offset + chunk->size <= start))
+                continue;
+
+            // Grow the array by doubling
+            if((count & (count - 1)) == 0)
+                dirty = (uint32_t*) realloc(dirty, sizeof(uint32_t) * (count ? count * 2 : 1));
+
+            dirty[count++] = i;
+        }
+    }
+
+    // Ranges may share chunks, so sort them and drop the repeats
+    qsort(dirty, count, sizeof(uint32_t), compare_index);
+
+    size_t n_dirty = 0;
+
+    for(size_t i = 0; i < count; i++) {
+        if((n_dirty == 0) || (dirty[n_dirty - 1] != dirty[i]))
+            dirty[n_dirty++] = dirty[i];
+    }
+
+    if(n_dirty == 0) {
+        free(dirty);
+        return 0;
+    }
+
+    // A lazy tree just forgets the dirty leaves and their ancestors, to be hashed when asked for
+    if(tree->hashed != NULL) {
+        for(size_t i = 0; i < n_dirty; i++) {
+            size_t pos = bpkg->nhashes + dirty[i];
+            tree->hashed[pos] = 0;
+
+            while(pos > 0) {
+                pos = (pos - 1) / 2;
+                tree->hashed[pos] = 0;
+            }
+        }
+
+        free(dirty);
+        return n_dirty;
+    }
+
+    struct thread_pool* pool = hasher_pool_create(n_dirty);
+    struct digest* digests = (struct digest*) malloc(sizeof(struct digest) * (n_dirty + 1));
+    int res = hash_leaves_of(bpkg, dirty, n_dirty, digests, tree->leaves, pool);
+
+    pool_destroy(pool);
+    free(digests);
+
+    if(res != 0) {
+        free(dirty);
+        return -1;
+    }
+
+    // Walk up from the dirty leaves in heap order, where the parent of node k is (k - 1) / 2
+    size_t* level = (size_t*) malloc(sizeof(size_t) * (n_dirty + 1));
+    size_t n_level = n_dirty;
+
+    for(size_t i = 0; i < n_dirty; i++)
+        level[i] = bpkg->nhashes + dirty[i];
+
+    while((n_level > 0) && (level[0] != 0)) {
+        size_t n_parents = 0;
+
+        // Children are in order, so siblings share a parent next to each other
+        for(size_t i = 0; i < n_level; i++) {
+            size_t parent = (level[i] - 1) / 2;
+
+            if((n_parents == 0) || (level[n_parents - 1] != parent))
+                level[n_parents++] = parent;
+        }
+
+        // Rehash the parents of this level side by side
+        for(size_t first = 0; first < n_parents; first += SHA256_MAX_LANES) {
+            uint32_t lanes = n_parents - first < SHA256_MAX_LANES ? n_parents - first : SHA256_MAX_LANES;
+            const struct digest* lefts[SHA256_MAX_LANES];
+            const struct digest* rights[SHA256_MAX_LANES];
+            struct digest* outs[SHA256_MAX_LANES];
+
+            for(uint32_t j = 0; j < lanes; j++) {
+                struct merkle_tree_node* node = &tree->nodes[level[first + j]];
+                lefts[j] = &node->left->computed_hash;
+                rights[j] = &node->right->computed_hash;
+                outs[j] = &node->computed_hash;
+            }
+
+            hash_pairs(lefts, rights, outs, lanes);
+        }
+
+        n_level = n_parents;
+    }
+
+    free(level);
+    free(dirty);
+
+    return n_dirty;
+}
+
+
 /**
  * Retrieves a list of all hashes within the package/tree
  * @param bpkg, constructed bpkg object
@@ -426,20 +634,15 @@ struct bpkg_query bpkg_get_all_hashes(struct bpkg_obj* bpkg) {
 
     qry.len = bpkg->nhashes + bpkg->nchunks;
     
-    qry.hashes = (char**) malloc(sizeof(char*) * (bpkg->nhashes + bpkg->nchunks));
-
-    // Populate hashes
-    for(int i = 0; i < (bpkg->nhashes + bpkg->nchunks); i++) {
-        qry.hashes[i] = (char*) malloc(sizeof(char) * HASH_SIZE);
-        memset(qry.hashes[i], '\0', sizeof(char) * HASH_SIZE);
-
-        // If non-leaf hash
-        if( i < bpkg->nhashes)
-            strcpy(qry.hashes[i], bpkg->hashes[i]);
-        // If leaf/chunk hash
-        else
-            strcpy(qry.hashes[i], bpkg->chunks[i - bpkg->nhashes]->hash);
-    }
+    qry.arena = arena_create(sizeof(struct digest) * qry.len);
+    qry.digests = (struct digest*) arena_alloc(qry.arena, sizeof(struct digest) * qry.len);
+
+    // Populate non-leaf hashes
+    memcpy(qry.digests, bpkg->hashes, sizeof(struct digest) * bpkg->nhashes);
+
+    // Populate leaf/chunk hashes
+    for(int i = 0; i < bpkg->nchunks; i++)
+        qry.digests[bpkg->nhashes + i] = bpkg->chunks[i].hash;
     
     return qry;
 }
@@ -452,27 +655,31 @@ struct bpkg_query bpkg_get_all_hashes(struct bpkg_obj* bpkg) {
  * 		and the number of hashes that have been retrieved
  */
 struct bpkg_query bpkg_get_completed_chunks(struct bpkg_obj* bpkg) { 
-    struct merkle_tree *tree = merkle_tree_build(bpkg);
-    
     struct bpkg_query qry = { 0 };
 
-    // Allocate memory for hashes with initial max size = nchunks
-    qry.hashes = (char** ) malloc(sizeof(char*) * bpkg->nchunks);
+    // Allocate memory for hashes with max size = nchunks
+    qry.arena = arena_create(sizeof(struct digest) * bpkg->nchunks);
+    qry.digests = (struct digest*) arena_alloc(qry.arena, sizeof(struct digest) * bpkg->nchunks);
 
-    // Allocate memory to count actual number of hashes stored
-    int* len = (int*) malloc(sizeof(int));
-    (*len) = 0;
+    // Count actual number of hashes stored
+    int count = 0;
+    int* len = &count;
 
-    // Get the completed chunk hashes
-    get_completed_chunks(qry.hashes, tree->root, len);
+    // Get the completed chunk hashes using the selected tree engine
+    if(bpkg_get_opts()->engine == TREE_FLAT) {
+        struct merkle_flat *flat = merkle_flat_build(bpkg);
 
-    qry.len = *len;
-    free(len);
-    merkle_tree_destroy(tree);
+        if(flat != NULL)
+            flat_get_completed_chunks(flat, qry.digests, len);
 
-    // If the number of hashes is not the maximum (nchunks), adjust the size of hashes array
-    if(qry.len != bpkg->nchunks)
-        qry.hashes = (char**) realloc(qry.hashes, sizeof(char*) * qry.len);
+        merkle_flat_destroy(flat);
+    } else {
+        struct merkle_tree *tree = merkle_tree_build(bpkg);
+        get_completed_chunks(qry.digests, tree->root, len);
+        merkle_tree_destroy(tree);
+    }
+
+    qry.len = count;
 
     return qry;
 }
@@ -489,27 +696,31 @@ struct bpkg_query bpkg_get_completed_chunks(struct bpkg_obj* bpkg) {
  * 		and the number of hashes that have been retrieved
  */
 struct bpkg_query bpkg_get_min_completed_hashes(struct bpkg_obj* bpkg) {
-    struct merkle_tree *tree = merkle_tree_build(bpkg);
-    
     struct bpkg_query qry = { 0 };
 
-    // Allocate memory for hashes with initial max size = nchunks
-    qry.hashes = (char** ) malloc(sizeof(char*) * bpkg->nchunks);
+    // Allocate memory for hashes with max size = nchunks
+    qry.arena = arena_create(sizeof(struct digest) * bpkg->nchunks);
+    qry.digests = (struct digest*) arena_alloc(qry.arena, sizeof(struct digest) * bpkg->nchunks);
 
-    // Allocate memory to count actual number of hashes stored
-    int* len = (int*) malloc(sizeof(int));
-    (*len) = 0;
+    // Count actual number of hashes stored
+    int count = 0;
+    int* len = &count;
 
-    // Get the completed hashes
-    get_completed_hashes(qry.hashes, tree->root, len);
+    // Get the completed hashes using the selected tree engine
+    if(bpkg_get_opts()->engine == TREE_FLAT) {
+        struct merkle_flat *flat = merkle_flat_build(bpkg);
 
-    qry.len = *len;
-    free(len);
-    merkle_tree_destroy(tree);
+        if(flat != NULL)
+            flat_get_completed_hashes(flat, 0, qry.digests, len);
 
-    // If the number of hashes is not the maximum (nchunks), adjust the size of hashes array
-    if(qry.len != bpkg->nchunks)
-        qry.hashes = (char**) realloc(qry.hashes, sizeof(char*) * qry.len);
+        merkle_flat_destroy(flat);
+    } else {
+        struct merkle_tree *tree = merkle_tree_build(bpkg);
+        get_completed_hashes(qry.digests, tree->root, len);
+        merkle_tree_destroy(tree);
+    }
+
+    qry.len = count;
 
     return qry;
 }
@@ -531,38 +742,43 @@ struct bpkg_query bpkg_get_all_chunk_hashes_from_hash(struct bpkg_obj* bpkg,
     
     struct bpkg_query qry = { 0 };
 
-    // Check that the hash is valid
-    if(!is_valid_hash(hash)) {
+    // Check that the hash is valid and convert it to binary once
+    struct digest target;
+
+    if(!hash_to_digest(hash, &target)) {
         // qry.len = 0;
         return qry;
     }
 
-    struct merkle_tree *tree = merkle_tree_build(bpkg);
+    // Allocate memory for hashes with max size = nchunks
+    qry.arena = arena_create(sizeof(struct digest) * bpkg->nchunks);
+    qry.digests = (struct digest*) arena_alloc(qry.arena, sizeof(struct digest) * bpkg->nchunks);
 
-    // Allocate memory for hashes with initial max size = nchunks
-    qry.hashes = (char**) malloc(sizeof(char*) * bpkg->nchunks);
+    // Count actual number of hashes stored
+    int count = 0;
 
-    // Allocate memory to store the node with the hash we're looking for
-    struct merkle_tree_node* node = (struct merkle_tree_node*) malloc(sizeof(struct merkle_tree_node));
+    // The answer only depends on expected hashes, so look the node up without building a tree
+    ssize_t pos = hash_index_find(bpkg, bpkg_hash_index(bpkg), &target);
 
-    // Find the node with the given hash value
-    find_node(tree->root, node, hash);
+    if(pos >= 0) {
+        size_t n_nodes = (size_t) bpkg->nhashes + bpkg->nchunks;
+        size_t first = pos;
+        size_t last = pos;
 
-    // Allocate memory to count actual number of hashes stored
-    int* len = (int*) malloc(sizeof(int));
-    (*len) = 0;
+        // Descend to the leftmost and rightmost leaves below the node
+        while(first < bpkg->nhashes) {
+            first = 2 * first + 1;
+            last = 2 * last + 2;
+        }
 
-    // Get the chunk hashes of the ancestral node
-    get_chunk_hashes_of_ancestor(qry.hashes, node, len);
+        if(last >= n_nodes)
+            last = n_nodes - 1;
 
-    qry.len = *len;
-    free(len);
-    free(node);
-    merkle_tree_destroy(tree);
+        for(size_t i = first; i <= last; i++)
+            qry.digests[count++] = bpkg->chunks[i - bpkg->nhashes].hash;
+    }
 
-    // If the number of hashes is not the maximum (nchunks), adjust the size of hashes array
-    if(qry.len != bpkg->nchunks)
-        qry.hashes = (char**) realloc(qry.hashes, sizeof(char*) * qry.len);
+    qry.len = count;
 
     return qry;
 }
@@ -576,15 +792,13 @@ struct bpkg_query bpkg_get_all_chunk_hashes_from_hash(struct bpkg_obj* bpkg,
  * it holds the current node of the in-order traversal
  * @param len, stores the total number of completed chunk hashes
  */
-void get_completed_chunks(char** hashes, struct merkle_tree_node* node, int* len) {
+void get_completed_chunks(struct digest* hashes, struct merkle_tree_node* node, int* len) {
     // If a child doesn't exist then we have a leaf node
     if(node->left == NULL) {
         // Check that it's a completed chunk hash
-        if(memcmp(node->computed_hash, node->expected_hash, HASH_SIZE - 1) == 0) {
+        if(memcmp(&node->computed_hash, &node->expected_hash, DIGEST_SIZE) == 0) {
             // Store the hash in hashes and increment len
-            hashes[*len] = (char*) malloc(sizeof(char) * HASH_SIZE);
-            memset(hashes[*len], '\0', sizeof(char) * HASH_SIZE);
-            strcpy(hashes[*len], node->computed_hash);
+            hashes[*len] = node->computed_hash;
             (*len)++;
         }
     // If a non-leaf node, use recursion for in-order traversal
@@ -603,11 +817,11 @@ void get_completed_chunks(char** hashes, struct merkle_tree_node* node, int* len
  * it holds the current node of the in-order traversal
  * @param len, stores the total number of completed chunk hashes
  */
-int get_completed_hashes(char** hashes, struct merkle_tree_node* node, int* len) {
+int get_completed_hashes(struct digest* hashes, struct merkle_tree_node* node, int* len) {
     // If a child doesn't exist then we have a leaf node
     if(node->left == NULL) {
         // Return 1 if it's a completed chunk hash, otherwise return 0
-        if(memcmp(node->expected_hash, node->computed_hash, HASH_SIZE - 1) == 0) {
+        if(memcmp(&node->expected_hash, &node->computed_hash, DIGEST_SIZE) == 0) {
             return 1;
         } else {
             return 0;
@@ -622,24 +836,18 @@ int get_completed_hashes(char** hashes, struct merkle_tree_node* node, int* len)
             // However if current node is root, then store it (we're done)
             if(memcmp(node->key, "root", 5) == 0) {
                 // Store the hash in hashes and increment len
-                hashes[*len] = (char*) malloc(sizeof(char) * HASH_SIZE);
-                memset(hashes[*len], '\0', sizeof(char) * HASH_SIZE);
-                strcpy(hashes[*len], node->computed_hash);
+                hashes[*len] = node->computed_hash;
                 (*len)++;
             }
             return 1;
         // If only the left child is a completed hash, store it and increment len
         } else if(res_left){
-            hashes[*len] = (char*) malloc(sizeof(char) * HASH_SIZE);
-            memset(hashes[*len], '\0', sizeof(char) * HASH_SIZE);
-            strcpy(hashes[*len], node->left->computed_hash);
+            hashes[*len] = node->left->computed_hash;
             (*len)++;
             return 0;
         // If only the right child is a completed hash, store it and increment len
         } else if(res_right){
-            hashes[*len] = (char*) malloc(sizeof(char) * HASH_SIZE);
-            memset(hashes[*len], '\0', sizeof(char) * HASH_SIZE);
-            strcpy(hashes[*len], node->right->computed_hash);
+            hashes[*len] = node->right->computed_hash;
             (*len)++;
             return 0;
         } else 
@@ -648,73 +856,17 @@ int get_completed_hashes(char** hashes, struct merkle_tree_node* node, int* len)
 }
 
 
-/**
- * A recursive function that uses in-order traversal
- * find a node with a corresponding hash in a merkle tree
- * @param curr_node, initally the root node of the tree, 
- * it holds the current node of the in-order traversal
- * @param node, allocated memory used to store the node
- * @param hash, the expected hash of the node being searched for
- */
-void find_node(struct merkle_tree_node* curr_node, struct merkle_tree_node* node, char* hash) {
-    // If left child exists, search recursively
-    if(curr_node->left)
-        find_node(curr_node->left, node, hash);
-    
-    // If node found, store details in node struct
-    if(memcmp(curr_node->expected_hash, hash, HASH_SIZE - 1) == 0) {
-    	node->key = curr_node->key;
-        node->value = curr_node->value;
-        node->left = curr_node->left;
-        node->right = curr_node->right;
-        node->is_leaf = curr_node->is_leaf;
-        strcpy(node->expected_hash, curr_node->expected_hash);
-        strcpy(node->computed_hash, curr_node->computed_hash);
-    }
-
-    // If right child exists, search recursively
-    if(curr_node->right)
-        find_node(curr_node->right, node, hash);
-}
-
-
-/**
- * A recursive function that uses in-order traversal
- * to find all the chunk hashes of an ancestor node
- * in a merkle tree
- * @param hashes, an array to store the chunk hashes
- * @param node, initally the ancestor node, holds the 
- * current node of the in-order traversal
- * @param len, stores the total number of chunk hashes
- */
-void get_chunk_hashes_of_ancestor(char** hashes, struct merkle_tree_node* node, int* len) {
-    // If a child doesn't exist then we have a leaf node
-    if(node->left == NULL) {
-        // Store the chunk hash in hashes and increment len
-        hashes[*len] = (char*) malloc(sizeof(char) * HASH_SIZE);
-        memset(hashes[*len], '\0', sizeof(char) * HASH_SIZE);
-        strcpy(hashes[*len], node->expected_hash);
-        (*len)++;
-    // If children are non-leaf nodes, use recursion for in-order traversal
-    } else {
-        get_chunk_hashes_of_ancestor(hashes, node->left, len);
-        get_chunk_hashes_of_ancestor(hashes, node->right, len);
-    }
-}
-
-
 /**
  * Deallocates the query result after it has been 
  * constructed from the relevant queries above.
  * @param qry, pointer to query object
  */
 void bpkg_query_destroy(struct bpkg_query* qry) {
-    // Deallocate hash memory
-    for(int i = 0; i < qry->len; i++) {
-        free(qry->hashes[i]);
-    }
-
-    free(qry->hashes);
+    // Everything the query holds came from its arena
+    arena_destroy(qry->arena);
+    qry->arena = NULL;
+    qry->hashes = NULL;
+    qry->digests = NULL;
 }
 
 
@@ -724,51 +876,17 @@ void bpkg_query_destroy(struct bpkg_query* qry) {
  * @param obj, pointer to bpkg object
  */
 void bpkg_obj_destroy(struct bpkg_obj* obj) {
-    // Deallocate hash memory
-    for(int i = 0; i < obj->nhashes; i++) {
-        free(obj->hashes[i]);
-    }
-
-    free(obj->hashes);
-
-    // Deallocate chunk memory
-    for(int i = 0; i < obj->nchunks; i++) {
-        free(obj->chunks[i]);
-    }
-
-    free(obj->chunks);
-
-    free(obj);
+    // The object lives in its own arena, along with its hashes and chunks
+    arena_destroy(obj->arena);
 }
 
 
 /**
- * Deallocates the memory for a merkle tree
+ * Deallocates the memory for a merkle tree and
+ * all of its nodes at once
  * @param tree, pointer to merkle tree object
  */
 void merkle_tree_destroy(struct merkle_tree *tree) {
-    merkle_nodes_destroy(tree->root);
-    free(tree);    
-}
-
-
-/**
- * Deallocates the memory for all leaf and 
- * non-leaf nodes of a merkle tree
- * @param node, pointer to merkle tree node
- */
-void merkle_nodes_destroy(struct merkle_tree_node *node) {
-    // If left child exists, recurse on left child
-    if(node->left != NULL)
-        merkle_nodes_destroy(node->left);
-    
-    // If right child exists, recurse on right child
-    if(node->right != NULL)
-        merkle_nodes_destroy(node->right);
-    // If leaf-node, free value
-    else
-        free(node->value);
-
-    free(node->key);
-    free(node);
+    // The tree lives in its own arena, along with its nodes
+    arena_destroy(tree->arena);
 }
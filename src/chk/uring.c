@@ -0,0 +1,403 @@
+#define _GNU_SOURCE
+#include "chk/hasher.h"
+#include "chk/uring.h"
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+
+struct uring_reader {
+    int ring_fd;
+    int fd; // the file being read
+    uint32_t depth;
+    size_t slot_size;
+    int registered; // slots are registered buffers, read with READ_FIXED
+    int broken; // the ring failed, so reads are only made with pread
+    int stuck; // reads may still land in the slots, so fallback is read into instead
+
+    // Submission ring, shared with the kernel
+    void* sq_map;
+    size_t sq_map_size;
+    uint32_t* sq_head;
+    uint32_t* sq_tail;
+    uint32_t sq_mask;
+    uint32_t* sq_array;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    uint32_t to_submit;
+
+    // Completion ring, shared with the kernel
+    void* cq_map;
+    size_t cq_map_size;
+    uint32_t* cq_head;
+    uint32_t* cq_tail;
+    uint32_t cq_mask;
+    struct io_uring_cqe* cqes;
+
+    // The state of each slot
+    char* buffers;
+    char* fallback; // slots for pread once the ring is stuck, allocated when needed
+    off_t* offsets;
+    size_t* lens;
+    int32_t* results;
+    uint8_t* in_flight;
+    uint32_t n_in_flight;
+};
+
+
+// glibc has no wrappers for the io_uring calls, so they're made directly
+static int sys_io_uring_setup(uint32_t entries, struct io_uring_params* params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int ring_fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+    return (int) syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int ring_fd, uint32_t opcode, void* arg, uint32_t nr_args) {
+    return (int) syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+
+/**
+ * Maps the submission and completion rings of a new
+ * io_uring instance into the reader
+ * @param reader, pointer to uring reader object
+ * @param params, the parameters returned by io_uring_setup
+ * @return 0 on success, -1 if the rings can't be mapped
+ */
+static int map_rings(struct uring_reader* reader, struct io_uring_params* params) {
+    reader->sq_map_size = params->sq_off.array + params->sq_entries * sizeof(uint32_t);
+    reader->cq_map_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+
+    // Newer kernels map both rings together
+    if(params->features & IORING_FEAT_SINGLE_MMAP) {
+        if(reader->cq_map_size > reader->sq_map_size)
+            reader->sq_map_size = reader->cq_map_size;
+
+        reader->cq_map_size = 0;
+    }
+
+    reader->sq_map = mmap(NULL, reader->sq_map_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, reader->ring_fd, IORING_OFF_SQ_RING);
+
+    if(reader->sq_map == MAP_FAILED)
+        return -1;
+
+    reader->cq_map = reader->sq_map;
+
+    if(reader->cq_map_size > 0) {
+        reader->cq_map = mmap(NULL, reader->cq_map_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, reader->ring_fd, IORING_OFF_CQ_RING);
+
+        if(reader->cq_map == MAP_FAILED) {
+            reader->cq_map_size = 0;
+            return -1;
+        }
+    }
+
+    reader->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+    reader->sqes = (struct io_uring_sqe*) mmap(NULL, reader->sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, reader->ring_fd, IORING_OFF_SQES);
+
+    if(reader->sqes == MAP_FAILED) {
+        reader->sqes = NULL;
+        return -1;
+    }
+
+    char* sq = (char*) reader->sq_map;
+    char* cq = (char*) reader->cq_map;
+
+    reader->sq_head = (uint32_t*) (sq + params->sq_off.head);
+    reader->sq_tail = (uint32_t*) (sq + params->sq_off.tail);
+    reader->sq_mask = *(uint32_t*) (sq + params->sq_off.ring_mask);
+    reader->sq_array = (uint32_t*) (sq + params->sq_off.array);
+    reader->cq_head = (uint32_t*) (cq + params->cq_off.head);
+    reader->cq_tail = (uint32_t*) (cq + params->cq_off.tail);
+    reader->cq_mask = *(uint32_t*) (cq + params->cq_off.ring_mask);
+    reader->cqes = (struct io_uring_cqe*) (cq + params->cq_off.cqes);
+
+    return 0;
+}
+
+
+/**
+ * Creates a uring reader. Fails where io_uring isn't
+ * available (an old kernel or a sandbox blocking it), in
+ * which case the caller reads with pread instead
+ * @param fd, file descriptor of the file to read
+ * @param depth, the number of slots and most reads in flight
+ * @param slot_size, the size of each slot
+ * @return reader, uring reader object pointer or NULL
+ */
+struct uring_reader* uring_reader_create(int fd, uint32_t depth, size_t slot_size) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int ring_fd = sys_io_uring_setup(depth, &params);
+
+    if(ring_fd < 0)
+        return NULL;
+
+    struct uring_reader* reader = (struct uring_reader*) calloc(1, sizeof(struct uring_reader));
+    reader->ring_fd = ring_fd;
+    reader->fd = fd;
+    reader->depth = depth;
+    reader->slot_size = slot_size;
+
+    if(map_rings(reader, &params) != 0) {
+        uring_reader_destroy(reader);
+        return NULL;
+    }
+
+    // One page-aligned allocation holds every slot
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t stride = (slot_size + page - 1) / page * page;
+
+    if(posix_memalign((void**) &reader->buffers, page, stride * depth) != 0) {
+        reader->buffers = NULL;
+        uring_reader_destroy(reader);
+        return NULL;
+    }
+
+    reader->slot_size = stride;
+    reader->offsets = (off_t*) calloc(depth, sizeof(off_t));
+    reader->lens = (size_t*) calloc(depth, sizeof(size_t));
+    reader->results = (int32_t*) calloc(depth, sizeof(int32_t));
+    reader->in_flight = (uint8_t*) calloc(depth, sizeof(uint8_t));
+
+    // Registered buffers skip pinning the pages on every read, plain reads still work without
+    struct iovec* iovs = (struct iovec*) malloc(sizeof(struct iovec) * depth);
+
+    for(uint32_t i = 0; i < depth; i++) {
+        iovs[i].iov_base = reader->buffers + i * stride;
+        iovs[i].iov_len = stride;
+    }
+
+    reader->registered = sys_io_uring_register(ring_fd, IORING_REGISTER_BUFFERS, iovs, depth) == 0;
+    free(iovs);
+
+    return reader;
+}
+
+
+/**
+ * Queues a read of len bytes at offset into a slot. The
+ * read is submitted along with any others queued the next
+ * time the reader waits
+ * @param reader, pointer to uring reader object
+ * @param slot, the slot to read into, which mustn't have a read in flight
+ * @param offset, the position in the file to read from
+ * @param len, the number of bytes to read (at most slot_size)
+ */
+void uring_reader_queue(struct uring_reader* reader, uint32_t slot, off_t offset, size_t len) {
+    reader->offsets[slot] = offset;
+    reader->lens[slot] = len;
+
+    // A failed ring leaves the whole read to uring_reader_wait()
+    if(reader->broken) {
+        reader->results[slot] = -1;
+        return;
+    }
+
+    uint32_t tail = *reader->sq_tail;
+    uint32_t index = tail & reader->sq_mask;
+    struct io_uring_sqe* sqe = &reader->sqes[index];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = reader->registered ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = reader->fd;
+    sqe->off = (uint64_t) offset;
+    sqe->addr = (uint64_t) (uintptr_t) (reader->buffers + slot * reader->slot_size);
+    sqe->len = (uint32_t) len;
+    sqe->buf_index = reader->registered ? slot : 0;
+    sqe->user_data = slot;
+
+    reader->sq_array[index] = index;
+    reader->in_flight[slot] = 1;
+    reader->n_in_flight++;
+    reader->to_submit++;
+
+    // The kernel must see the entry before the new tail
+    __atomic_store_n(reader->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Takes every completion off the completion ring, marking
+ * the slots they belong to as done
+ * @param reader, pointer to uring reader object
+ */
+static void reap(struct uring_reader* reader) {
+    uint32_t head = *reader->cq_head;
+    uint32_t tail = __atomic_load_n(reader->cq_tail, __ATOMIC_ACQUIRE);
+
+    for(; head != tail; head++) {
+        struct io_uring_cqe* cqe = &reader->cqes[head & reader->cq_mask];
+        uint32_t slot = (uint32_t) cqe->user_data;
+
+        reader->results[slot] = cqe->res;
+        reader->in_flight[slot] = 0;
+        reader->n_in_flight--;
+    }
+
+    __atomic_store_n(reader->cq_head, head, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Takes back the queued reads the kernel hasn't picked up
+ * from the submission ring, so they're never submitted
+ * @param reader, pointer to uring reader object
+ */
+static void withdraw(struct uring_reader* reader) {
+    uint32_t head = __atomic_load_n(reader->sq_head, __ATOMIC_ACQUIRE);
+    uint32_t tail = *reader->sq_tail;
+
+    for(uint32_t i = head; i != tail; i++) {
+        uint32_t slot = (uint32_t) reader->sqes[i & reader->sq_mask].user_data;
+
+        reader->results[slot] = -1;
+        reader->in_flight[slot] = 0;
+        reader->n_in_flight--;
+    }
+
+    __atomic_store_n(reader->sq_tail, head, __ATOMIC_RELEASE);
+    reader->to_submit = 0;
+}
+
+
+/**
+ * Waits for every read the kernel has accepted to complete,
+ * without submitting any more
+ * @param reader, pointer to uring reader object
+ * @return 0 once none are in flight, -1 if the ring can't be waited on
+ */
+static int drain(struct uring_reader* reader) {
+    while(reader->n_in_flight > 0) {
+        int res = sys_io_uring_enter(reader->ring_fd, 0, 1, IORING_ENTER_GETEVENTS);
+
+        if((res < 0) && (errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY))
+            return -1;
+
+        reap(reader);
+    }
+
+    return 0;
+}
+
+
+/**
+ * Submits the queued reads and takes the completions
+ * which are ready, blocking for at least one when asked.
+ * Should the ring stop working, the reads the kernel never
+ * picked up are taken back and the ones it did are waited
+ * for, so every slot is left to be read with pread
+ * @param reader, pointer to uring reader object
+ * @param min_complete, the number of completions to wait for
+ */
+static void enter(struct uring_reader* reader, uint32_t min_complete) {
+    uint32_t flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int res = sys_io_uring_enter(reader->ring_fd, reader->to_submit, min_complete, flags);
+
+    if(res >= 0) {
+        reader->to_submit -= (uint32_t) res < reader->to_submit ? (uint32_t) res : reader->to_submit;
+    } else if((errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY)) {
+        // A failed enter doesn't cancel reads the kernel already has
+        reader->broken = 1;
+        withdraw(reader);
+        reap(reader);
+
+        if(drain(reader) != 0)
+            reader->stuck = 1;
+
+        return;
+    }
+
+    reap(reader);
+}
+
+
+/**
+ * Waits for the read of a slot to complete. A short read
+ * is finished with pread, and bytes past the end of the
+ * file are zeroed, the same as read_block()
+ * @param reader, pointer to uring reader object
+ * @param slot, the slot to wait for
+ * @return pointer to the bytes read into the slot
+ */
+const char* uring_reader_wait(struct uring_reader* reader, uint32_t slot) {
+    if((reader->to_submit > 0) && (!reader->broken))
+        enter(reader, 0);
+
+    while(reader->in_flight[slot] && (!reader->broken))
+        enter(reader, 1);
+
+    // Slots the kernel may still write into are never read from, every read goes to the fallback instead
+    if(reader->stuck) {
+        if(reader->fallback == NULL)
+            reader->fallback = (char*) malloc(sizeof(char) * reader->slot_size * reader->depth);
+
+        char* buffer = reader->fallback + slot * reader->slot_size;
+        read_block(reader->fd, buffer, reader->lens[slot], reader->offsets[slot]);
+        return buffer;
+    }
+
+    char* buffer = reader->buffers + slot * reader->slot_size;
+    size_t done = reader->results[slot] > 0 ? (size_t) reader->results[slot] : 0;
+
+    // The rest of a short or failed read is read again the plain way
+    if(done < reader->lens[slot])
+        read_block(reader->fd, buffer + done, reader->lens[slot] - done, reader->offsets[slot] + done);
+
+    return buffer;
+}
+
+
+/**
+ * Waits for every read in flight, then unregisters the
+ * buffers, closes the ring and deallocates the reader.
+ * The slots of a stuck ring are never freed, since the
+ * kernel may still write into them
+ * @param reader, pointer to uring reader object
+ */
+void uring_reader_destroy(struct uring_reader* reader) {
+    if(reader == NULL)
+        return;
+
+    // The kernel may still be writing into the slots
+    if((reader->sqes != NULL) && (!reader->stuck)) {
+        withdraw(reader);
+
+        if(drain(reader) != 0)
+            reader->stuck = 1;
+    }
+
+    if(reader->registered && (!reader->stuck))
+        sys_io_uring_register(reader->ring_fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+
+    if(reader->sqes != NULL)
+        munmap(reader->sqes, reader->sqes_size);
+
+    if((reader->cq_map_size > 0) && (reader->cq_map != MAP_FAILED))
+        munmap(reader->cq_map, reader->cq_map_size);
+
+    if((reader->sq_map != NULL) && (reader->sq_map != MAP_FAILED))
+        munmap(reader->sq_map, reader->sq_map_size);
+
+    close(reader->ring_fd);
+    free(reader->fallback);
+
+    if(!reader->stuck)
+        free(reader->buffers);
+    free(reader->offsets);
+    free(reader->lens);
+    free(reader->results);
+    free(reader->in_flight);
+    free(reader);
+}
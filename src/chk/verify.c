@@ -0,0 +1,446 @@
+#define _GNU_SOURCE
+#include "add/budget.h"
+#include "chk/cache.h"
+#include "chk/hasher.h"
+#include "chk/holes.h"
+#include "chk/pipeline.h"
+#include "chk/pkgchk.h"
+#include "chk/verify.h"
+#include "chk/zeros.h"
+#include "crypt/sha256.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Most bytes of the data file held in memory at a time
+#define VERIFY_BUFFER_BYTES (1 << 20)
+// One pending subtree per level, enough for any chunk count
+#define VERIFY_STACK_MAX 64
+
+
+/**
+ * subtree object, holds the hash of a complete
+ * subtree waiting for its sibling.
+ */
+struct subtree {
+    struct digest hash;
+    uint32_t height;
+};
+
+
+/**
+ * Pushes a chunk hash onto the stack of pending subtrees.
+ * While the top two subtrees have the same height they are
+ * siblings, so they're popped and replaced by their parent
+ * @param stack, array of VERIFY_STACK_MAX pending subtrees
+ * @param depth, the number of subtrees on the stack
+ * @param hash, the chunk hash to push
+ */
+static void push_chunk(struct subtree* stack, size_t* depth, const struct digest* hash) {
+    stack[*depth].hash = *hash;
+    stack[*depth].height = 0;
+    (*depth)++;
+
+    while((*depth >= 2) && (stack[*depth - 1].height == stack[*depth - 2].height)) {
+        struct subtree* left = &stack[*depth - 2];
+        const struct digest* lefts[1] = { &left->hash };
+        const struct digest* rights[1] = { &stack[*depth - 1].hash };
+        struct digest* outs[1] = { &left->hash };
+
+        hash_pairs(lefts, rights, outs, 1);
+        left->height++;
+        (*depth)--;
+    }
+}
+
+
+/**
+ * Records a failing chunk's bytes, extending the last range
+ * when the chunk carries straight on from it
+ * @param res, verify result object
+ * @param offset, where the chunk starts in the data file
+ * @param length, the size of the chunk
+ */
+static void add_range(struct bpkg_verify* res, uint64_t offset, uint64_t length) {
+    struct byte_range* last = res->n_ranges > 0 ? &res->ranges[res->n_ranges - 1] : NULL;
+
+    if((last != NULL) && (last->offset + last->length == offset)) {
+        last->length += length;
+        return;
+    }
+
+    // Grow the array by doubling
+    if((res->n_ranges & (res->n_ranges - 1)) == 0)
+        res->ranges = (struct byte_range*) realloc(res->ranges, sizeof(struct byte_range) * (res->n_ranges ? res->n_ranges * 2 : 1));
+
+    res->ranges[res->n_ranges].offset = offset;
+    res->ranges[res->n_ranges].length = length;
+    res->n_ranges++;
+}
+
+
+/**
+ * Checks one computed chunk hash against the bpkg, recording
+ * a failure in the result, and folds it into the stack
+ * @param bpkg, constructed bpkg object
+ * @param res, verify result object
+ * @param index, index of the chunk
+ * @param hash, the chunk hash computed from the data file
+ * @param stack, array of VERIFY_STACK_MAX pending subtrees
+ * @param depth, the number of subtrees on the stack
+ * @return 1 when VERIFY_FAIL_FAST has to stop here, 0 otherwise
+ */
+static int check_chunk(struct bpkg_obj* bpkg, struct bpkg_verify* res, size_t index,
+    const struct digest* hash, struct subtree* stack, size_t* depth) {
+
+    const struct chunk* chunk = &bpkg->chunks[index];
+    enum bpkg_verify_mode mode = bpkg_get_opts()->verify_mode;
+
+    if(memcmp(hash, &chunk->hash, sizeof(struct digest)) != 0) {
+        // Keep the details of the first chunk that fails
+        if(res->first_mismatch < 0) {
+            res->first_mismatch = index;
+            res->first_offset = chunk->offset;
+            res->expected = chunk->hash;
+            res->actual = *hash;
+        }
+
+        res->n_mismatches++;
+
+        if(mode == VERIFY_REPORT_ALL)
+            add_range(res, chunk->offset, chunk->size);
+
+        // Skip reading the rest of the file
+        if(mode == VERIFY_FAIL_FAST)
+            return 1;
+    }
+
+    push_chunk(stack, depth, hash);
+    return 0;
+}
+
+
+/**
+ * Reads up to size bytes at offset into a buffer, through
+ * the O_DIRECT descriptor when there is one
+ * @param fd, file descriptor of the data file
+ * @param direct_fd, the data file opened with O_DIRECT, or -1
+ * @param bounce, aligned buffer for direct reads
+ * @param buffer, buffer to read into
+ * @param size, the number of bytes to read
+ * @param offset, the position in the file to read from
+ */
+static void fetch(int fd, int direct_fd, char* bounce, char* buffer, size_t size, off_t offset) {
+    if(direct_fd < 0) {
+        read_block(fd, buffer, size, offset);
+        return;
+    }
+
+    memcpy(buffer, read_block_direct(direct_fd, fd, bounce, size, offset), size);
+}
+
+
+/**
+ * stream reader object, what's needed to read
+ * the steps of a streamed verify.
+ */
+struct stream_reader {
+    struct bpkg_obj* bpkg;
+    int fd;
+    int direct_fd; // the data file opened with O_DIRECT, or -1
+    char* bounce;  // aligned buffer for direct reads
+    struct io_budget* budget;
+    struct hole_map* holes; // NULL unless the data file is sparse
+    size_t batch;
+    size_t piece;
+    struct read_step step; // the reader's own place in the plan when pipelined
+};
+
+
+/**
+ * Reads the pieces of a step's chunks into a buffer, one
+ * after another. Chunks in holes aren't read at all
+ * @param reader, stream reader object
+ * @param step, the step to read
+ * @param buffer, buffer of at least step->len * step->count bytes
+ */
+static void load_step(struct stream_reader* reader, const struct read_step* step, char* buffer) {
+    if(step->hole)
+        return;
+
+    const struct chunk* chunks = &reader->bpkg->chunks[step->first];
+    uint64_t taken = budget_acquire(reader->budget, step->len * step->count);
+
+    // Chunks that sit next to each other in the file are one read
+    if(step->contiguous) {
+        fetch(reader->fd, reader->direct_fd, reader->bounce, buffer, step->len * step->count,
+            (off_t) (chunks[0].offset + step->done));
+    } else {
+        for(size_t j = 0; j < step->count; j++)
+            fetch(reader->fd, reader->direct_fd, reader->bounce, buffer + j * step->len, step->len,
+                (off_t) (chunks[j].offset + step->done));
+    }
+
+    budget_release(reader->budget, taken);
+}
+
+
+/**
+ * Reads the next step of a streamed verify into a pipeline slot,
+ * run on the pipeline's reader thread
+ * @param arg, pointer to stream_reader
+ * @param buffer, the slot to fill
+ * @return 1 if the slot was filled, 0 once every chunk has been read
+ */
+static int fill_step(void* arg, char* buffer) {
+    struct stream_reader* reader = (struct stream_reader*) arg;
+
+    if(!read_step_next(reader->bpkg->chunks, NULL, reader->bpkg->nchunks, reader->batch, reader->piece,
+        reader->holes, &reader->step))
+        return 0;
+
+    load_step(reader, &reader->step, buffer);
+    return 1;
+}
+
+
+/**
+ * Reads and hashes every chunk of the data file in order,
+ * checking each one as it's hashed. With the ring_slots
+ * build option a reader thread reads ahead into a ring
+ * while this thread hashes, O_DIRECT reads included.
+ * Chunks lying in holes of a sparse data file get the
+ * digest of zeros without reading
+ * @param bpkg, constructed bpkg object
+ * @param fd, file descriptor of the data file
+ * @param res, verify result object
+ * @param stack, array of VERIFY_STACK_MAX pending subtrees
+ * @param depth, the number of subtrees on the stack
+ * @param digests, array of nchunks digests to keep the chunk hashes in, or NULL
+ * @param budget, budget to take read bytes from, or NULL
+ * @return 1 when VERIFY_FAIL_FAST stopped early, 0 otherwise
+ */
+static int stream_chunks(struct bpkg_obj* bpkg, int fd, struct bpkg_verify* res,
+    struct subtree* stack, size_t* depth, struct digest* digests, struct io_budget* budget) {
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // Size the buffer for the largest chunk
+    size_t block_size = 0;
+
+    for(uint32_t i = 0; i < bpkg->nchunks; i++) {
+        if(bpkg->chunks[i].size > block_size)
+            block_size = bpkg->chunks[i].size;
+    }
+
+    const struct bpkg_opts* opts = bpkg_get_opts();
+    size_t buffer_bytes = (opts->ring_slots > 0) && (opts->ring_slot_bytes > 0) ? opts->ring_slot_bytes : VERIFY_BUFFER_BYTES;
+
+    // Read a batch of whole chunks at a time, or one chunk in pieces when it's too large
+    struct stream_reader reader = { bpkg, fd, -1, NULL, budget, hole_map_load(fd), 1, 0, { 0 } };
+    reader.piece = block_size < buffer_bytes ? block_size : buffer_bytes;
+    reader.batch = (block_size > 0) && (block_size < buffer_bytes) ? buffer_bytes / block_size : 1;
+
+    // Read around the page cache when asked to, or drop what was read where O_DIRECT can't be used
+    reader.direct_fd = opts->page_mode == PAGES_DIRECT ? open(bpkg->filename, O_RDONLY | O_DIRECT) : -1;
+    int drop = (opts->page_mode == PAGES_DROP) || ((opts->page_mode == PAGES_DIRECT) && (reader.direct_fd < 0));
+
+    if((reader.direct_fd >= 0) && (posix_memalign((void**) &reader.bounce, DIRECT_ALIGN, reader.piece * reader.batch + 2 * DIRECT_ALIGN) != 0)) {
+        close(reader.direct_fd);
+        reader.direct_fd = -1;
+        drop = 1;
+    }
+
+    // Either a reader thread fills the ring, or this thread reads into one buffer between hashing
+    struct read_pipeline* pipeline = NULL;
+    char* buffer = NULL;
+
+    if(opts->ring_slots > 0)
+        pipeline = pipeline_start(opts->ring_slots, reader.piece * reader.batch, fill_step, &reader);
+    else
+        buffer = (char*) malloc(sizeof(char) * reader.piece * reader.batch + 1);
+
+    struct sha256_compute_data* buffs = (struct sha256_compute_data*) malloc(sizeof(struct sha256_compute_data) * reader.batch);
+    struct sha256_compute_data** data = (struct sha256_compute_data**) malloc(sizeof(struct sha256_compute_data*) * reader.batch);
+    const void** blocks = (const void**) malloc(sizeof(void*) * reader.batch);
+    struct digest* hashes = (struct digest*) malloc(sizeof(struct digest) * reader.batch);
+
+    struct read_step step = { 0 };
+    int stopped = 0;
+
+    while((!stopped) && read_step_next(bpkg->chunks, NULL, bpkg->nchunks, reader.batch, reader.piece, reader.holes, &step)) {
+        const struct chunk* chunks = &bpkg->chunks[step.first];
+
+        // Chunks read in one piece can be checked for zeros before they're hashed
+        int whole = (step.done == 0) && read_step_last(bpkg->chunks, NULL, &step);
+
+        if((step.done == 0) && (!whole)) {
+            for(size_t j = 0; j < step.count; j++) {
+                sha256_compute_data_init(&buffs[j]);
+                data[j] = &buffs[j];
+            }
+        }
+
+        const char* bytes = buffer;
+
+        if(pipeline != NULL)
+            bytes = pipeline_take(pipeline);
+        else
+            load_step(&reader, &step, buffer);
+
+        if(bytes == NULL)
+            break;
+
+        for(size_t j = 0; j < step.count; j++)
+            blocks[j] = bytes + j * step.len;
+
+        // Every chunk of a hole run has the same size, so they share one digest of zeros
+        if(step.hole) {
+            zero_digest(chunks[0].size, &hashes[0]);
+
+            for(size_t j = 1; j < step.count; j++)
+                hashes[j] = hashes[0];
+        } else if(whole) {
+            hash_blocks(blocks, step.len, step.count, hashes);
+        } else {
+            sha256_update_multi(data, blocks, step.len, step.count);
+        }
+
+        if(pipeline != NULL)
+            pipeline_give_back(pipeline);
+
+        if(!read_step_last(bpkg->chunks, NULL, &step))
+            continue;
+
+        if(!whole) {
+            sha256_finalize_multi(data, step.count);
+
+            for(size_t j = 0; j < step.count; j++)
+                sha256_output(&buffs[j], hashes[j].bytes);
+        }
+
+        // Nothing read is needed again, so evict it as soon as it's hashed
+        if(drop && (!step.hole) && step.contiguous) {
+            drop_pages(fd, chunks[0].offset, chunks[0].size * step.count);
+        } else if(drop && (!step.hole)) {
+            for(size_t j = 0; j < step.count; j++)
+                drop_pages(fd, chunks[j].offset, chunks[j].size);
+        }
+
+        for(size_t j = 0; (j < step.count) && (!stopped); j++) {
+            if(digests != NULL)
+                digests[step.first + j] = hashes[j];
+
+            stopped = check_chunk(bpkg, res, step.first + j, &hashes[j], stack, depth);
+        }
+    }
+
+    // Stops the reader too when VERIFY_FAIL_FAST ends the pass early
+    pipeline_stop(pipeline);
+
+    free(hashes);
+    free(blocks);
+    free(data);
+    free(buffs);
+    free(buffer);
+    free(reader.bounce);
+    hole_map_destroy(reader.holes);
+
+    if(reader.direct_fd >= 0)
+        close(reader.direct_fd);
+
+    return stopped;
+}
+
+
+/**
+ * Verifies a data file against its bpkg object in a single
+ * sequential read without building a tree. Chunk hashes are
+ * folded into a stack holding at most one pending subtree per
+ * level, so memory stays at O(log n) digests and one read
+ * buffer however large the file is. The verify_mode build
+ * option can stop at the first failing chunk or collect the
+ * byte ranges of every failing chunk instead. With the
+ * use_cache build option an unchanged data file isn't read
+ * at all, its chunk hashes coming from the sidecar cache
+ * @param bpkg, constructed bpkg object
+ * @param res, verify result object to fill in
+ * @return 0 on success, -1 if the data file can't be opened
+ */
+int bpkg_verify_stream(struct bpkg_obj* bpkg, struct bpkg_verify* res) {
+    return bpkg_verify_stream_budget(bpkg, res, NULL);
+}
+
+
+/**
+ * Verifies a data file like bpkg_verify_stream(), taking the
+ * bytes of each read from a budget shared with other threads
+ * so many packages can be verified at once without every
+ * one of them reading at the same time
+ * @param bpkg, constructed bpkg object
+ * @param res, verify result object to fill in
+ * @param budget, budget to take read bytes from (NULL for none)
+ * @return 0 on success, -1 if the data file can't be opened
+ */
+int bpkg_verify_stream_budget(struct bpkg_obj* bpkg, struct bpkg_verify* res,
+    struct io_budget* budget) {
+    memset(res, 0, sizeof(struct bpkg_verify));
+    res->first_mismatch = -1;
+
+    if(bpkg->nchunks == 0)
+        return -1;
+
+    int fd = open(bpkg->filename, O_RDONLY);
+
+    if(fd < 0)
+        return -1;
+
+    struct subtree stack[VERIFY_STACK_MAX];
+    size_t depth = 0;
+    int stopped = 0;
+
+    // The cache needs every chunk hash, so it costs a digest per chunk
+    struct cache_key key;
+    struct digest* digests = NULL;
+
+    if(bpkg_get_opts()->use_cache && (cache_key_init(bpkg, fd, &key) == 0))
+        digests = (struct digest*) malloc(sizeof(struct digest) * bpkg->nchunks);
+
+    if((digests != NULL) && (cache_load(bpkg, &key, digests) == 0)) {
+        for(size_t i = 0; (i < bpkg->nchunks) && (!stopped); i++)
+            stopped = check_chunk(bpkg, res, i, &digests[i], stack, &depth);
+    } else {
+        stopped = stream_chunks(bpkg, fd, res, stack, &depth, digests, budget);
+
+        // Only a full pass has every chunk hash for the cache
+        if((digests != NULL) && (!stopped))
+            cache_save(bpkg, &key, fd, digests);
+    }
+
+    free(digests);
+    close(fd);
+
+    if(stopped)
+        return 0;
+
+    // A whole number of levels leaves the root alone on the stack
+    res->complete = 1;
+    res->root = stack[0].hash;
+
+    const struct digest* expected = bpkg->nhashes > 0 ? &bpkg->hashes[0] : &bpkg->chunks[0].hash;
+    res->ok = (depth == 1) && (memcmp(&res->root, expected, sizeof(struct digest)) == 0);
+
+    return 0;
+}
+
+
+/**
+ * Deallocates the failing byte ranges of a verify result
+ * @param res, pointer to verify result object
+ */
+void bpkg_verify_destroy(struct bpkg_verify* res) {
+    free(res->ranges);
+    res->ranges = NULL;
+    res->n_ranges = 0;
+}
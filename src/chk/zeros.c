@@ -0,0 +1,233 @@
+#include "chk/hasher.h"
+#include "chk/pkgchk.h"
+#include "chk/zeros.h"
+#include "crypt/sha256.h"
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ZEROS_X86
+#endif
+
+// Zeros hashed at a time by zero_digest()
+#define ZERO_PIECE (64 << 10)
+// Bytes scanned between checks for data
+#define ZERO_STRIDE 256
+
+
+/**
+ * zero chain object, the hash of an all-zero chunk
+ * and of all-zero subtrees of them at every height.
+ */
+struct zero_chain {
+    uint64_t size;
+    struct digest heights[ZERO_HEIGHTS];
+};
+
+static char zeros[ZERO_PIECE]; // never written
+static struct zero_chain chains[ZERO_SIZES];
+static uint32_t n_chains; // chains are complete before they're counted, so readers don't lock
+static pthread_mutex_t chains_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int (*scan_zeros)(const char* bytes, size_t size);
+
+
+/**
+ * Scans the bytes of a block a word at a time
+ * @param bytes, the block
+ * @param size, the size of the block
+ */
+static int scan_zeros_scalar(const char* bytes, size_t size) {
+    size_t i = 0;
+
+    for(; i + ZERO_STRIDE <= size; i += ZERO_STRIDE) {
+        uint64_t acc = 0;
+
+        for(size_t k = 0; k < ZERO_STRIDE; k += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, bytes + i + k, sizeof(word));
+            acc |= word;
+        }
+
+        if(acc != 0)
+            return 0;
+    }
+
+    for(; i < size; i++) {
+        if(bytes[i] != '\0')
+            return 0;
+    }
+
+    return 1;
+}
+
+
+#ifdef ZEROS_X86
+/**
+ * Scans the bytes of a block 32 at a time in AVX2 registers
+ * @param bytes, the block
+ * @param size, the size of the block
+ */
+__attribute__((target("avx2")))
+static int scan_zeros_avx2(const char* bytes, size_t size) {
+    size_t i = 0;
+
+    for(; i + ZERO_STRIDE <= size; i += ZERO_STRIDE) {
+        __m256i acc = _mm256_setzero_si256();
+
+        for(size_t k = 0; k < ZERO_STRIDE; k += sizeof(__m256i))
+            acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i*) (bytes + i + k)));
+
+        if(!_mm256_testz_si256(acc, acc))
+            return 0;
+    }
+
+    return scan_zeros_scalar(bytes + i, size - i);
+}
+
+
+/**
+ * Scans the bytes of a block 64 at a time in AVX-512 registers
+ * @param bytes, the block
+ * @param size, the size of the block
+ */
+__attribute__((target("avx512f")))
+static int scan_zeros_avx512(const char* bytes, size_t size) {
+    size_t i = 0;
+
+    for(; i + ZERO_STRIDE <= size; i += ZERO_STRIDE) {
+        __m512i acc = _mm512_setzero_si512();
+
+        for(size_t k = 0; k < ZERO_STRIDE; k += sizeof(__m512i))
+            acc = _mm512_or_si512(acc, _mm512_loadu_si512((const void*) (bytes + i + k)));
+
+        if(_mm512_test_epi64_mask(acc, acc) != 0)
+            return 0;
+    }
+
+    return scan_zeros_scalar(bytes + i, size - i);
+}
+#endif
+
+
+/**
+ * Indicates whether every byte of a block is zero, using
+ * the widest vector registers the CPU has. Blocks with data
+ * usually stop the scan within their first few bytes
+ * @param bytes, the block
+ * @param size, the size of the block
+ */
+int is_zero_block(const void* bytes, size_t size) {
+    int (*scan)(const char*, size_t) = __atomic_load_n(&scan_zeros, __ATOMIC_RELAXED);
+
+    // Every thread picks the same scan, so racing to store it is harmless
+    if(scan == NULL) {
+        scan = scan_zeros_scalar;
+#ifdef ZEROS_X86
+        __builtin_cpu_init();
+
+        if(__builtin_cpu_supports("avx512f"))
+            scan = scan_zeros_avx512;
+        else if(__builtin_cpu_supports("avx2"))
+            scan = scan_zeros_avx2;
+#endif
+        __atomic_store_n(&scan_zeros, scan, __ATOMIC_RELAXED);
+    }
+
+    return scan((const char*) bytes, size);
+}
+
+
+/**
+ * Hashes size zero bytes
+ * @param size, the number of zeros
+ * @param out, digest to store the result in
+ */
+static void hash_zeros(uint64_t size, struct digest* out) {
+    struct sha256_compute_data data;
+    sha256_compute_data_init(&data);
+
+    for(uint64_t done = 0; done < size; done += ZERO_PIECE)
+        sha256_update(&data, zeros, size - done < ZERO_PIECE ? size - done : ZERO_PIECE);
+
+    sha256_finalize(&data, NULL);
+    sha256_output(&data, out->bytes);
+}
+
+
+/**
+ * Returns the hash of a chunk of size zero bytes. The first
+ * ZERO_SIZES sizes asked for are kept, along with the hash
+ * of an all-zero subtree of their chunks at every height, so
+ * each one is only computed once per process
+ * @param size, the size of the chunk
+ * @param out, digest to store the result in
+ */
+void zero_digest(uint64_t size, struct digest* out) {
+    uint32_t n = __atomic_load_n(&n_chains, __ATOMIC_ACQUIRE);
+
+    for(uint32_t i = 0; i < n; i++) {
+        if(chains[i].size == size) {
+            *out = chains[i].heights[0];
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&chains_lock);
+
+    // Another thread may have added the size while this one waited
+    n = n_chains;
+
+    for(uint32_t i = 0; i < n; i++) {
+        if(chains[i].size == size) {
+            *out = chains[i].heights[0];
+            pthread_mutex_unlock(&chains_lock);
+            return;
+        }
+    }
+
+    // Once the table is full, sizes past it are hashed every time
+    if(n == ZERO_SIZES) {
+        pthread_mutex_unlock(&chains_lock);
+        hash_zeros(size, out);
+        return;
+    }
+
+    struct zero_chain* chain = &chains[n];
+    chain->size = size;
+    hash_zeros(size, &chain->heights[0]);
+
+    for(uint32_t h = 1; h < ZERO_HEIGHTS; h++) {
+        const struct digest* lefts[1] = { &chain->heights[h - 1] };
+        struct digest* outs[1] = { &chain->heights[h] };
+        hash_pairs(lefts, lefts, outs, 1);
+    }
+
+    *out = chain->heights[0];
+    __atomic_store_n(&n_chains, n + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&chains_lock);
+}
+
+
+/**
+ * Finds the parent of two copies of a kept all-zero subtree
+ * hash without hashing them
+ * @param child, the hash of both children
+ * @param out, digest to store the parent's hash in
+ * @return 1 if child is a kept all-zero subtree hash, 0 otherwise
+ */
+int zero_parent(const struct digest* child, struct digest* out) {
+    uint32_t n = __atomic_load_n(&n_chains, __ATOMIC_ACQUIRE);
+
+    for(uint32_t i = 0; i < n; i++) {
+        for(uint32_t h = 0; h + 1 < ZERO_HEIGHTS; h++) {
+            if(memcmp(child, &chains[i].heights[h], sizeof(struct digest)) == 0) {
+                *out = chains[i].heights[h + 1];
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
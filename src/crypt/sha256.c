@@ -3,9 +3,32 @@
 #include <string.h>
 #include <stdio.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA256_X86
+#endif
+
 #define SHA256K 64
 #define rotate_r(val, bits) (val >> bits | val << (32 - bits))
 
+//Compresses nblocks consecutive 64 byte blocks into hcomps
+typedef void (*sha256_blocks_fn)(uint32_t hcomps[SHA256_INT_SZ],
+		const uint8_t* chunk, size_t nblocks);
+
+//Compresses nblocks blocks of each of a fixed number of messages at once,
+//hcomps[i] and chunks[i] being the state and the data of lane i
+typedef void (*sha256_lanes_fn)(uint32_t* hcomps[],
+		const uint8_t* chunks[], size_t nblocks);
+
+//The compression functions a backend hashes with, lanes is NULL
+//(and width 1) when messages are hashed one at a time
+struct sha256_engine {
+	sha256_blocks_fn blocks;
+	sha256_lanes_fn lanes;
+	uint32_t width;
+};
+
 
 //Constant List from: https://en.wikipedia.org/wiki/SHA-2#Pseudocode
 static const uint32_t k[SHA256K] = {
@@ -62,8 +85,8 @@ void sha256_compute_data_init(struct sha256_compute_data* data) {
 
 //Derived from: https://en.wikipedia.org/wiki/SHA-2#Pseudocode
 //And https://github.com/LekKit/sha256/blob/master/sha256.c
-void sha256_calculate_chunk(struct sha256_compute_data *data, 
-		uint8_t chunk[SHA256_CHUNK_SZ]) {
+static void sha256_chunk_scalar(uint32_t hcomps[SHA256_INT_SZ], 
+		const uint8_t* chunk) {
 	uint32_t w[SHA256_CHUNK_SZ];
 	uint32_t tv[SHA256_INT_SZ];
 
@@ -92,7 +115,7 @@ void sha256_calculate_chunk(struct sha256_compute_data *data,
 	}
 
 	for(uint32_t i = 0; i < SHA256_INT_SZ; i++) {
-		tv[i] = data->hcomps[i];
+		tv[i] = hcomps[i];
 	}
 
 	for(uint32_t i = 0; i < SHA256_CHUNK_SZ; i++) {
@@ -126,16 +149,392 @@ void sha256_calculate_chunk(struct sha256_compute_data *data,
 	}
 
 	for(uint32_t i = 0; i < SHA256_INT_SZ; i++) {
-		data->hcomps[i] += tv[i];
+		hcomps[i] += tv[i];
+	}
+}
+
+static void sha256_blocks_scalar(uint32_t hcomps[SHA256_INT_SZ], 
+		const uint8_t* chunk, size_t nblocks) {
+	for(size_t i = 0; i < nblocks; i++) {
+		sha256_chunk_scalar(hcomps, chunk + i * SHA256_CHUNK_SZ);
+	}
+}
+
+#ifdef SHA256_X86
+//Derived from: Intel SHA Extensions white paper (Gulley et al., 2013)
+//The state is kept in the ABEF/CDGH layout sha256rnds2 expects for
+//the whole run of blocks and only shuffled back at the end
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_blocks_shani(uint32_t hcomps[SHA256_INT_SZ], 
+		const uint8_t* chunk, size_t nblocks) {
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 
+			0x0405060700010203ULL);
+	__m128i state0, state1, msg, tmp, w[4];
+
+	tmp = _mm_loadu_si128((const __m128i*) &hcomps[0]);
+	state1 = _mm_loadu_si128((const __m128i*) &hcomps[4]);
+	tmp = _mm_shuffle_epi32(tmp, 0xB1);
+	state1 = _mm_shuffle_epi32(state1, 0x1B);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+	while (nblocks-- > 0) {
+		__m128i abef = state0;
+		__m128i cdgh = state1;
+
+		//Each pass runs four rounds, w[] holds the last 16 schedule words
+		for (uint32_t i = 0; i < 16; i++) {
+			if (i < 4) {
+				msg = _mm_loadu_si128((const __m128i*) (chunk + i * 16));
+				w[i] = _mm_shuffle_epi8(msg, mask);
+			} else {
+				tmp = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+				tmp = _mm_add_epi32(tmp, 
+						_mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+				w[i & 3] = _mm_sha256msg2_epu32(tmp, w[(i + 3) & 3]);
+			}
+
+			msg = _mm_add_epi32(w[i & 3], 
+					_mm_loadu_si128((const __m128i*) &k[i * 4]));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg = _mm_shuffle_epi32(msg, 0x0E);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+		}
+
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+		chunk += SHA256_CHUNK_SZ;
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1B);
+	state1 = _mm_shuffle_epi32(state1, 0xB1);
+	state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+	state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+	_mm_storeu_si128((__m128i*) &hcomps[0], state0);
+	_mm_storeu_si128((__m128i*) &hcomps[4], state1);
+}
+
+//Reads a big-endian 32 bit word
+static inline uint32_t load_be32(const uint8_t* p) {
+	return (uint32_t) p[0] << 24 
+		| (uint32_t) p[1] << 16 
+		| (uint32_t) p[2] << 8 
+		| (uint32_t) p[3];
+}
+
+//Multi-buffer SHA-256: each vector register holds the same state or
+//message word of 8 (AVX2) or 16 (AVX-512) independent messages, so the
+//scalar rounds above run on every lane at once
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+AVX2_TARGET static inline __m256i ror_avx2(__m256i x, int bits) {
+	return _mm256_or_si256(_mm256_srli_epi32(x, bits), 
+			_mm256_slli_epi32(x, 32 - bits));
+}
+
+AVX2_TARGET static void sha256_lanes_avx2(uint32_t* hcomps[], 
+		const uint8_t* chunks[], size_t nblocks) {
+	uint32_t tmp[8];
+	__m256i s[SHA256_INT_SZ];
+	__m256i tv[SHA256_INT_SZ];
+	__m256i w[16];
+	const uint8_t* ptrs[8];
+
+	for (uint32_t i = 0; i < SHA256_INT_SZ; i++) {
+		for (uint32_t l = 0; l < 8; l++) {
+			tmp[l] = hcomps[l][i];
+		}
+		s[i] = _mm256_loadu_si256((const __m256i*) tmp);
+	}
+	for (uint32_t l = 0; l < 8; l++) {
+		ptrs[l] = chunks[l];
+	}
+
+	while (nblocks-- > 0) {
+		for (uint32_t i = 0; i < SHA256_INT_SZ; i++) {
+			tv[i] = s[i];
+		}
+
+		//w[] is a rolling window over the last 16 schedule words
+		for (uint32_t i = 0; i < SHA256_CHUNK_SZ; i++) {
+			if (i < 16) {
+				for (uint32_t l = 0; l < 8; l++) {
+					tmp[l] = load_be32(ptrs[l] + i * 4);
+				}
+				w[i] = _mm256_loadu_si256((const __m256i*) tmp);
+			} else {
+				__m256i w15 = w[(i - 15) & 15];
+				__m256i w2 = w[(i - 2) & 15];
+				__m256i s0 = _mm256_xor_si256(_mm256_xor_si256(
+						ror_avx2(w15, 7), ror_avx2(w15, 18)), 
+						_mm256_srli_epi32(w15, 3));
+				__m256i s1 = _mm256_xor_si256(_mm256_xor_si256(
+						ror_avx2(w2, 17), ror_avx2(w2, 19)), 
+						_mm256_srli_epi32(w2, 10));
+				w[i & 15] = _mm256_add_epi32(_mm256_add_epi32(w[i & 15], s0), 
+						_mm256_add_epi32(w[(i - 7) & 15], s1));
+			}
+
+			__m256i S1 = _mm256_xor_si256(_mm256_xor_si256(
+					ror_avx2(tv[4], 6), ror_avx2(tv[4], 11)), 
+					ror_avx2(tv[4], 25));
+			__m256i ch = _mm256_xor_si256(_mm256_and_si256(tv[4], tv[5]), 
+					_mm256_andnot_si256(tv[4], tv[6]));
+			__m256i temp1 = _mm256_add_epi32(_mm256_add_epi32(tv[7], S1), 
+					_mm256_add_epi32(_mm256_add_epi32(ch, w[i & 15]), 
+					_mm256_set1_epi32(k[i])));
+			__m256i S0 = _mm256_xor_si256(_mm256_xor_si256(
+					ror_avx2(tv[0], 2), ror_avx2(tv[0], 13)), 
+					ror_avx2(tv[0], 22));
+			__m256i maj = _mm256_xor_si256(_mm256_xor_si256(
+					_mm256_and_si256(tv[0], tv[1]), 
+					_mm256_and_si256(tv[0], tv[2])), 
+					_mm256_and_si256(tv[1], tv[2]));
+			__m256i temp2 = _mm256_add_epi32(S0, maj);
+
+			tv[7] = tv[6];
+			tv[6] = tv[5];
+			tv[5] = tv[4];
+			tv[4] = _mm256_add_epi32(tv[3], temp1);
+			tv[3] = tv[2];
+			tv[2] = tv[1];
+			tv[1] = tv[0];
+			tv[0] = _mm256_add_epi32(temp1, temp2);
+		}
+
+		for (uint32_t i = 0; i < SHA256_INT_SZ; i++) {
+			s[i] = _mm256_add_epi32(s[i], tv[i]);
+		}
+		for (uint32_t l = 0; l < 8; l++) {
+			ptrs[l] += SHA256_CHUNK_SZ;
+		}
+	}
+
+	for (uint32_t i = 0; i < SHA256_INT_SZ; i++) {
+		_mm256_storeu_si256((__m256i*) tmp, s[i]);
+		for (uint32_t l = 0; l < 8; l++) {
+			hcomps[l][i] = tmp[l];
+		}
+	}
+}
+
+//Same as the AVX2 lanes with 16 lanes, a native rotate and
+//ternary logic for ch (0xCA) and maj (0xE8)
+#define AVX512_TARGET __attribute__((target("avx512f")))
+
+AVX512_TARGET static void sha256_lanes_avx512(uint32_t* hcomps[], 
+		const uint8_t* chunks[], size_t nblocks) {
+	uint32_t tmp[16];
+	__m512i s[SHA256_INT_SZ];
+	__m512i tv[SHA256_INT_SZ];
+	__m512i w[16];
+	const uint8_t* ptrs[16];
+
+	for (uint32_t i = 0; i < SHA256_INT_SZ; i++) {
+		for (uint32_t l = 0; l < 16; l++) {
+			tmp[l] = hcomps[l][i];
+		}
+		s[i] = _mm512_loadu_si512((const void*) tmp);
+	}
+	for (uint32_t l = 0; l < 16; l++) {
+		ptrs[l] = chunks[l];
+	}
+
+	while (nblocks-- > 0) {
+		for (uint32_t i = 0; i < SHA256_INT_SZ; i++) {
+			tv[i] = s[i];
+		}
+
+		for (uint32_t i = 0; i < SHA256_CHUNK_SZ; i++) {
+			if (i < 16) {
+				for (uint32_t l = 0; l < 16; l++) {
+					tmp[l] = load_be32(ptrs[l] + i * 4);
+				}
+				w[i] = _mm512_loadu_si512((const void*) tmp);
+			} else {
+				__m512i w15 = w[(i - 15) & 15];
+				__m512i w2 = w[(i - 2) & 15];
+				__m512i s0 = _mm512_ternarylogic_epi32(_mm512_ror_epi32(w15, 7), 
+						_mm512_ror_epi32(w15, 18), _mm512_srli_epi32(w15, 3), 0x96);
+				__m512i s1 = _mm512_ternarylogic_epi32(_mm512_ror_epi32(w2, 17), 
+						_mm512_ror_epi32(w2, 19), _mm512_srli_epi32(w2, 10), 0x96);
+				w[i & 15] = _mm512_add_epi32(_mm512_add_epi32(w[i & 15], s0), 
+						_mm512_add_epi32(w[(i - 7) & 15], s1));
+			}
+
+			__m512i S1 = _mm512_ternarylogic_epi32(_mm512_ror_epi32(tv[4], 6), 
+					_mm512_ror_epi32(tv[4], 11), _mm512_ror_epi32(tv[4], 25), 0x96);
+			__m512i ch = _mm512_ternarylogic_epi32(tv[4], tv[5], tv[6], 0xCA);
+			__m512i temp1 = _mm512_add_epi32(_mm512_add_epi32(tv[7], S1), 
+					_mm512_add_epi32(_mm512_add_epi32(ch, w[i & 15]), 
+					_mm512_set1_epi32(k[i])));
+			__m512i S0 = _mm512_ternarylogic_epi32(_mm512_ror_epi32(tv[0], 2), 
+					_mm512_ror_epi32(tv[0], 13), _mm512_ror_epi32(tv[0], 22), 0x96);
+			__m512i maj = _mm512_ternarylogic_epi32(tv[0], tv[1], tv[2], 0xE8);
+			__m512i temp2 = _mm512_add_epi32(S0, maj);
+
+			tv[7] = tv[6];
+			tv[6] = tv[5];
+			tv[5] = tv[4];
+			tv[4] = _mm512_add_epi32(tv[3], temp1);
+			tv[3] = tv[2];
+			tv[2] = tv[1];
+			tv[1] = tv[0];
+			tv[0] = _mm512_add_epi32(temp1, temp2);
+		}
+
+		for (uint32_t i = 0; i < SHA256_INT_SZ; i++) {
+			s[i] = _mm512_add_epi32(s[i], tv[i]);
+		}
+		for (uint32_t l = 0; l < 16; l++) {
+			ptrs[l] += SHA256_CHUNK_SZ;
+		}
+	}
+
+	for (uint32_t i = 0; i < SHA256_INT_SZ; i++) {
+		_mm512_storeu_si512((void*) tmp, s[i]);
+		for (uint32_t l = 0; l < 16; l++) {
+			hcomps[l][i] = tmp[l];
+		}
+	}
+}
+#endif
+
+int sha256_backend_supported(enum sha256_backend backend) {
+	switch (backend) {
+	case SHA256_AUTO:
+	case SHA256_SCALAR:
+		return 1;
+#ifdef SHA256_X86
+	case SHA256_SHANI: {
+		//SHA-NI is CPUID leaf 7 EBX bit 29, the shuffles need SSSE3 and SSE4.1
+		uint32_t eax, ebx, ecx, edx;
+		if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) 
+				|| !(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1)) {
+			return 0;
+		}
+		if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+			return 0;
+		}
+		return (ebx & (1u << 29)) != 0;
+	}
+	//These also check that the OS saves the wider registers
+	case SHA256_AVX2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") != 0;
+	case SHA256_AVX512:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx512f") != 0;
+#endif
+	default:
+		return 0;
+	}
+}
+
+//Fills in the engine of a backend. The lane backends hash single
+//messages with the scalar code. SHA256_AUTO takes SHA-NI for single
+//messages when present, and for batches 16 AVX-512 lanes, which beat
+//SHA-NI, or else 8 AVX2 lanes only on CPUs without SHA-NI
+static int backend_engine(enum sha256_backend backend, 
+		struct sha256_engine* engine) {
+	if (!sha256_backend_supported(backend)) {
+		return -1;
+	}
+
+	engine->blocks = sha256_blocks_scalar;
+	engine->lanes = NULL;
+	engine->width = 1;
+
+#ifdef SHA256_X86
+	if (backend == SHA256_SHANI || (backend == SHA256_AUTO 
+			&& sha256_backend_supported(SHA256_SHANI))) {
+		engine->blocks = sha256_blocks_shani;
+	}
+	if (backend == SHA256_AVX512 || (backend == SHA256_AUTO 
+			&& sha256_backend_supported(SHA256_AVX512))) {
+		engine->lanes = sha256_lanes_avx512;
+		engine->width = 16;
+	} else if (backend == SHA256_AVX2 || (backend == SHA256_AUTO 
+			&& sha256_backend_supported(SHA256_AVX2) 
+			&& !sha256_backend_supported(SHA256_SHANI))) {
+		engine->lanes = sha256_lanes_avx2;
+		engine->width = 8;
+	}
+#endif
+	return 0;
+}
+
+//Selected once at startup, see sha256_set_backend()
+static struct sha256_engine sha256_engine = { sha256_blocks_scalar, NULL, 1 };
+static enum sha256_backend sha256_current = SHA256_SCALAR;
+
+/**
+ * Selects the compression backend used by every later hash. Not safe to
+ * call while other threads are hashing.
+ * @param backend, the backend to use, SHA256_AUTO for the fastest supported
+ * @return 0 on success, -1 if the CPU doesn't support the backend
+ */
+int sha256_set_backend(enum sha256_backend backend) {
+	struct sha256_engine engine;
+	if (backend_engine(backend, &engine) != 0) {
+		return -1;
+	}
+	sha256_engine = engine;
+	sha256_current = backend;
+	return 0;
+}
+
+enum sha256_backend sha256_get_backend(void) {
+	return sha256_current;
+}
+
+uint32_t sha256_multi_lanes(void) {
+	return sha256_engine.width;
+}
+
+__attribute__((constructor))
+static void sha256_select_backend(void) {
+	sha256_set_backend(SHA256_AUTO);
+}
+
+void sha256_calculate_chunk(struct sha256_compute_data *data, 
+		uint8_t chunk[SHA256_CHUNK_SZ]) {
+	sha256_engine.blocks(data->hcomps, chunk, 1);
+}
+
+//Compresses nblocks blocks of n messages, a lane width at a time.
+//Spare lanes of the last group re-read the first message's blocks
+//into a throwaway state
+static void sha256_multi_blocks(const struct sha256_engine* engine, 
+		uint32_t* hcomps[], const uint8_t* chunks[], size_t nblocks, 
+		uint32_t n) {
+	if (engine->lanes == NULL) {
+		for (uint32_t i = 0; i < n; i++) {
+			engine->blocks(hcomps[i], chunks[i], nblocks);
+		}
+		return;
+	}
+
+	uint32_t spare[SHA256_INT_SZ];
+	uint32_t* lane_hcomps[SHA256_MAX_LANES];
+	const uint8_t* lane_chunks[SHA256_MAX_LANES];
+
+	for (uint32_t base = 0; base < n; base += engine->width) {
+		for (uint32_t l = 0; l < engine->width; l++) {
+			lane_hcomps[l] = base + l < n ? hcomps[base + l] : spare;
+			lane_chunks[l] = base + l < n ? chunks[base + l] : chunks[base];
+		}
+		engine->lanes(lane_hcomps, lane_chunks, nblocks);
 	}
 }
 
 //Derived from: https://en.wikipedia.org/wiki/SHA-2#Pseudocode
 //And https://github.com/LekKit/sha256/blob/master/sha256.c
-void sha256_update(struct sha256_compute_data *data, 
-		void *bytes, uint32_t size) {
+static void sha256_update_with(const struct sha256_engine* engine, 
+		struct sha256_compute_data *data, const void *bytes, uint32_t size) {
 	
-	uint8_t* ptr = (uint8_t*) bytes;
+	const uint8_t* ptr = (const uint8_t*) bytes;
 	data->data_size += size;
 	
 	if (size + data->chunk_size >= 64) {
@@ -149,26 +548,106 @@ void sha256_update(struct sha256_compute_data *data,
 		ptr += (64 - data->chunk_size);
 		size -= (64 - data->chunk_size);
 		data->chunk_size = 0;
-		sha256_calculate_chunk(data, tmp_chunk);
+		engine->blocks(data->hcomps, tmp_chunk, 1);
 	}
 
-	while (size >= 64) {
-		sha256_calculate_chunk(data, ptr);
-		ptr += 64;
-		size -= 64; 
+	//Whole blocks go to the backend in one call
+	if (size >= 64) {
+		engine->blocks(data->hcomps, ptr, size / 64);
+		ptr += size & ~63u;
+		size &= 63u;
 	}
 
 	memcpy(data->last_chunk + data->chunk_size, ptr, size);
 	data->chunk_size += size;
 }
 
-//Derived from: https://en.wikipedia.org/wiki/SHA-2#Pseudocode
-//And https://github.com/LekKit/sha256/blob/master/sha256.c
-void sha256_finalize(struct sha256_compute_data *data, 
-		uint8_t hash[SHA256_INT_SZ]) {
-	
-	
+void sha256_update(struct sha256_compute_data *data, 
+		void *bytes, uint32_t size) {
+	sha256_update_with(&sha256_engine, data, bytes, size);
+}
+
+//Updates up to SHA256_MAX_LANES messages that are at the same position
+//with size bytes each, sharing every compression between the lanes
+static void sha256_update_group(const struct sha256_engine* engine, 
+		struct sha256_compute_data* data[], const void* bytes[], 
+		uint32_t size, uint32_t n) {
+	uint32_t* hcomps[SHA256_MAX_LANES];
+	const uint8_t* ptrs[SHA256_MAX_LANES];
+	uint8_t pending = data[0]->chunk_size;
+
+	//Messages that have drifted apart are updated one at a time
+	for (uint32_t i = 0; i < n; i++) {
+		if (data[i]->chunk_size != pending) {
+			for (uint32_t j = 0; j < n; j++) {
+				sha256_update_with(engine, data[j], bytes[j], size);
+			}
+			return;
+		}
+	}
+
+	for (uint32_t i = 0; i < n; i++) {
+		hcomps[i] = data[i]->hcomps;
+		ptrs[i] = (const uint8_t*) bytes[i];
+		data[i]->data_size += size;
+	}
+
+	//Top up the buffered partial blocks first
+	if (pending > 0 && size + pending >= 64) {
+		uint32_t fill = 64 - pending;
+		const uint8_t* chunks[SHA256_MAX_LANES];
+
+		for (uint32_t i = 0; i < n; i++) {
+			memcpy(data[i]->last_chunk + pending, ptrs[i], fill);
+			chunks[i] = data[i]->last_chunk;
+			ptrs[i] += fill;
+		}
+		sha256_multi_blocks(engine, hcomps, chunks, 1, n);
+		size -= fill;
+		pending = 0;
+	}
+
+	if (size >= 64) {
+		sha256_multi_blocks(engine, hcomps, ptrs, size / 64, n);
+		for (uint32_t i = 0; i < n; i++) {
+			ptrs[i] += size & ~63u;
+		}
+		size &= 63u;
+	}
+
+	for (uint32_t i = 0; i < n; i++) {
+		memcpy(data[i]->last_chunk + pending, ptrs[i], size);
+		data[i]->chunk_size = pending + size;
+	}
+}
+
+static void sha256_update_multi_with(const struct sha256_engine* engine, 
+		struct sha256_compute_data* data[], const void* bytes[], 
+		uint32_t size, uint32_t n) {
+	for (uint32_t base = 0; base < n; base += SHA256_MAX_LANES) {
+		uint32_t count = n - base < SHA256_MAX_LANES 
+			? n - base : SHA256_MAX_LANES;
+		sha256_update_group(engine, data + base, bytes + base, size, count);
+	}
+}
 
+/**
+ * Adds size bytes to each of n messages. Messages hashed side by side
+ * from the same position (such as equal sized merkle leaves) share
+ * each compression across the lanes of the selected backend.
+ * @param data, n sha256 data structs
+ * @param bytes, n buffers of size bytes each
+ * @param size, the number of bytes to add to each message
+ * @param n, the number of messages
+ */
+void sha256_update_multi(struct sha256_compute_data* data[], 
+		const void* bytes[], uint32_t size, uint32_t n) {
+	sha256_update_multi_with(&sha256_engine, data, bytes, size, n);
+}
+
+//Appends the 0x80 byte and zero padding, returning 1 when the
+//length no longer fits and an extra block must be compressed
+static int sha256_pad(struct sha256_compute_data* data) {
 	data->last_chunk[data->chunk_size] = 0x80;
 	data->chunk_size++;
 
@@ -177,20 +656,79 @@ void sha256_finalize(struct sha256_compute_data *data,
 			0, 
 			64 - data->chunk_size);
 
-	if (data->chunk_size > 56) {
-		sha256_calculate_chunk(data, data->last_chunk);
-		memset(data->last_chunk, 0, 64);
-	}
+	return data->chunk_size > 56;
+}
 
-	/* Add total size as big-endian int64 x8 */
+/* Add total size as big-endian int64 x8 */
+static void sha256_pad_length(struct sha256_compute_data* data) {
 	uint64_t size = data->data_size * 8;
 	
 	for (int32_t i = 8; i > 0; --i) {
 		data->last_chunk[55+i] = size & 255;
 		size >>= 8;
 	}
+}
+
+//Derived from: https://en.wikipedia.org/wiki/SHA-2#Pseudocode
+//And https://github.com/LekKit/sha256/blob/master/sha256.c
+static void sha256_finalize_with(const struct sha256_engine* engine, 
+		struct sha256_compute_data *data) {
+
+	if (sha256_pad(data)) {
+		engine->blocks(data->hcomps, data->last_chunk, 1);
+		memset(data->last_chunk, 0, 64);
+	}
+
+	sha256_pad_length(data);
+	engine->blocks(data->hcomps, data->last_chunk, 1);
+}
+
+void sha256_finalize(struct sha256_compute_data *data, 
+		uint8_t hash[SHA256_INT_SZ]) {
+	sha256_finalize_with(&sha256_engine, data);
+}
+
+static void sha256_finalize_multi_with(const struct sha256_engine* engine, 
+		struct sha256_compute_data* data[], uint32_t n) {
+	uint32_t* hcomps[SHA256_MAX_LANES];
+	const uint8_t* chunks[SHA256_MAX_LANES];
+
+	for (uint32_t base = 0; base < n; base += SHA256_MAX_LANES) {
+		uint32_t count = n - base < SHA256_MAX_LANES 
+			? n - base : SHA256_MAX_LANES;
+		uint32_t full = 0;
+
+		//Lanes whose length spills into an extra block go first
+		for (uint32_t i = base; i < base + count; i++) {
+			if (sha256_pad(data[i])) {
+				hcomps[full] = data[i]->hcomps;
+				chunks[full] = data[i]->last_chunk;
+				full++;
+			}
+		}
+		sha256_multi_blocks(engine, hcomps, chunks, 1, full);
+
+		for (uint32_t i = 0; i < full; i++) {
+			memset((uint8_t*) chunks[i], 0, 64);
+		}
+
+		for (uint32_t i = 0; i < count; i++) {
+			sha256_pad_length(data[base + i]);
+			hcomps[i] = data[base + i]->hcomps;
+			chunks[i] = data[base + i]->last_chunk;
+		}
+		sha256_multi_blocks(engine, hcomps, chunks, 1, count);
+	}
+}
 
-	sha256_calculate_chunk(data, data->last_chunk);
+/**
+ * Finishes n messages, compressing their final blocks across lanes.
+ * The digests are then read with sha256_output().
+ * @param data, n sha256 data structs
+ * @param n, the number of messages
+ */
+void sha256_finalize_multi(struct sha256_compute_data* data[], uint32_t n) {
+	sha256_finalize_multi_with(&sha256_engine, data, n);
 }
 
 //Original: https://github.com/LekKit/sha256/blob/master/sha256.c
@@ -223,3 +761,69 @@ void sha256_output_hex(struct sha256_compute_data* data,
 	sha256_output(data, hash);
 	bin_to_hex(hash, 32, hexbuf);
 }
+
+//Test vectors from: FIPS 180-2 Appendix B
+static const struct {
+	const char* msg;
+	uint32_t repeat;
+	const char* hex;
+} sha256_vectors[] = {
+	{ "", 1, 
+	  "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+	{ "abc", 1, 
+	  "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+	{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1, 
+	  "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+	{ "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+	  "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", 10000, 
+	  "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" }
+};
+
+/**
+ * Runs the known answer vectors through one backend directly, without
+ * changing the backend selected for the rest of the program. Each vector
+ * is hashed on its own and as a full batch of identical messages.
+ * @param backend, the backend to check
+ * @return 0 if every vector matches, 1 on a mismatch, -1 if unsupported
+ */
+int sha256_self_test(enum sha256_backend backend) {
+	struct sha256_engine engine;
+	if (backend_engine(backend, &engine) != 0) {
+		return -1;
+	}
+
+	uint32_t nvectors = sizeof(sha256_vectors) / sizeof(sha256_vectors[0]);
+	for (uint32_t v = 0; v < nvectors; v++) {
+		struct sha256_compute_data lanes[SHA256_MAX_LANES + 1];
+		struct sha256_compute_data* data[SHA256_MAX_LANES + 1];
+		const void* bytes[SHA256_MAX_LANES + 1];
+		uint8_t hash[32];
+		char hexbuf[64];
+
+		//Lane 0 is hashed on its own, the rest as one batch
+		for (uint32_t l = 0; l <= SHA256_MAX_LANES; l++) {
+			sha256_compute_data_init(&lanes[l]);
+			data[l] = &lanes[l];
+			bytes[l] = sha256_vectors[v].msg;
+		}
+
+		uint32_t len = strlen(sha256_vectors[v].msg);
+		for (uint32_t r = 0; r < sha256_vectors[v].repeat; r++) {
+			sha256_update_with(&engine, &lanes[0], sha256_vectors[v].msg, len);
+			sha256_update_multi_with(&engine, data + 1, bytes + 1, len, 
+					SHA256_MAX_LANES);
+		}
+		sha256_finalize_with(&engine, &lanes[0]);
+		sha256_finalize_multi_with(&engine, data + 1, SHA256_MAX_LANES);
+
+		for (uint32_t l = 0; l <= SHA256_MAX_LANES; l++) {
+			sha256_output(&lanes[l], hash);
+			bin_to_hex(hash, 32, hexbuf);
+
+			if (memcmp(hexbuf, sha256_vectors[v].hex, 64) != 0) {
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
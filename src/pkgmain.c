@@ -1,4 +1,10 @@
- #include <chk/pkgchk.h>
+ #include <add/inputs.h>
+#include <add/budget.h>
+#include <add/pool.h>
+#include <chk/batch.h>
+#include <chk/bpkg2.h>
+#include <chk/pkgchk.h>
+#include <chk/verify.h>
 #include <crypt/sha256.h>
 #include <string.h>
 #include <stdlib.h>
@@ -42,23 +48,187 @@ int arg_select(int argc, char** argv, int* asel, char* harg) {
 	if(strcmp(cursor, "-integrity_check") == 0) {
 		*asel = 6;
 	}
+	if(strcmp(cursor, "-convert") == 0) {
+		if(argc < 4) {
+			puts("output file not provided");
+			exit(1);
+		}
+		*asel = 7;
+	}
+	if(strcmp(cursor, "-batch") == 0) {
+		*asel = 8;
+	}
 	return *asel;
 }
 
 
+void opt_select(int argc, char** argv) {
+	struct bpkg_opts* opts = bpkg_get_opts();
+
+	// Options follow the flag (and the hash for -hashes_of)
+	for(int i = 3; i < argc; i++) {
+		if(strcmp(argv[i], "-threads") == 0) {
+			if(i + 1 >= argc) {
+				puts("thread count not provided");
+				exit(1);
+			}
+			opts->nthreads = (uint32_t) strtoul(argv[++i], NULL, 10);
+		}
+		if(strcmp(argv[i], "-mmap") == 0) {
+			opts->read_mode = READ_MMAP;
+		}
+		if(strcmp(argv[i], "-uring") == 0) {
+			opts->read_mode = READ_URING;
+		}
+		if(strcmp(argv[i], "-drop_pages") == 0) {
+			opts->page_mode = PAGES_DROP;
+		}
+		if(strcmp(argv[i], "-direct") == 0) {
+			opts->page_mode = PAGES_DIRECT;
+		}
+		if(strcmp(argv[i], "-flat") == 0) {
+			opts->engine = TREE_FLAT;
+		}
+		if(strcmp(argv[i], "-fail_fast") == 0) {
+			opts->verify_mode = VERIFY_FAIL_FAST;
+		}
+		if(strcmp(argv[i], "-report_all") == 0) {
+			opts->verify_mode = VERIFY_REPORT_ALL;
+		}
+		if(strcmp(argv[i], "-cache") == 0) {
+			opts->use_cache = 1;
+		}
+		if(strcmp(argv[i], "-pipeline") == 0) {
+			if(i + 1 >= argc) {
+				puts("ring size not provided");
+				exit(1);
+			}
+			opts->ring_slots = (uint32_t) strtoul(argv[++i], NULL, 10);
+		}
+		if(strcmp(argv[i], "-ring_kib") == 0) {
+			if(i + 1 >= argc) {
+				puts("ring buffer size not provided");
+				exit(1);
+			}
+			opts->ring_slot_bytes = (size_t) strtoull(argv[++i], NULL, 10) * 1024;
+		}
+	}
+}
+
+
+uint64_t budget_select(int argc, char** argv) {
+	uint64_t mib = 0;
+
+	// Only -batch shares a read budget, given in MiB
+	for(int i = 3; i < argc; i++) {
+		if(strcmp(argv[i], "-io_budget") == 0) {
+			if(i + 1 >= argc) {
+				puts("io budget not provided");
+				exit(1);
+			}
+			mib = strtoull(argv[++i], NULL, 10);
+		}
+	}
+
+	return mib * 1024 * 1024;
+}
+
+
 void bpkg_print_hashes(struct bpkg_query* qry) {
+	char hex[SHA256_HEX_LEN];
+
 	for(int i = 0; i < qry->len; i++) {
-		printf("%.64s\n", qry->hashes[i]);
+		// Hashes are kept in binary and only formatted here
+		if(qry->digests) {
+			digest_to_hash(&qry->digests[i], hex);
+			printf("%.64s\n", hex);
+		} else {
+			printf("%.64s\n", qry->hashes[i]);
+		}
 	}
 
 }
 
+void bpkg_print_batch(struct batch* batch) {
+	for(size_t i = 0; i < batch->n_packages; i++) {
+		struct batch_result* result = &batch->results[i];
+
+		if(result->status == BATCH_SUCCESS) {
+			printf("%s: SUCCESS\n", result->path);
+		} else if(result->status == BATCH_INVALID) {
+			printf("%s: FAILED (unable to load pkg)\n", result->path);
+		} else if(result->status == BATCH_NO_DATA) {
+			printf("%s: FAILED (unable to open data file)\n", result->path);
+		} else if(result->first_mismatch >= 0) {
+			printf("%s: FAILED (chunk %lld at offset %llu)\n", result->path,
+					(long long) result->first_mismatch,
+					(unsigned long long) result->first_offset);
+		} else {
+			printf("%s: FAILED (root hash)\n", result->path);
+		}
+	}
+}
+
+int run_batch(int argc, char** argv) {
+	struct batch* batch = batch_load(argv[1]);
+
+	if(!batch) {
+		puts("Unable to read batch");
+		return 1;
+	}
+
+	// Packages share the pool's threads and one read budget
+	uint64_t budget_bytes = budget_select(argc, argv);
+	struct thread_pool* pool = pool_create(bpkg_get_opts()->nthreads);
+	struct io_budget* budget = budget_bytes > 0 ? budget_create(budget_bytes) : NULL;
+
+	batch_run(batch, pool, budget);
+	bpkg_print_batch(batch);
+
+	budget_destroy(budget);
+	pool_destroy(pool);
+	batch_destroy(batch);
+
+	return 0;
+}
+
+void bpkg_print_mismatch(struct bpkg_verify* res) {
+	char hex[SHA256_HEX_LEN];
+
+	if(res->first_mismatch < 0)
+		return;
+
+	printf("First mismatching chunk: %lld\n", (long long) res->first_mismatch);
+	printf("Offset: %llu\n", (unsigned long long) res->first_offset);
+	digest_to_hash(&res->expected, hex);
+	printf("Expected: %.64s\n", hex);
+	digest_to_hash(&res->actual, hex);
+	printf("Actual: %.64s\n", hex);
+
+	// Only filled in with -report_all
+	if(res->n_ranges > 0)
+		printf("Mismatching chunks: %zu\n", res->n_mismatches);
+
+	for(size_t i = 0; i < res->n_ranges; i++) {
+		printf("Mismatching bytes: %llu-%llu\n",
+				(unsigned long long) res->ranges[i].offset,
+				(unsigned long long) (res->ranges[i].offset
+					+ res->ranges[i].length - 1));
+	}
+}
+
 int main(int argc, char** argv) {
 
 	int argselect = 0;
 	char hash[SHA256_HEX_LEN];
 
 	if(arg_select(argc, argv, &argselect, hash)) {
+		opt_select(argc, argv);
+
+		// A batch names many packages rather than one
+		if(argselect == 8)
+			return run_batch(argc, argv);
+
 		struct bpkg_query qry = { 0 };
 		struct bpkg_obj* obj = bpkg_load(argv[1]);
 
@@ -93,16 +263,29 @@ int main(int argc, char** argv) {
 			bpkg_print_hashes(&qry);
 			bpkg_query_destroy(&qry);
 		} else if(argselect == 6) {
-			struct bpkg_query qry2 = { 0 };
+			struct bpkg_verify res;
 
-			qry = bpkg_get_min_completed_hashes(obj);
-			qry2 = bpkg_get_all_hashes(obj);
-			if(strcmp(qry.hashes[0], qry2.hashes[0]) == 0)
+			// Stream the data file rather than building a tree
+			if((bpkg_verify_stream(obj, &res) == 0) && res.ok) {
 				printf("Integrity Check: SUCCESS\n");
-			else
+			} else {
 				printf("Integrity Check: FAILED...\n");
-			bpkg_query_destroy(&qry);
-			bpkg_query_destroy(&qry2);
+
+				// The plain check keeps its one line, the details come with -fail_fast and -report_all
+				if(bpkg_get_opts()->verify_mode != VERIFY_ROOT)
+					bpkg_print_mismatch(&res);
+			}
+			bpkg_verify_destroy(&res);
+		} else if(argselect == 7) {
+
+			// Write the package out in the binary bpkg2 format
+			if(bpkg2_save(obj, argv[3]) == 0) {
+				printf("Converted to %s\n", argv[3]);
+			} else {
+				puts("Unable to write bpkg2 file");
+				bpkg_obj_destroy(obj);
+				return 1;
+			}
 		} else {
 			puts("Argument is invalid");
 			return 1;
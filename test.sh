@@ -79,3 +79,75 @@ make clean-tests > /dev/null
 
 ### Test 21 − Hashes of Empty Ancestor (Edge Case)
 # Testing bpkg_get_all_chunk_hashes_from_hash() with a valid bpkg object and empty ancestor hash
+
+### Test 22 − Multithreaded Merkle Tree Construction (Positive Test Case)
+# Testing merkle_tree_build() with 4 threads gives the same root hash as a single thread
+
+### Test 23 − Memory-Mapped Merkle Tree Construction (Positive Test Case)
+# Testing merkle_tree_build() with the READ_MMAP read mode gives the same root hash as pread
+
+### Test 24 − Hash-Only Merkle Tree (Positive Test Case)
+# Testing merkle_tree_build() keeps no chunk data in leaf nodes by default and merkle_node_read() fetches the same bytes a retain_values tree keeps
+
+### Test 25 − Flat Merkle Tree Engine (Positive Test Case)
+# Testing bpkg_get_min_completed_hashes() with the TREE_FLAT engine returns the same hashes as the linked tree for a compromised data file
+
+### Test 26 − Binary Hashes (Positive Test Case)
+# Testing bpkg_get_all_hashes() returns the root hash of a bpkg file as its 32-byte binary digest
+
+### Test 27 − SHA-256 Backends (Positive Test Case)
+# Testing sha256_self_test() passes for every backend the CPU supports and that the SHA-NI and scalar backends hash the same inputs alike
+
+### Test 28 − Multi-Buffer SHA-256 (Positive Test Case)
+# Testing sha256_update_multi() and sha256_finalize_multi() match single message hashes on every supported backend, and that merkle_tree_build() gives the same root with batched leaves and pairs
+
+### Test 29 − Streaming Integrity Check (Positive Test Case)
+# Testing bpkg_verify_stream() verifies a complete data file against its root hash, and for a compromised data file computes the same root as merkle_tree_build() and reports the first mismatching chunk
+
+### Test 30 − Fail-Fast And Report-All Verification (Positive Test Case)
+# Testing bpkg_verify_stream() with VERIFY_FAIL_FAST stops at the first mismatching chunk with its offset and hashes, and with VERIFY_REPORT_ALL reports byte ranges covering every mismatching chunk
+
+### Test 31 − Single-Pass Parser Rules (Negative Test Case)
+# Testing bpkg_load() and is_valid_bpkg() reject trailing data, a hash count larger than the file can hold and a chunk line with a stray separator
+
+### Test 32 − Arena Allocation (Positive Test Case)
+# Testing arena_alloc() and arena_calloc() hand out aligned memory with large allocations in their own block, and that repeated merkle_tree_build() and query cycles backed by arenas give the same results
+
+### Test 33 − Binary Bpkg2 Format (Positive Test Case)
+# Testing bpkg2_save() writes a package in less than half the size of its text form, that bpkg_load() detects the bpkg2 format and loads the same package with uniform and explicit chunk offsets, and that a truncated bpkg2 file is rejected
+
+### Test 34 − Sparse Multi-Terabyte Package (Positive Test Case)
+# Testing bpkg_load() keeps sizes and offsets past 4 GiB in both formats, bpkg_file_check() creates a sparse 4 TiB data file, merkle_node_read() reads a chunk 3 TiB into it, and blocks larger than a read are hashed whole by merkle_tree_build() and bpkg_verify_stream()
+
+### Test 35 − Variable-Size Chunks (Positive Test Case)
+# Testing merkle_tree_build() hashes each leaf over exactly the [offset, offset + size) of its chunk with pread and mmap for chunks of different sizes, a short tail and an out-of-order chunk, and that bpkg_verify_stream() computes the same root and reports each chunk's own byte range
+
+### Test 36 − Sidecar Verification Cache (Positive Test Case)
+# Testing bpkg_verify_stream() with the use_cache build option writes a sidecar cache after a full pass, that it and merkle_tree_build() take leaf digests from the cache while the data file is unchanged, and that touching the data file makes it hashed again
+
+### Test 37 − Incremental Merkle Update (Positive Test Case)
+# Testing merkle_tree_update() rehashes only the leaves whose chunks overlap the modified byte ranges, once each, leaving a tree equal to a fresh merkle_tree_build(), and that restoring the data and updating gives back the expected root
+
+### Test 38 − Hash Index Lookup (Positive Test Case)
+# Testing bpkg_hash_index() builds the index once and hash_index_find() returns the heap position of every expected hash, and that bpkg_get_all_chunk_hashes_from_hash() answers for the root and an inner node of a package whose data file doesn't exist
+
+### Test 39 − Lazy Merkle Tree (Positive Test Case)
+# Testing merkle_tree_build_lazy() and merkle_tree_find() work without the data file, that merkle_tree_compute() only hashes the chunks below the node asked for, and that merkle_tree_update() on a lazy tree leaves dirty nodes to be hashed on demand
+
+### Test 40 − Batch Verification (Positive Test Case)
+# Testing batch_load() reads the packages of a manifest in order and of a directory in name order, that batch_run() across a pool with a shared budget gives each package its own result for valid, failing, missing-data and unloadable packages, and that budget_acquire() caps a request at the whole budget
+
+### Test 41 − io_uring Chunk Reader (Positive Test Case)
+# Testing uring_reader_queue() and uring_reader_wait() read several blocks in flight into their own slots and zero the tail past the end of the file, and that merkle_tree_build() with the READ_URING read mode gives the expected leaves, values and root with one and four threads
+
+### Test 42 − Page Cache Modes (Positive Test Case)
+# Testing read_block_direct() gives the same bytes as a normal read at unaligned offsets and for a tail past the end of the file, that merkle_tree_build() and bpkg_verify_stream() give the expected results with the PAGES_DROP and PAGES_DIRECT page modes, and that a direct read leaves none of the data file in the page cache
+
+### Test 43 − Read/Hash Pipeline (Positive Test Case)
+# Testing read_step_next() plans runs of same-sized chunks and pieces of large chunks, that a pipeline hands back slots in the order its reader filled them and can be stopped early, and that merkle_tree_build() and bpkg_verify_stream() through a ring of buffers give the expected results, including with slots smaller than a chunk
+
+### Test 44 − Sparse Data File Holes (Positive Test Case)
+# Testing zero_digest() matches hashing the zeros, that hole_map_load() and hole_map_is_hole() tell the chunks in holes from the ones with data, and that merkle_tree_build() and bpkg_verify_stream() give the same leaves and root for a sparse data file as for the same bytes written out in full
+
+### Test 45 − Zero Chunk Digests (Positive Test Case)
+# Testing is_zero_block() finds a single set byte at any position and alignment, that zero_digest() matches hashing the zeros and zero_parent() gives the parents of all-zero subtrees, and that merkle_tree_build() and bpkg_verify_stream() over zero chunks and a chunk of data match hashing every byte
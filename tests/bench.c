@@ -0,0 +1,223 @@
+#define _GNU_SOURCE
+#include "chk/bpkg2.h"
+#include "chk/pkgchk.h"
+#include "crypt/sha256.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/**
+ * Writes a data file of nchunks blocks and a bpkg file
+ * describing it. The expected hashes are placeholders as
+ * only the time taken to build the tree is of interest
+ * @param bpkg_path, path of the bpkg file to write
+ * @param data_path, path of the data file to write
+ * @param nchunks, the number of chunks (a power of 2)
+ * @param block_size, the size of each chunk
+ */
+static void write_package(const char* bpkg_path, const char* data_path,
+    uint32_t nchunks, uint32_t block_size) {
+
+    FILE *data = fopen(data_path, "w");
+    char *block = malloc(block_size);
+
+    for(uint32_t i = 0; i < nchunks; i++) {
+        memset(block, i & 0xff, block_size);
+        fwrite(block, 1, block_size, data);
+    }
+
+    free(block);
+    fclose(data);
+
+    FILE *fp = fopen(bpkg_path, "w");
+    char hash[HASH_SIZE];
+    memset(hash, '0', HASH_SIZE - 1);
+    hash[HASH_SIZE - 1] = '\0';
+
+    fprintf(fp, "ident:");
+    for(int i = 0; i < IDENT_SIZE - 1; i++)
+        fputc('0', fp);
+
+    fprintf(fp, "\nfilename:%s\nsize:%llu\nnhashes:%u\nhashes:\n", data_path,
+        (unsigned long long) nchunks * block_size, nchunks - 1);
+
+    for(uint32_t i = 0; i < nchunks - 1; i++)
+        fprintf(fp, "\t%s\n", hash);
+
+    fprintf(fp, "nchunks:%u\nchunks:\n", nchunks);
+
+    for(uint32_t i = 0; i < nchunks; i++)
+        fprintf(fp, "\t%s,%llu,%u\n", hash, (unsigned long long) i * block_size, block_size);
+
+    fclose(fp);
+}
+
+
+/**
+ * Returns the current time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**
+ * Times merkle_tree_build() on a generated package with
+ * 1 up to N threads, then with each SHA-256 backend. Small
+ * blocks make the non-leaf levels a large share of the work
+ * usage: ./bench [nchunks] [block_size] [max_threads] [rounds]
+ */
+int main(int argc, char** argv) {
+    uint32_t nchunks = argc > 1 ? strtoul(argv[1], NULL, 10) : (1 << 20);
+    uint32_t block_size = argc > 2 ? strtoul(argv[2], NULL, 10) : 64;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t max_threads = argc > 3 ? strtoul(argv[3], NULL, 10) : (ncpus > 0 ? ncpus : 1);
+    int rounds = argc > 4 ? atoi(argv[4]) : 3;
+
+    char bpkg_path[] = "/tmp/bench-XXXXXX.bpkg";
+    char data_path[] = "/tmp/bench-XXXXXX.data";
+    close(mkstemps(bpkg_path, 5));
+    close(mkstemps(data_path, 5));
+
+    write_package(bpkg_path, data_path, nchunks, block_size);
+
+    double load_start = now();
+    struct bpkg_obj *bpkg = bpkg_load(bpkg_path);
+    double load_time = now() - load_start;
+
+    if(!bpkg) {
+        puts("Unable to load generated package");
+        return 1;
+    }
+
+    // Time loading the same package from the binary format
+    char bpkg2_path[] = "/tmp/bench-XXXXXX.bpkg2";
+    close(mkstemps(bpkg2_path, 6));
+    bpkg2_save(bpkg, bpkg2_path);
+
+    double load2_start = now();
+    struct bpkg_obj *bpkg2 = bpkg_load(bpkg2_path);
+    double load2_time = now() - load2_start;
+
+    bpkg_obj_destroy(bpkg2);
+    remove(bpkg2_path);
+
+    printf("nchunks=%u block_size=%u rounds=%d\n", nchunks, block_size, rounds);
+    printf("bpkg_load %.4f seconds (bpkg2 %.4f seconds)\n", load_time, load2_time);
+    printf("%8s %12s %10s\n", "threads", "seconds", "speedup");
+
+    double base = 0;
+
+    // Double the threads each step, always finishing on max_threads
+    for(uint32_t threads = 1; threads <= max_threads;
+        threads = (threads < max_threads) & (threads * 2 > max_threads) ? max_threads : threads * 2) {
+        bpkg_get_opts()->nthreads = threads;
+
+        // Keep the best of the rounds to reduce noise
+        double best = 0;
+
+        for(int r = 0; r < rounds; r++) {
+            double start = now();
+            struct merkle_tree *tree = merkle_tree_build(bpkg);
+            double elapsed = now() - start;
+            merkle_tree_destroy(tree);
+
+            if((r == 0) | (elapsed < best))
+                best = elapsed;
+        }
+
+        if(threads == 1)
+            base = best;
+
+        printf("%8u %12.4f %9.2fx\n", threads, best, base / best);
+    }
+
+    // Compare the SHA-256 backends on a single thread
+    const enum sha256_backend backends[] = { SHA256_SCALAR, SHA256_SHANI, SHA256_AVX2, SHA256_AVX512, SHA256_AUTO };
+    const char* names[] = { "scalar", "sha-ni", "avx2", "avx512", "auto" };
+    enum sha256_backend prev = sha256_get_backend();
+    bpkg_get_opts()->nthreads = 1;
+
+    printf("%8s %12s\n", "backend", "seconds");
+
+    for(int b = 0; b < 5; b++) {
+        if(sha256_set_backend(backends[b]) != 0)
+            continue;
+
+        double best = 0;
+
+        for(int r = 0; r < rounds; r++) {
+            double start = now();
+            struct merkle_tree *tree = merkle_tree_build(bpkg);
+            double elapsed = now() - start;
+            merkle_tree_destroy(tree);
+
+            if((r == 0) | (elapsed < best))
+                best = elapsed;
+        }
+
+        printf("%8s %12.4f\n", names[b], best);
+    }
+    sha256_set_backend(prev);
+
+    // Compare the ways of reading the data file on a single thread
+    const enum bpkg_read_mode modes[] = { READ_PREAD, READ_MMAP, READ_URING };
+    const char* mode_names[] = { "pread", "mmap", "uring" };
+
+    printf("%8s %12s\n", "read", "seconds");
+
+    for(int m = 0; m < 3; m++) {
+        bpkg_get_opts()->read_mode = modes[m];
+
+        double best = 0;
+
+        for(int r = 0; r < rounds; r++) {
+            double start = now();
+            struct merkle_tree *tree = merkle_tree_build(bpkg);
+            double elapsed = now() - start;
+            merkle_tree_destroy(tree);
+
+            if((r == 0) | (elapsed < best))
+                best = elapsed;
+        }
+
+        printf("%8s %12.4f\n", mode_names[m], best);
+    }
+    bpkg_get_opts()->read_mode = READ_PREAD;
+
+    // Compare ring sizes for the reader thread on a single hashing thread
+    const uint32_t ring_sizes[] = { 0, 2, 4, 8 };
+
+    printf("%8s %12s\n", "ring", "seconds");
+
+    for(int s = 0; s < 4; s++) {
+        bpkg_get_opts()->ring_slots = ring_sizes[s];
+
+        double best = 0;
+
+        for(int r = 0; r < rounds; r++) {
+            double start = now();
+            struct merkle_tree *tree = merkle_tree_build(bpkg);
+            double elapsed = now() - start;
+            merkle_tree_destroy(tree);
+
+            if((r == 0) | (elapsed < best))
+                best = elapsed;
+        }
+
+        printf("%8u %12.4f\n", ring_sizes[s], best);
+    }
+    bpkg_get_opts()->ring_slots = 0;
+
+    bpkg_obj_destroy(bpkg);
+    remove(bpkg_path);
+    remove(data_path);
+
+    return 0;
+}
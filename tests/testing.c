@@ -1,6 +1,29 @@
+#define _GNU_SOURCE
+#include "add/arena.h"
+#include "add/budget.h"
+#include "add/inputs.h"
+#include "add/pool.h"
+#include "chk/batch.h"
+#include "chk/bpkg2.h"
+#include "chk/cache.h"
+#include "chk/hasher.h"
+#include "chk/holes.h"
+#include "chk/index.h"
+#include "chk/pipeline.h"
 #include "chk/pkgchk.h"
+#include "chk/uring.h"
+#include "chk/verify.h"
+#include "chk/zeros.h"
+#include "crypt/sha256.h"
+#include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <stdarg.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 #include <stddef.h>
 #include <setjmp.h>
 #include <cmocka.h>
@@ -199,6 +222,1302 @@ static void get_hashes_of_empty_ancestor_test(void **state) {
 }
 
 
+// Test 22 − Multithreaded Merkle Tree Construction (Positive Test Case)
+static void merkle_tree_build_threads_test(void **state) {
+    struct bpkg_obj *bpkg = bpkg_load("tests/pkgs/file1.bpkg");
+    struct merkle_tree *tree = merkle_tree_build(bpkg);
+    bpkg_get_opts()->nthreads = 4;
+    struct merkle_tree *tree_mt = merkle_tree_build(bpkg);
+    bpkg_get_opts()->nthreads = 1;
+    // Check that the threaded build computes the same root hash
+    assert_memory_equal(&tree_mt->root->computed_hash, &tree->root->computed_hash, DIGEST_SIZE);
+    merkle_tree_destroy(tree);
+    merkle_tree_destroy(tree_mt);
+    bpkg_obj_destroy(bpkg);
+}
+
+
+// Test 23 − Memory-Mapped Merkle Tree Construction (Positive Test Case)
+static void merkle_tree_build_mmap_test(void **state) {
+    struct bpkg_obj *bpkg = bpkg_load("tests/pkgs/file1.bpkg");
+    struct merkle_tree *tree = merkle_tree_build(bpkg);
+    bpkg_get_opts()->read_mode = READ_MMAP;
+    struct merkle_tree *tree_mm = merkle_tree_build(bpkg);
+    bpkg_get_opts()->read_mode = READ_PREAD;
+    // Check that hashing from the mapped file computes the same root hash
+    assert_memory_equal(&tree_mm->root->computed_hash, &tree->root->computed_hash, DIGEST_SIZE);
+    merkle_tree_destroy(tree);
+    merkle_tree_destroy(tree_mm);
+    bpkg_obj_destroy(bpkg);
+}
+
+
+// Test 24 − Hash-Only Merkle Tree (Positive Test Case)
+static void merkle_tree_hash_only_test(void **state) {
+    struct bpkg_obj *bpkg = bpkg_load("tests/pkgs/file1.bpkg");
+    struct merkle_tree *tree = merkle_tree_build(bpkg);
+    bpkg_get_opts()->retain_values = 1;
+    struct merkle_tree *tree_rv = merkle_tree_build(bpkg);
+    bpkg_get_opts()->retain_values = 0;
+
+    // Walk down to the last leaf of both trees
+    struct merkle_tree_node *leaf = tree->root, *leaf_rv = tree_rv->root;
+    while(leaf->right) {
+        leaf = leaf->right;
+        leaf_rv = leaf_rv->right;
+    }
+
+    // Check that no chunk is kept and that it can be fetched on demand
+    assert_null(leaf->value);
+    char buffer[4096];
+    assert_int_equal(merkle_node_read(bpkg, leaf, buffer), leaf->length);
+    assert_memory_equal(buffer, leaf_rv->value, leaf->length);
+    merkle_tree_destroy(tree);
+    merkle_tree_destroy(tree_rv);
+    bpkg_obj_destroy(bpkg);
+}
+
+
+// Test 25 − Flat Merkle Tree Engine (Positive Test Case)
+static void flat_engine_min_hashes_test(void **state) {
+    struct bpkg_obj *bpkg = bpkg_load("tests/pkgs/file18.bpkg");
+    struct bpkg_query qry = bpkg_get_min_completed_hashes(bpkg);
+    bpkg_get_opts()->engine = TREE_FLAT;
+    struct bpkg_query qry_flat = bpkg_get_min_completed_hashes(bpkg);
+    bpkg_get_opts()->engine = TREE_LINKED;
+    // Check that the flat engine returns the same hashes in the same order
+    assert_int_equal(qry_flat.len, qry.len);
+    assert_memory_equal(qry_flat.digests, qry.digests, qry.len * DIGEST_SIZE);
+    bpkg_query_destroy(&qry);
+    bpkg_query_destroy(&qry_flat);
+    bpkg_obj_destroy(bpkg);
+}
+
+
+// Test 26 − Binary Hashes (Positive Test Case)
+static void binary_hashes_test(void **state) {
+    struct bpkg_obj *bpkg = bpkg_load("tests/pkgs/file1.bpkg");
+    struct bpkg_query qry = bpkg_get_all_hashes(bpkg);
+    // Check that the hexadecimal root hash is stored as 32 bytes
+    const uint8_t root[DIGEST_SIZE] = {
+        0x6b, 0x00, 0x3f, 0xdf, 0x99, 0x36, 0x99, 0x05, 0x8a, 0x49, 0x25, 0xa2, 0xb9, 0x19, 0x46, 0xdf,
+        0xe4, 0xf0, 0x16, 0xf3, 0xe2, 0x87, 0xc0, 0xf4, 0x5f, 0x12, 0xa7, 0x00, 0xf8, 0x3a, 0xb4, 0xc1
+    };
+    assert_memory_equal(qry.digests[0].bytes, root, DIGEST_SIZE);
+    bpkg_query_destroy(&qry);
+    bpkg_obj_destroy(bpkg);
+}
+
+
+// Test 27 − SHA-256 Backends (Positive Test Case)
+static void sha256_backends_test(void **state) {
+    // Check the known answer vectors against every supported backend
+    assert_int_equal(sha256_self_test(SHA256_SCALAR), 0);
+    if(sha256_backend_supported(SHA256_SHANI))
+        assert_int_equal(sha256_self_test(SHA256_SHANI), 0);
+    else
+        assert_int_equal(sha256_set_backend(SHA256_SHANI), -1);
+
+    // Check every backend gives the same hashes across block boundaries
+    enum sha256_backend prev = sha256_get_backend();
+    uint8_t bytes[300];
+    for(int i = 0; i < 300; i++)
+        bytes[i] = (uint8_t) (i * 31 + 7);
+
+    for(uint32_t len = 0; len <= 300; len += 5) {
+        uint8_t expected[32], actual[32];
+        struct sha256_compute_data data;
+
+        assert_int_equal(sha256_set_backend(SHA256_SCALAR), 0);
+        sha256_compute_data_init(&data);
+        sha256_update(&data, bytes, len);
+        sha256_finalize(&data, NULL);
+        sha256_output(&data, expected);
+
+        assert_int_equal(sha256_set_backend(SHA256_AUTO), 0);
+        sha256_compute_data_init(&data);
+        sha256_update(&data, bytes, len);
+        sha256_finalize(&data, NULL);
+        sha256_output(&data, actual);
+
+        assert_memory_equal(actual, expected, 32);
+    }
+    sha256_set_backend(prev);
+}
+
+
+// Test 28 − Multi-Buffer SHA-256 (Positive Test Case)
+static void sha256_multi_test(void **state) {
+    enum sha256_backend prev = sha256_get_backend();
+    const enum sha256_backend backends[] = { SHA256_SCALAR, SHA256_SHANI, SHA256_AVX2, SHA256_AVX512 };
+    static uint8_t bytes[20][300];
+    for(int m = 0; m < 20; m++)
+        for(int i = 0; i < 300; i++)
+            bytes[m][i] = (uint8_t) (i * 31 + m * 7);
+
+    struct bpkg_obj *bpkg = bpkg_load("tests/pkgs/file1.bpkg");
+    assert_int_equal(sha256_set_backend(SHA256_SCALAR), 0);
+    struct merkle_tree *tree = merkle_tree_build(bpkg);
+
+    for(int b = 0; b < 4; b++) {
+        if(sha256_set_backend(backends[b]) != 0)
+            continue;
+
+        // Check a batch of 20 messages hashes the same as each message on its own
+        for(uint32_t len = 0; len <= 300; len += 37) {
+            struct sha256_compute_data lanes[20];
+            struct sha256_compute_data* data[20];
+            const void* msgs[20];
+
+            for(int m = 0; m < 20; m++) {
+                sha256_compute_data_init(&lanes[m]);
+                data[m] = &lanes[m];
+                msgs[m] = bytes[m];
+            }
+
+            // Feed the batch in two parts to cover partial blocks
+            sha256_update_multi(data, msgs, len / 3, 20);
+            for(int m = 0; m < 20; m++)
+                msgs[m] = bytes[m] + len / 3;
+            sha256_update_multi(data, msgs, len - len / 3, 20);
+            sha256_finalize_multi(data, 20);
+
+            for(int m = 0; m < 20; m++) {
+                uint8_t expected[32], actual[32];
+                struct sha256_compute_data single;
+                sha256_compute_data_init(&single);
+                sha256_update(&single, bytes[m], len);
+                sha256_finalize(&single, NULL);
+                sha256_output(&single, expected);
+                sha256_output(&lanes[m], actual);
+                assert_memory_equal(actual, expected, 32);
+            }
+        }
+
+        // Check a tree built with batched leaves and pairs has the same root
+        struct merkle_tree *tree_mb = merkle_tree_build(bpkg);
+        assert_memory_equal(&tree_mb->root->computed_hash, &tree->root->computed_hash, DIGEST_SIZE);
+        merkle_tree_destroy(tree_mb);
+    }
+
+    sha256_set_backend(prev);
+    merkle_tree_destroy(tree);
+    bpkg_obj_destroy(bpkg);
+}
+
+
+// Test 29 − Streaming Integrity Check (Positive Test Case)
+static void verify_stream_test(void **state) {
+    struct bpkg_verify res;
+
+    // Check a complete data file verifies with the bpkg's root hash
+    struct bpkg_obj *bpkg = bpkg_load("tests/pkgs/file1.bpkg");
+    assert_int_equal(bpkg_verify_stream(bpkg, &res), 0);
+    assert_int_equal(res.ok, 1);
+    assert_int_equal(res.first_mismatch, -1);
+    assert_memory_equal(&res.root, &bpkg->hashes[0], DIGEST_SIZE);
+    bpkg_obj_destroy(bpkg);
+
+    // Check a compromised data file reports the first chunk that differs from the tree
+    bpkg = bpkg_load("tests/pkgs/file18.bpkg");
+    struct merkle_tree *tree = merkle_tree_build(bpkg);
+    assert_int_equal(bpkg_verify_stream(bpkg, &res), 0);
+    assert_int_equal(res.ok, 0);
+    assert_memory_equal(&res.root, &tree->root->computed_hash, DIGEST_SIZE);
+
+    struct merkle_tree_node *node = tree->root;
+    int64_t first = 0;
+    // Follow the leftmost mismatching subtree down to its chunk
+    while(!node->is_leaf) {
+        first *= 2;
+        if(memcmp(&node->left->computed_hash, &node->left->expected_hash, DIGEST_SIZE) != 0) {
+            node = node->left;
+        } else {
+            node = node->right;
+            first += 1;
+        }
+    }
+    assert_int_equal(res.first_mismatch, first);
+
+    merkle_tree_destroy(tree);
+    bpkg_obj_destroy(bpkg);
+}
+
+
+// Test 30 − Fail-Fast And Report-All Verification (Positive Test Case)
+static void verify_modes_test(void **state) {
+    struct bpkg_obj *bpkg = bpkg_load("tests/pkgs/file18.bpkg");
+    struct bpkg_verify full, fast, all;
+
+    assert_int_equal(bpkg_verify_stream(bpkg, &full), 0);
+
+    // Check fail-fast stops at the same first chunk without a root
+    bpkg_get_opts()->verify_mode = VERIFY_FAIL_FAST;
+    assert_int_equal(bpkg_verify_stream(bpkg, &fast), 0);
+    assert_int_equal(fast.complete, 0);
+    assert_int_equal(fast.ok, 0);
+    assert_int_equal(fast.n_mismatches, 1);
+    assert_int_equal(fast.first_mismatch, full.first_mismatch);
+    assert_int_equal(fast.first_offset, full.first_offset);
+    assert_memory_equal(&fast.expected, &bpkg->chunks[fast.first_mismatch].hash, DIGEST_SIZE);
+    assert_memory_not_equal(&fast.actual, &fast.expected, DIGEST_SIZE);
+
+    // Check report-all covers every chunk that differs from the tree
+    bpkg_get_opts()->verify_mode = VERIFY_REPORT_ALL;
+    assert_int_equal(bpkg_verify_stream(bpkg, &all), 0);
+    assert_int_equal(all.complete, 1);
+    assert_memory_equal(&all.root, &full.root, DIGEST_SIZE);
+
+    struct merkle_tree *tree = merkle_tree_build(bpkg);
+    int len = 0;
+    struct digest *completed = (struct digest*) malloc(sizeof(struct digest) * bpkg->nchunks);
+    get_completed_chunks(completed, tree->root, &len);
+    assert_int_equal(all.n_mismatches, bpkg->nchunks - len);
+
+    uint64_t covered = 0;
+    size_t block_size = bpkg->size / bpkg->nchunks;
+    for(size_t i = 0; i < all.n_ranges; i++) {
+        assert_int_equal(all.ranges[i].offset % block_size, 0);
+        covered += all.ranges[i].length;
+    }
+    assert_int_equal(covered, all.n_mismatches * block_size);
+
+    free(completed);
+    merkle_tree_destroy(tree);
+    bpkg_verify_destroy(&all);
+    bpkg_obj_destroy(bpkg);
+
+    // Check neighbouring failing chunks are merged into one range
+    bpkg = bpkg_load("tests/pkgs/file1.bpkg");
+    block_size = bpkg->size / bpkg->nchunks;
+    FILE *src = fopen(bpkg->filename, "rb");
+    char *data = (char*) malloc(bpkg->size);
+    assert_int_equal(fread(data, 1, bpkg->size, src), bpkg->size);
+    fclose(src);
+
+    data[1 * block_size] ^= 1;
+    data[2 * block_size + 5] ^= 1;
+    data[5 * block_size + block_size - 1] ^= 1;
+
+    strcpy(bpkg->filename, "/tmp/pkgchk_verify_test.data");
+    FILE *dst = fopen(bpkg->filename, "wb");
+    fwrite(data, 1, bpkg->size, dst);
+    fclose(dst);
+    free(data);
+
+    assert_int_equal(bpkg_verify_stream(bpkg, &all), 0);
+    assert_int_equal(all.n_mismatches, 3);
+    assert_int_equal(all.n_ranges, 2);
+    assert_int_equal(all.ranges[0].offset, 1 * block_size);
+    assert_int_equal(all.ranges[0].length, 2 * block_size);
+    assert_int_equal(all.ranges[1].offset, 5 * block_size);
+    assert_int_equal(all.ranges[1].length, block_size);
+    remove(bpkg->filename);
+
+    bpkg_get_opts()->verify_mode = VERIFY_ROOT;
+    bpkg_verify_destroy(&full);
+    bpkg_verify_destroy(&fast);
+    bpkg_verify_destroy(&all);
+    bpkg_obj_destroy(bpkg);
+}
+
+
+// Test 31 − Single-Pass Parser Rules (Negative Test Case)
+static void parser_rules_test(void **state) {
+    FILE *src = fopen("tests/pkgs/file1.bpkg", "rb");
+    fseek(src, 0, SEEK_END);
+    long size = ftell(src);
+    fseek(src, 0, SEEK_SET);
+    char *text = (char*) malloc(size + 64);
+    assert_int_equal(fread(text, 1, size, src), size);
+    fclose(src);
+
+    const char *path = "/tmp/pkgchk_parser_test.bpkg";
+    assert_int_equal(is_valid_bpkg("tests/pkgs/file1.bpkg"), 1);
+
+    // Check trailing data after the last chunk is rejected
+    FILE *fp = fopen(path, "wb");
+    fwrite(text, 1, size, fp);
+    fputs("extra\n", fp);
+    fclose(fp);
+    assert_null(bpkg_load(path));
+    assert_int_equal(is_valid_bpkg(path), 0);
+
+    // Check a hash count larger than the file can hold is rejected before allocating
+    char *nhashes = strstr(text, "nhashes:");
+    fp = fopen(path, "wb");
+    fwrite(text, 1, nhashes - text, fp);
+    fputs("nhashes:4000000000", fp);
+    char *rest = strchr(nhashes, '\n');
+    fwrite(rest, 1, size - (rest - text), fp);
+    fclose(fp);
+    assert_null(bpkg_load(path));
+
+    // Check a chunk line with a stray separator is rejected
+    text[size - 2] = ',';
+    fp = fopen(path, "wb");
+    fwrite(text, 1, size - 1, fp);
+    fputc('\n', fp);
+    fclose(fp);
+    assert_null(bpkg_load(path));
+
+    remove(path);
+    free(text);
+}
+
+
+// Test 32 − Arena Allocation (Positive Test Case)
+static void arena_test(void **state) {
+    struct arena *arena = arena_create(256);
+
+    // Check allocations are aligned for any type and counted
+    char *a = (char*) arena_alloc(arena, 3);
+    char *b = (char*) arena_alloc(arena, 5);
+    assert_int_equal((uintptr_t) a % _Alignof(max_align_t), 0);
+    assert_int_equal((uintptr_t) b % _Alignof(max_align_t), 0);
+    assert_true(b >= a + 3);
+
+    // Check a large allocation gets its own block and zeroed memory stays zeroed
+    char *big = (char*) arena_calloc(arena, 4096);
+    for(int i = 0; i < 4096; i++)
+        assert_int_equal(big[i], 0);
+    memset(big, 0xff, 4096);
+    assert_true(arena_used(arena) >= 4096 + 8);
+
+    // Check the current block is still used after the large allocation
+    char *c = (char*) arena_alloc(arena, 8);
+    assert_true(c > b && c < b + 256);
+    arena_destroy(arena);
+    arena_destroy(NULL);
+
+    // Check repeated load, build and query cycles give the same results
+    struct bpkg_obj *bpkg = bpkg_load("tests/pkgs/file18.bpkg");
+    struct bpkg_query first = bpkg_get_all_hashes(bpkg);
+    for(int i = 0; i < 3; i++) {
+        struct merkle_tree *tree = merkle_tree_build(bpkg);
+        assert_int_equal(tree->n_nodes, first.len);
+        assert_string_equal(tree->root->key, "root");
+        merkle_tree_destroy(tree);
+
+        struct bpkg_query qry = bpkg_get_all_hashes(bpkg);
+        assert_int_equal(qry.len, first.len);
+        assert_memory_equal(qry.digests, first.digests, sizeof(struct digest) * qry.len);
+        bpkg_query_destroy(&qry);
+        bpkg_query_destroy(&qry);
+    }
+    bpkg_query_destroy(&first);
+    bpkg_obj_destroy(bpkg);
+}
+
+
+// Test 33 − Binary Bpkg2 Format (Positive Test Case)
+static void bpkg2_format_test(void **state) {
+    const char *path = "/tmp/pkgchk_bpkg2_test.bpkg";
+    struct bpkg_obj *text = bpkg_load("tests/pkgs/file2.bpkg");
+    assert_int_equal(bpkg2_save(text, path), 0);
+
+    // Check the binary file is less than half the size of the text one
+    FILE *fp = fopen(path, "rb");
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fclose(fp);
+    assert_true(size * 2 < 75001);
+
+    // Check bpkg_load() detects the binary format and loads the same package
+    struct bpkg_obj *bin = bpkg_load(path);
+    assert_non_null(bin);
+    assert_string_equal(bin->ident, text->ident);
+    assert_string_equal(bin->filename, text->filename);
+    assert_int_equal(bin->size, text->size);
+    assert_int_equal(bin->nhashes, text->nhashes);
+    assert_int_equal(bin->nchunks, text->nchunks);
+    assert_memory_equal(bin->hashes, text->hashes, sizeof(struct digest) * text->nhashes);
+    assert_memory_equal(bin->chunks, text->chunks, sizeof(struct chunk) * text->nchunks);
+    assert_int_equal(is_valid_bpkg(path), 1);
+    bpkg_obj_destroy(bin);
+
+    // Check chunks that aren't back to back keep their offsets and sizes
+    text->chunks[1].size = 100;
+    text->chunks[2].offset = 7;
+    assert_int_equal(bpkg2_save(text, path), 0);
+    bin = bpkg_load(path);
+    assert_non_null(bin);
+    assert_memory_equal(bin->chunks, text->chunks, sizeof(struct chunk) * text->nchunks);
+    bpkg_obj_destroy(bin);
+
+    // Check a truncated file is rejected
+    assert_int_equal(truncate(path, size - 1), 0);
+    assert_null(bpkg_load(path));
+
+    remove(path);
+    bpkg_obj_destroy(text);
+}
+
+
+// Writes a bpkg describing the given chunks of a data file, with every hash zeroed
+static void write_bpkg(const char *path, const char *data_path, uint64_t size, uint32_t nchunks,
+    const uint64_t *offsets, const uint64_t *sizes) {
+    FILE *fp = fopen(path, "w");
+    fprintf(fp, "ident:");
+    for(int i = 0; i < IDENT_SIZE - 1; i++)
+        fputc('a', fp);
+    fprintf(fp, "\nfilename:%s\nsize:%llu\nnhashes:%u\nhashes:\n", data_path, (unsigned long long) size, nchunks - 1);
+    for(uint32_t i = 0; i < nchunks - 1; i++)
+        fprintf(fp, "\t%064d\n", 0);
+    fprintf(fp, "nchunks:%u\nchunks:\n", nchunks);
+    for(uint32_t i = 0; i < nchunks; i++)
+        fprintf(fp, "\t%064d,%llu,%llu\n", 0, (unsigned long long) offsets[i], (unsigned long long) sizes[i]);
+    fclose(fp);
+}
+
+
+// Test 34 − Sparse Multi-Terabyte Package (Positive Test Case)
+static void large_package_test(void **state) {
+    const char *path = "/tmp/pkgchk_large_test.bpkg";
+    const char *data_path = "/tmp/pkgchk_large_test.data";
+    unsigned long long size = 4ULL << 40, half = size / 2;
+    remove(data_path);
+
+    const uint64_t halves[2] = { 0, half };
+    const uint64_t half_sizes[2] = { half, half };
+    write_bpkg(path, data_path, size, 2, halves, half_sizes);
+
+    // Check sizes and offsets past 4 GiB are kept whole in both formats
+    struct bpkg_obj *bpkg = bpkg_load(path);
+    assert_non_null(bpkg);
+    assert_true(bpkg->size == size);
+    assert_true((bpkg->chunks[1].offset == half) && (bpkg->chunks[1].size == half));
+    assert_int_equal(bpkg2_save(bpkg, path), 0);
+    struct bpkg_obj *bin = bpkg_load(path);
+    assert_non_null(bin);
+    assert_true(bin->size == size);
+    assert_memory_equal(bin->chunks, bpkg->chunks, sizeof(struct chunk) * bpkg->nchunks);
+    bpkg_obj_destroy(bin);
+
+    // Check the data file is created sparse at its full size
+    struct bpkg_query qry = bpkg_file_check(bpkg);
+    assert_string_equal(qry.hashes[0], "File Created");
+    bpkg_query_destroy(&qry);
+    struct stat st;
+    assert_int_equal(stat(data_path, &st), 0);
+    assert_true((unsigned long long) st.st_size == size);
+    assert_true(st.st_blocks < 2048);
+
+    // Check a chunk read 3 TiB into the file gets the right bytes
+    int fd = open(data_path, O_WRONLY);
+    assert_int_equal(pwrite(fd, "marker", 6, 3ULL << 40), 6);
+    close(fd);
+    struct merkle_tree_node node = { 0 };
+    node.offset = 3ULL << 40;
+    node.length = 6;
+    node.is_leaf = 1;
+    char buffer[6];
+    assert_int_equal(merkle_node_read(bpkg, &node, buffer), 6);
+    assert_memory_equal(buffer, "marker", 6);
+    bpkg_obj_destroy(bpkg);
+
+    // Check blocks larger than a read are hashed whole, with pread and mmap
+    size_t block_size = 3 << 20;
+    char *block = (char*) malloc(block_size + 1);
+    FILE *fp = fopen(data_path, "w");
+    for(size_t i = 0; i < block_size; i++)
+        block[i] = (char) (i * 7);
+    fwrite(block, 1, block_size, fp);
+    fwrite(block + 1, 1, block_size - 1, fp);
+    fclose(fp);
+
+    const uint64_t blocks[2] = { 0, block_size };
+    const uint64_t block_sizes[2] = { block_size, block_size };
+    write_bpkg(path, data_path, block_size * 2, 2, blocks, block_sizes);
+
+    struct sha256_compute_data data;
+    struct digest expected;
+    block[block_size] = '\0';
+    sha256_compute_data_init(&data);
+    sha256_update(&data, block + 1, block_size);
+    sha256_finalize(&data, NULL);
+    sha256_output(&data, expected.bytes);
+
+    bpkg = bpkg_load(path);
+    struct merkle_tree *tree = merkle_tree_build(bpkg);
+    bpkg_get_opts()->read_mode = READ_MMAP;
+    struct merkle_tree *tree_mm = merkle_tree_build(bpkg);
+    bpkg_get_opts()->read_mode = READ_PREAD;
+    assert_memory_equal(&tree->root->right->computed_hash, &expected, DIGEST_SIZE);
+    assert_memory_equal(&tree_mm->root->computed_hash, &tree->root->computed_hash, DIGEST_SIZE);
+
+    struct bpkg_verify res;
+    assert_int_equal(bpkg_verify_stream(bpkg, &res), 0);
+    assert_memory_equal(&res.root, &tree->root->computed_hash, DIGEST_SIZE);
+    bpkg_verify_destroy(&res);
+
+    merkle_tree_destroy(tree);
+    merkle_tree_destroy(tree_mm);
+    bpkg_obj_destroy(bpkg);
+    free(block);
+    remove(path);
+    remove(data_path);
+}
+
+
+// Test 35 − Variable-Size Chunks (Positive Test Case)
+static void chunk_ranges_test(void **state) {
+    const char *path = "/tmp/pkgchk_chunks_test.bpkg";
+    const char *data_path = "/tmp/pkgchk_chunks_test.data";
+    // Two full chunks, a short tail and a chunk read from the start of the file again
+    const uint64_t offsets[] = { 0, 4096, 8192, 100 };
+    const uint64_t sizes[] = { 4096, 4096, 808, 1000 };
+    char data[9000];
+
+    for(int i = 0; i < 9000; i++)
+        data[i] = (char) (i * 13 + i / 256);
+
+    FILE *fp = fopen(data_path, "w");
+    fwrite(data, 1, sizeof(data), fp);
+    fclose(fp);
+    write_bpkg(path, data_path, sizeof(data), 4, offsets, sizes);
+
+    struct bpkg_obj *bpkg = bpkg_load(path);
+    struct merkle_tree *tree = merkle_tree_build(bpkg);
+    bpkg_get_opts()->read_mode = READ_MMAP;
+    bpkg_get_opts()->retain_values = 1;
+    struct merkle_tree *tree_mm = merkle_tree_build(bpkg);
+    bpkg_get_opts()->read_mode = READ_PREAD;
+    bpkg_get_opts()->retain_values = 0;
+
+    // Check each leaf hashes exactly the bytes of its chunk
+    struct merkle_tree_node *leaves[] = { tree->root->left->left, tree->root->left->right,
+        tree->root->right->left, tree->root->right->right };
+    struct merkle_tree_node *leaves_mm[] = { tree_mm->root->left->left, tree_mm->root->left->right,
+        tree_mm->root->right->left, tree_mm->root->right->right };
+
+    for(int i = 0; i < 4; i++) {
+        struct sha256_compute_data sha;
+        struct digest expected;
+        sha256_compute_data_init(&sha);
+        sha256_update(&sha, data + offsets[i], sizes[i]);
+        sha256_finalize(&sha, NULL);
+        sha256_output(&sha, expected.bytes);
+
+        assert_memory_equal(&leaves[i]->computed_hash, &expected, DIGEST_SIZE);
+        assert_memory_equal(&leaves_mm[i]->computed_hash, &expected, DIGEST_SIZE);
+        assert_int_equal(leaves[i]->offset, offsets[i]);
+        assert_int_equal(leaves[i]->length, sizes[i]);
+        assert_memory_equal(leaves_mm[i]->value, data + offsets[i], sizes[i]);
+    }
+
+    // Check the streaming verifier hashes the same chunks and reports their own byte ranges
+    bpkg_get_opts()->verify_mode = VERIFY_REPORT_ALL;
+    struct bpkg_verify res;
+    assert_int_equal(bpkg_verify_stream(bpkg, &res), 0);
+    bpkg_get_opts()->verify_mode = VERIFY_ROOT;
+    assert_memory_equal(&res.root, &tree->root->computed_hash, DIGEST_SIZE);
+    assert_int_equal(res.n_mismatches, 4);
+    assert_int_equal(res.n_ranges, 2);
+    assert_int_equal(res.ranges[0].offset, 0);
+    assert_int_equal(res.ranges[0].length, 9000);
+    assert_int_equal(res.ranges[1].offset, 100);
+    assert_int_equal(res.ranges[1].length, 1000);
+    bpkg_verify_destroy(&res);
+
+    merkle_tree_destroy(tree);
+    merkle_tree_destroy(tree_mm);
+    bpkg_obj_destroy(bpkg);
+    remove(path);
+    remove(data_path);
+}
+
+
+// Copies the data file of a bpkg to data_path and points the bpkg at the copy
+static void copy_data_file(struct bpkg_obj *bpkg, const char *data_path) {
+    FILE *src = fopen(bpkg->filename, "rb");
+    FILE *fp = fopen(data_path, "wb");
+    char block[4096];
+    size_t n;
+    while((n = fread(block, 1, sizeof(block), src)) > 0)
+        fwrite(block, 1, n, fp);
+    fclose(src);
+    fclose(fp);
+    strcpy(bpkg->filename, data_path);
+}
+
+
+// Test 36 − Sidecar Verification Cache (Positive Test Case)
+static void verify_cache_test(void **state) {
+    const char *data_path = "/tmp/pkgchk_cache_test.data";
+    const char *cache_path = "/tmp/pkgchk_cache_test.data" CACHE_SUFFIX;
+    remove(cache_path);
+
+    // Copy file1 so its data file can be touched
+    struct bpkg_obj *bpkg = bpkg_load("tests/pkgs/file1.bpkg");
+    copy_data_file(bpkg, data_path);
+
+    // Data files changed in the last moments aren't cached, so age it
+    struct timespec times[2] = { { time(NULL) - 3600, 0 }, { time(NULL) - 3600, 0 } };
+    assert_int_equal(utimensat(AT_FDCWD, data_path, times, 0), 0);
+
+    // Check a full pass writes the cache
+    bpkg_get_opts()->use_cache = 1;
+    struct bpkg_verify res;
+    assert_int_equal(bpkg_verify_stream(bpkg, &res), 0);
+    assert_int_equal(res.ok, 1);
+    struct stat st;
+    assert_int_equal(stat(cache_path, &st), 0);
+    assert_int_equal(st.st_size, sizeof(struct cache_key) + sizeof(struct digest) * bpkg->nchunks);
+
+    // Check the cached digests are used while the data file is unchanged
+    struct digest zeros[2] = { 0 };
+    int fd = open(cache_path, O_WRONLY);
+    assert_int_equal(pwrite(fd, zeros, sizeof(zeros), sizeof(struct cache_key)), sizeof(zeros));
+    close(fd);
+    assert_int_equal(bpkg_verify_stream(bpkg, &res), 0);
+    assert_int_equal(res.ok, 0);
+    assert_int_equal(res.first_mismatch, 0);
+    assert_memory_equal(&res.actual, &zeros[0], DIGEST_SIZE);
+    struct merkle_tree *tree = merkle_tree_build(bpkg);
+    assert_memory_equal(&tree->root->left->left->left->left->left->left->left->computed_hash, &zeros[0], DIGEST_SIZE);
+    merkle_tree_destroy(tree);
+
+    // Check touching the data file makes it hashed again and the cache rewritten
+    times[1].tv_sec++;
+    assert_int_equal(utimensat(AT_FDCWD, data_path, times, 0), 0);
+    tree = merkle_tree_build(bpkg);
+    assert_memory_equal(&tree->root->computed_hash, &bpkg->hashes[0], DIGEST_SIZE);
+    merkle_tree_destroy(tree);
+    assert_int_equal(bpkg_verify_stream(bpkg, &res), 0);
+    assert_int_equal(res.ok, 1);
+    bpkg_get_opts()->use_cache = 0;
+
+    bpkg_obj_destroy(bpkg);
+    remove(cache_path);
+    remove(data_path);
+}
+
+
+// Test 37 − Incremental Merkle Update (Positive Test Case)
+static void merkle_tree_update_test(void **state) {
+    const char *data_path = "/tmp/pkgchk_update_test.data";
+
+    // Copy file1 so its data file can be written to
+    struct bpkg_obj *bpkg = bpkg_load("tests/pkgs/file1.bpkg");
+    copy_data_file(bpkg, data_path);
+
+    struct merkle_tree *tree = merkle_tree_build(bpkg);
+    assert_memory_equal(&tree->root->computed_hash, &bpkg->hashes[0], DIGEST_SIZE);
+
+    // Overwrite part of chunk 3 and a span crossing from chunk 9 into chunk 10
+    uint64_t size = bpkg->chunks[0].size;
+    char saved[2][64], block[64];
+    struct byte_range ranges[3] = {
+        { 3 * size + 5, 10 },
+        { 10 * size - 32, 64 },
+        { 3 * size + 8, 4 }, // overlaps the first range
+    };
+    int fd = open(data_path, O_RDWR);
+    memset(block, 0xab, sizeof(block));
+    assert_int_equal(pread(fd, saved[0], 10, ranges[0].offset), 10);
+    assert_int_equal(pread(fd, saved[1], 64, ranges[1].offset), 64);
+    assert_int_equal(pwrite(fd, block, 10, ranges[0].offset), 10);
+    assert_int_equal(pwrite(fd, block, 64, ranges[1].offset), 64);
+
+    // Check only the three dirty leaves are rehashed and the tree matches a fresh build
+    assert_int_equal(merkle_tree_update(bpkg, tree, ranges, 3), 3);
+    struct merkle_tree *fresh = merkle_tree_build(bpkg);
+    assert_memory_not_equal(&tree->root->computed_hash, &bpkg->hashes[0], DIGEST_SIZE);
+    assert_memory_equal(&tree->root->computed_hash, &fresh->root->computed_hash, DIGEST_SIZE);
+    for(uint32_t i = 0; i < bpkg->nchunks; i++)
+        assert_memory_equal(&tree->leaves[i]->computed_hash, &fresh->leaves[i]->computed_hash, DIGEST_SIZE);
+    merkle_tree_destroy(fresh);
+
+    // Check empty ranges leave the tree alone
+    struct byte_range empty = { 0, 0 };
+    assert_int_equal(merkle_tree_update(bpkg, tree, &empty, 1), 0);
+
+    // Check restoring the data and updating again gives back the expected root
+    assert_int_equal(pwrite(fd, saved[0], 10, ranges[0].offset), 10);
+    assert_int_equal(pwrite(fd, saved[1], 64, ranges[1].offset), 64);
+    close(fd);
+    assert_int_equal(merkle_tree_update(bpkg, tree, ranges, 2), 3);
+    assert_memory_equal(&tree->root->computed_hash, &bpkg->hashes[0], DIGEST_SIZE);
+
+    merkle_tree_destroy(tree);
+    bpkg_obj_destroy(bpkg);
+    remove(data_path);
+}
+
+
+// Test 38 − Hash Index Lookup (Positive Test Case)
+static void hash_index_test(void **state) {
+    // file7's data file doesn't exist, so nothing here can hash it
+    struct bpkg_obj *bpkg = bpkg_load("resources/pkgs/file7.bpkg");
+    assert_non_null(bpkg);
+    size_t n_nodes = bpkg->nhashes + bpkg->nchunks;
+
+    // Check every expected hash is found at its own heap position, or an earlier one sharing it
+    struct hash_index *index = bpkg_hash_index(bpkg);
+    assert_true(bpkg_hash_index(bpkg) == index);
+    for(size_t pos = 0; pos < n_nodes; pos++) {
+        const struct digest *hash = pos < bpkg->nhashes ? &bpkg->hashes[pos] : &bpkg->chunks[pos - bpkg->nhashes].hash;
+        ssize_t found = hash_index_find(bpkg, index, hash);
+        assert_true((found >= 0) && ((size_t) found <= pos));
+        const struct digest *match = (size_t) found < bpkg->nhashes ? &bpkg->hashes[found] : &bpkg->chunks[found - bpkg->nhashes].hash;
+        assert_memory_equal(match, hash, DIGEST_SIZE);
+    }
+    struct digest missing = { 0 };
+    assert_int_equal(hash_index_find(bpkg, index, &missing), -1);
+
+    // Check -hashes_of is answered for the root and its right child without the data file
+    char hex[HASH_SIZE] = { 0 };
+    digest_to_hash(&bpkg->hashes[0], hex);
+    struct bpkg_query qry = bpkg_get_all_chunk_hashes_from_hash(bpkg, hex);
+    assert_int_equal(qry.len, bpkg->nchunks);
+    bpkg_query_destroy(&qry);
+
+    digest_to_hash(&bpkg->hashes[2], hex);
+    qry = bpkg_get_all_chunk_hashes_from_hash(bpkg, hex);
+    assert_int_equal(qry.len, bpkg->nchunks / 2);
+    for(int i = 0; i < qry.len; i++)
+        assert_memory_equal(&qry.digests[i], &bpkg->chunks[bpkg->nchunks / 2 + i].hash, DIGEST_SIZE);
+    bpkg_query_destroy(&qry);
+    assert_int_not_equal(access(bpkg->filename, F_OK), 0);
+
+    bpkg_obj_destroy(bpkg);
+}
+
+
+// Test 39 − Lazy Merkle Tree (Positive Test Case)
+static void merkle_tree_lazy_test(void **state) {
+    // Check a lazy tree is built and searched without the data file
+    struct bpkg_obj *bpkg = bpkg_load("resources/pkgs/file7.bpkg");
+    struct merkle_tree *tree = merkle_tree_build_lazy(bpkg);
+    assert_non_null(tree);
+    assert_true(merkle_tree_find(bpkg, tree, &bpkg->hashes[0]) == tree->root);
+    assert_true(merkle_tree_find(bpkg, tree, &bpkg->chunks[5].hash) == tree->leaves[5]);
+    assert_int_equal(merkle_tree_compute(bpkg, tree, tree->root->left), -1);
+    assert_int_not_equal(access(bpkg->filename, F_OK), 0);
+    merkle_tree_destroy(tree);
+    bpkg_obj_destroy(bpkg);
+
+    // Copy file1 so its data file can be written to
+    const char *data_path = "/tmp/pkgchk_lazy_test.data";
+    bpkg = bpkg_load("tests/pkgs/file1.bpkg");
+    copy_data_file(bpkg, data_path);
+
+    // Check computing the right half only hashes the chunks below it
+    tree = merkle_tree_build_lazy(bpkg);
+    struct merkle_tree_node *right = merkle_tree_find(bpkg, tree, &bpkg->hashes[2]);
+    assert_true(right == tree->root->right);
+    assert_int_equal(merkle_tree_compute(bpkg, tree, right), 0);
+    assert_memory_equal(&right->computed_hash, &right->expected_hash, DIGEST_SIZE);
+    assert_int_equal(tree->hashed[2], 1);
+    assert_int_equal(tree->hashed[1], 0);
+    assert_int_equal(tree->hashed[bpkg->nhashes], 0);
+    assert_int_equal(tree->hashed[bpkg->nhashes + bpkg->nchunks - 1], 1);
+
+    // Check the root then gives the same hashes as a full build
+    assert_int_equal(merkle_tree_compute(bpkg, tree, tree->root), 0);
+    assert_memory_equal(&tree->root->computed_hash, &bpkg->hashes[0], DIGEST_SIZE);
+
+    // Check a dirty range is only hashed again once the root is asked for
+    struct byte_range range = { 0, 16 };
+    int fd = open(data_path, O_WRONLY);
+    char block[16];
+    memset(block, 0xcd, 16);
+    assert_int_equal(pwrite(fd, block, 16, 0), 16);
+    close(fd);
+    assert_int_equal(merkle_tree_update(bpkg, tree, &range, 1), 1);
+    assert_int_equal(tree->hashed[0], 0);
+    assert_int_equal(tree->hashed[2], 1);
+    assert_int_equal(merkle_tree_compute(bpkg, tree, tree->root), 0);
+    struct merkle_tree *fresh = merkle_tree_build(bpkg);
+    assert_memory_equal(&tree->root->computed_hash, &fresh->root->computed_hash, DIGEST_SIZE);
+    assert_memory_not_equal(&tree->root->computed_hash, &bpkg->hashes[0], DIGEST_SIZE);
+    merkle_tree_destroy(fresh);
+
+    merkle_tree_destroy(tree);
+    bpkg_obj_destroy(bpkg);
+    remove(data_path);
+}
+
+
+// Test 40 − Batch Verification (Positive Test Case)
+static void batch_test(void **state) {
+    const char *manifest = "/tmp/pkgchk_batch_test.txt";
+    FILE *fp = fopen(manifest, "w");
+    fprintf(fp, "# packages to sweep\ntests/pkgs/file1.bpkg\n\nresources/pkgs/file7.bpkg\r\n");
+    fprintf(fp, "tests/pkgs/missing.bpkg\ntests/pkgs/file18.bpkg\nresources/pkgs/file4.bpkg\n");
+    fclose(fp);
+
+    // Check a request larger than the budget takes all of it rather than waiting forever
+    struct io_budget *budget = budget_create(64 * 1024);
+    assert_int_equal(budget_acquire(budget, 1 << 20), 64 * 1024);
+    budget_release(budget, 64 * 1024);
+
+    // Check each package of a manifest gets its own result, in order
+    struct batch *batch = batch_load(manifest);
+    assert_non_null(batch);
+    assert_int_equal(batch->n_packages, 5);
+    struct thread_pool *pool = pool_create(4);
+    batch_run(batch, pool, budget);
+    assert_string_equal(batch->results[1].path, "resources/pkgs/file7.bpkg");
+    assert_int_equal(batch->results[0].status, BATCH_SUCCESS);
+    assert_int_equal(batch->results[1].status, BATCH_NO_DATA);
+    assert_int_equal(batch->results[2].status, BATCH_INVALID);
+    assert_int_equal(batch->results[3].status, BATCH_FAILED);
+    assert_int_equal(batch->results[3].first_mismatch, 0);
+    assert_int_equal(batch->results[4].status, BATCH_SUCCESS);
+    batch_destroy(batch);
+
+    // Check a directory gives its packages in name order
+    batch = batch_load("resources/pkgs");
+    assert_non_null(batch);
+    assert_int_equal(batch->n_packages, 3);
+    assert_string_equal(batch->results[0].path, "resources/pkgs/file1.bpkg");
+    assert_string_equal(batch->results[2].path, "resources/pkgs/file7.bpkg");
+    batch_run(batch, NULL, NULL);
+    assert_int_equal(batch->results[1].status, BATCH_SUCCESS);
+    batch_destroy(batch);
+
+    assert_null(batch_load("/tmp/pkgchk_batch_missing"));
+
+    pool_destroy(pool);
+    budget_destroy(budget);
+    remove(manifest);
+}
+
+
+// Test 41 − io_uring Chunk Reader (Positive Test Case)
+static void uring_reader_test(void **state) {
+    const char *data_path = "/tmp/pkgchk_uring_test.data";
+    char data[10000];
+
+    for(int i = 0; i < 10000; i++)
+        data[i] = (char) (i * 7 + i / 128);
+
+    FILE *fp = fopen(data_path, "w");
+    fwrite(data, 1, sizeof(data), fp);
+    fclose(fp);
+
+    // Check reads in flight together land in their own slots, with the tail past the end zeroed
+    int fd = open(data_path, O_RDONLY);
+    struct uring_reader *reader = uring_reader_create(fd, 4, 4096);
+
+    if(reader != NULL) {
+        char tail[4096] = { 0 };
+        memcpy(tail, data + 8192, 10000 - 8192);
+
+        uring_reader_queue(reader, 0, 0, 4096);
+        uring_reader_queue(reader, 1, 8192, 4096);
+        uring_reader_queue(reader, 3, 100, 1000);
+        assert_memory_equal(uring_reader_wait(reader, 3), data + 100, 1000);
+        assert_memory_equal(uring_reader_wait(reader, 1), tail, 4096);
+        assert_memory_equal(uring_reader_wait(reader, 0), data, 4096);
+
+        // Check a slot can be reused once its read is done
+        uring_reader_queue(reader, 0, 4096, 4096);
+        assert_memory_equal(uring_reader_wait(reader, 0), data + 4096, 4096);
+        uring_reader_destroy(reader);
+    }
+
+    close(fd);
+    remove(data_path);
+
+    // Check trees built through io_uring (or pread where it's unavailable) match, with and without threads
+    struct bpkg_obj *bpkg = bpkg_load("tests/pkgs/file1.bpkg");
+    bpkg_get_opts()->read_mode = READ_URING;
+    bpkg_get_opts()->retain_values = 1;
+
+    for(uint32_t threads = 1; threads <= 4; threads += 3) {
+        bpkg_get_opts()->nthreads = threads;
+        struct merkle_tree *tree = merkle_tree_build(bpkg);
+        assert_memory_equal(&tree->root->computed_hash, &bpkg->hashes[0], DIGEST_SIZE);
+
+        char block[4096];
+        for(uint32_t i = 0; i < bpkg->nchunks; i += 37) {
+            assert_memory_equal(&tree->leaves[i]->computed_hash, &bpkg->chunks[i].hash, DIGEST_SIZE);
+            assert_int_equal(merkle_node_read(bpkg, tree->leaves[i], block), bpkg->chunks[i].size);
+            assert_memory_equal(tree->leaves[i]->value, block, bpkg->chunks[i].size);
+        }
+        merkle_tree_destroy(tree);
+    }
+
+    bpkg_get_opts()->nthreads = 1;
+    bpkg_get_opts()->read_mode = READ_PREAD;
+    bpkg_get_opts()->retain_values = 0;
+    bpkg_obj_destroy(bpkg);
+}
+
+
+// Test 42 − Page Cache Modes (Positive Test Case)
+static void page_mode_test(void **state) {
+    const char *data_path = "/tmp/pkgchk_pages_test.data";
+    char data[10000];
+
+    for(int i = 0; i < 10000; i++)
+        data[i] = (char) (i * 11 + i / 64);
+
+    FILE *fp = fopen(data_path, "w");
+    fwrite(data, 1, sizeof(data), fp);
+    fclose(fp);
+
+    // Check direct reads at unaligned offsets, and of a tail running past the end, give the plain bytes
+    int fd = open(data_path, O_RDONLY);
+    int direct_fd = open(data_path, O_RDONLY | O_DIRECT);
+    char *bounce = NULL;
+    assert_int_equal(posix_memalign((void **) &bounce, DIRECT_ALIGN, 4096 + 2 * DIRECT_ALIGN), 0);
+    char tail[4096] = { 0 };
+    memcpy(tail, data + 8000, 2000);
+
+    // Without O_DIRECT support the plain descriptor stands in, which must give the same bytes
+    int reader = direct_fd >= 0 ? direct_fd : fd;
+    assert_memory_equal(read_block_direct(reader, fd, bounce, 1000, 100), data + 100, 1000);
+    assert_memory_equal(read_block_direct(reader, fd, bounce, 4096, 8000), tail, 4096);
+    assert_memory_equal(read_block_direct(reader, fd, bounce, 4096, 4096), data + 4096, 4096);
+    free(bounce);
+    close(fd);
+    remove(data_path);
+
+    // Check every page mode gives the same trees and verify results
+    struct bpkg_obj *bpkg = bpkg_load("tests/pkgs/file1.bpkg");
+    const enum bpkg_page_mode modes[] = { PAGES_DROP, PAGES_DIRECT };
+
+    for(int m = 0; m < 2; m++) {
+        bpkg_get_opts()->page_mode = modes[m];
+        struct merkle_tree *tree = merkle_tree_build(bpkg);
+        assert_memory_equal(&tree->root->computed_hash, &bpkg->hashes[0], DIGEST_SIZE);
+        merkle_tree_destroy(tree);
+
+        struct bpkg_verify res;
+        assert_int_equal(bpkg_verify_stream(bpkg, &res), 0);
+        assert_int_equal(res.ok, 1);
+    }
+
+    // Check a direct read leaves none of the data file cached where O_DIRECT works
+    if(direct_fd >= 0) {
+        fd = open(bpkg->filename, O_RDONLY);
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        struct merkle_tree *tree = merkle_tree_build(bpkg);
+        merkle_tree_destroy(tree);
+
+        size_t size = bpkg->size;
+        size_t page = (size_t) sysconf(_SC_PAGESIZE);
+        unsigned char resident[size / page + 1];
+        void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        assert_int_equal(mincore(map, size, resident), 0);
+        for(size_t i = 0; i < (size + page - 1) / page; i++)
+            assert_int_equal(resident[i] & 1, 0);
+        munmap(map, size);
+        close(fd);
+        close(direct_fd);
+    }
+
+    bpkg_get_opts()->page_mode = PAGES_KEEP;
+    bpkg_obj_destroy(bpkg);
+}
+
+
+// Test 43 − Read/Hash Pipeline (Positive Test Case)
+static int fill_counter(void *arg, char *buffer) {
+    int *next = (int *) arg;
+
+    if(*next == 100)
+        return 0;
+
+    memcpy(buffer, next, sizeof(int));
+    (*next)++;
+    return 1;
+}
+
+static void pipeline_test(void **state) {
+    // Check a plan reads runs of same-sized chunks together, and large chunks in pieces
+    struct chunk chunks[5] = { 0 };
+    const uint64_t sizes[5] = { 100, 100, 100, 250, 100 };
+    uint64_t offset = 0;
+
+    for(int i = 0; i < 5; i++) {
+        chunks[i].offset = i == 2 ? offset + 50 : offset;
+        chunks[i].size = sizes[i];
+        offset = chunks[i].offset + chunks[i].size;
+    }
+
+    struct read_step step = { 0 };
+    assert_int_equal(read_step_next(chunks, NULL, 5, 4, 100, NULL, &step), 1);
+    assert_int_equal(step.first, 0);
+    assert_int_equal(step.count, 3);
+    assert_int_equal(step.contiguous, 0);
+    assert_int_equal(read_step_last(chunks, NULL, &step), 1);
+
+    const uint64_t dones[3] = { 0, 100, 200 };
+    for(int i = 0; i < 3; i++) {
+        assert_int_equal(read_step_next(chunks, NULL, 5, 4, 100, NULL, &step), 1);
+        assert_int_equal(step.first, 3);
+        assert_int_equal(step.done, dones[i]);
+        assert_int_equal(step.len, i < 2 ? 100 : 50);
+        assert_int_equal(read_step_last(chunks, NULL, &step), i == 2);
+    }
+
+    // A plan over chosen chunks only reads those
+    const uint32_t indices[2] = { 4, 0 };
+    memset(&step, 0, sizeof(step));
+    assert_int_equal(read_step_next(chunks, indices, 2, 4, 100, NULL, &step), 1);
+    assert_int_equal(step.count, 2);
+    assert_int_equal(step.contiguous, 0);
+    assert_int_equal(read_step_next(chunks, indices, 2, 4, 100, NULL, &step), 0);
+
+    // Check slots come out in the order they were filled, and the reader can be stopped early
+    for(uint32_t ring = 1; ring <= 3; ring++) {
+        int next = 0;
+        struct read_pipeline *pipeline = pipeline_start(ring, sizeof(int), fill_counter, &next);
+
+        for(int i = 0; i < 100; i++) {
+            const char *slot = pipeline_take(pipeline);
+            assert_non_null(slot);
+            assert_memory_equal(slot, &i, sizeof(int));
+            pipeline_give_back(pipeline);
+        }
+        assert_null(pipeline_take(pipeline));
+        pipeline_stop(pipeline);
+
+        next = 0;
+        pipeline = pipeline_start(ring, sizeof(int), fill_counter, &next);
+        assert_non_null(pipeline_take(pipeline));
+        pipeline_stop(pipeline);
+    }
+
+    // Check trees and verify results through the ring match, including with slots smaller than a chunk
+    struct bpkg_obj *bpkg = bpkg_load("tests/pkgs/file1.bpkg");
+    const size_t slot_bytes[3] = { 0, 1000, 64 * 1024 };
+    bpkg_get_opts()->retain_values = 1;
+
+    for(int i = 0; i < 3; i++) {
+        bpkg_get_opts()->ring_slots = 1 + i;
+        bpkg_get_opts()->ring_slot_bytes = slot_bytes[i];
+
+        struct merkle_tree *tree = merkle_tree_build(bpkg);
+        assert_memory_equal(&tree->root->computed_hash, &bpkg->hashes[0], DIGEST_SIZE);
+
+        char block[4096];
+        for(uint32_t j = 0; j < bpkg->nchunks; j += 37) {
+            assert_memory_equal(&tree->leaves[j]->computed_hash, &bpkg->chunks[j].hash, DIGEST_SIZE);
+            assert_int_equal(merkle_node_read(bpkg, tree->leaves[j], block), bpkg->chunks[j].size);
+            assert_memory_equal(tree->leaves[j]->value, block, bpkg->chunks[j].size);
+        }
+        merkle_tree_destroy(tree);
+
+        struct bpkg_verify res;
+        assert_int_equal(bpkg_verify_stream(bpkg, &res), 0);
+        assert_int_equal(res.ok, 1);
+    }
+
+    bpkg_get_opts()->ring_slots = 0;
+    bpkg_get_opts()->ring_slot_bytes = 0;
+    bpkg_get_opts()->retain_values = 0;
+    bpkg_obj_destroy(bpkg);
+}
+
+
+// Test 44 − Sparse Data File Holes (Positive Test Case)
+static void hole_map_test(void **state) {
+    const char *path = "/tmp/pkgchk_holes_test.bpkg";
+    const char *data_path = "/tmp/pkgchk_holes_test.data";
+    const size_t chunk_size = 64 << 10;
+    const uint32_t nchunks = 16;
+
+    // Check the digest of zeros matches hashing the zeros
+    char *zeros = (char *) calloc(chunk_size + 1, 1);
+    struct sha256_compute_data sha;
+    struct digest expected, zero;
+    sha256_compute_data_init(&sha);
+    sha256_update(&sha, zeros, chunk_size);
+    sha256_finalize(&sha, NULL);
+    sha256_output(&sha, expected.bytes);
+    zero_digest(chunk_size, &zero);
+    assert_memory_equal(&zero, &expected, DIGEST_SIZE);
+
+    // A sparse file with data in chunk 3 and a few bytes in the middle of chunk 9
+    remove(data_path);
+    int fd = open(data_path, O_RDWR | O_CREAT, 0644);
+    assert_int_equal(ftruncate(fd, chunk_size * nchunks), 0);
+    char *block = (char *) malloc(chunk_size);
+    for(size_t i = 0; i < chunk_size; i++)
+        block[i] = (char) (i * 5 + 1);
+    assert_int_equal(pwrite(fd, block, chunk_size, 3 * chunk_size), (ssize_t) chunk_size);
+    assert_int_equal(pwrite(fd, "marker", 6, 9 * chunk_size + 5000), 6);
+
+    // Check the holes are found where the filesystem reports them
+    struct hole_map *holes = hole_map_load(fd);
+    if(holes != NULL) {
+        assert_int_equal(hole_map_is_hole(holes, 0, chunk_size), 1);
+        assert_int_equal(hole_map_is_hole(holes, 3 * chunk_size, chunk_size), 0);
+        assert_int_equal(hole_map_is_hole(holes, 9 * chunk_size, chunk_size), 0);
+        assert_int_equal(hole_map_is_hole(holes, 15 * chunk_size, chunk_size), 1);
+        assert_int_equal(hole_map_is_hole(holes, 20 * chunk_size, chunk_size), 1);
+        hole_map_destroy(holes);
+
+        // Probing a single range agrees with the map
+        assert_int_equal(hole_probe(fd, 0, chunk_size), 1);
+        assert_int_equal(hole_probe(fd, 3 * chunk_size, chunk_size), 0);
+        assert_int_equal(hole_probe(fd, 9 * chunk_size, chunk_size), 0);
+        assert_int_equal(hole_probe(fd, 15 * chunk_size, chunk_size), 1);
+    }
+    close(fd);
+
+    uint64_t offsets[16], sizes[16];
+    for(uint32_t i = 0; i < nchunks; i++) {
+        offsets[i] = i * chunk_size;
+        sizes[i] = chunk_size;
+    }
+    write_bpkg(path, data_path, chunk_size * nchunks, nchunks, offsets, sizes);
+
+    // Check the sparse file hashes the same as the same bytes written out in full
+    struct bpkg_obj *bpkg = bpkg_load(path);
+    bpkg_get_opts()->retain_values = 1;
+    struct merkle_tree *sparse = merkle_tree_build(bpkg);
+    bpkg_get_opts()->retain_values = 0;
+    struct bpkg_verify sparse_res;
+    assert_int_equal(bpkg_verify_stream(bpkg, &sparse_res), 0);
+
+    assert_memory_equal(&sparse->leaves[0]->computed_hash, &zero, DIGEST_SIZE);
+    assert_memory_equal(sparse->leaves[0]->value, zeros, chunk_size);
+    assert_true(sparse->leaves[15]->length == chunk_size);
+
+    FILE *fp = fopen(data_path, "w");
+    for(uint32_t i = 0; i < nchunks; i++) {
+        if(i == 9)
+            memcpy(zeros + 5000, "marker", 6);
+        fwrite(i == 3 ? block : zeros, 1, chunk_size, fp);
+        memset(zeros, 0, chunk_size);
+    }
+    fclose(fp);
+
+    struct merkle_tree *dense = merkle_tree_build(bpkg);
+    struct bpkg_verify dense_res;
+    assert_int_equal(bpkg_verify_stream(bpkg, &dense_res), 0);
+
+    for(uint32_t i = 0; i < nchunks; i++)
+        assert_memory_equal(&sparse->leaves[i]->computed_hash, &dense->leaves[i]->computed_hash, DIGEST_SIZE);
+    assert_memory_equal(&sparse->root->computed_hash, &dense->root->computed_hash, DIGEST_SIZE);
+    assert_memory_equal(&sparse_res.root, &dense_res.root, DIGEST_SIZE);
+    assert_memory_equal(&sparse_res.root, &dense->root->computed_hash, DIGEST_SIZE);
+
+    bpkg_verify_destroy(&sparse_res);
+    bpkg_verify_destroy(&dense_res);
+    merkle_tree_destroy(sparse);
+    merkle_tree_destroy(dense);
+    bpkg_obj_destroy(bpkg);
+    free(block);
+    free(zeros);
+    remove(path);
+    remove(data_path);
+}
+
+
+// Test 45 − Zero Chunk Digests (Positive Test Case)
+static void hash_pair_plain(const struct digest *left, const struct digest *right, struct digest *out) {
+    char combined[(HASH_SIZE - 1) * 2];
+    struct sha256_compute_data sha;
+    digest_to_hash(left, combined);
+    digest_to_hash(right, combined + HASH_SIZE - 1);
+    sha256_compute_data_init(&sha);
+    sha256_update(&sha, combined, sizeof(combined));
+    sha256_finalize(&sha, NULL);
+    sha256_output(&sha, out->bytes);
+}
+
+static void zero_digest_test(void **state) {
+    // Check the zero scan finds a single set byte anywhere, at any alignment
+    char *buffer = (char *) calloc(1100, 1);
+    for(size_t size = 0; size < 600; size += 37) {
+        for(size_t start = 0; start < 4; start++) {
+            assert_int_equal(is_zero_block(buffer + start, size), 1);
+            for(size_t i = 0; i < size; i++) {
+                buffer[start + i] = 1;
+                assert_int_equal(is_zero_block(buffer + start, size), 0);
+                buffer[start + i] = 0;
+            }
+        }
+    }
+    free(buffer);
+
+    // Check kept digests match hashing the zeros, and the parents of all-zero subtrees follow them
+    const uint64_t sizes[2] = { 4096, 1000 };
+    for(int s = 0; s < 2; s++) {
+        char *zeros = (char *) calloc(sizes[s] + 1, 1);
+        struct sha256_compute_data sha;
+        struct digest expected, zero, parent, plain;
+        sha256_compute_data_init(&sha);
+        sha256_update(&sha, zeros, sizes[s]);
+        sha256_finalize(&sha, NULL);
+        sha256_output(&sha, expected.bytes);
+        zero_digest(sizes[s], &zero);
+        assert_memory_equal(&zero, &expected, DIGEST_SIZE);
+
+        for(int h = 0; h < 5; h++) {
+            hash_pair_plain(&zero, &zero, &plain);
+            assert_int_equal(zero_parent(&zero, &parent), 1);
+            assert_memory_equal(&parent, &plain, DIGEST_SIZE);
+            zero = parent;
+        }
+        free(zeros);
+    }
+    struct digest data = { { 1 } }, out;
+    assert_int_equal(zero_parent(&data, &out), 0);
+
+    // Check a tree over zero chunks and one chunk of data hashes the same as hashing every byte
+    const char *path = "/tmp/pkgchk_zeros_test.bpkg";
+    const char *data_path = "/tmp/pkgchk_zeros_test.data";
+    const uint32_t nchunks = 8;
+    char block[4096] = { 0 };
+    FILE *fp = fopen(data_path, "w");
+    for(uint32_t i = 0; i < nchunks; i++) {
+        block[100] = i == 5 ? 'x' : 0;
+        fwrite(block, 1, sizeof(block), fp);
+    }
+    fclose(fp);
+
+    uint64_t chunk_offsets[8], chunk_sizes[8];
+    for(uint32_t i = 0; i < nchunks; i++) {
+        chunk_offsets[i] = i * sizeof(block);
+        chunk_sizes[i] = sizeof(block);
+    }
+    write_bpkg(path, data_path, sizeof(block) * nchunks, nchunks, chunk_offsets, chunk_sizes);
+
+    struct digest nodes[2 * 8 - 1];
+    for(uint32_t i = 0; i < nchunks; i++) {
+        struct sha256_compute_data sha;
+        block[100] = i == 5 ? 'x' : 0;
+        sha256_compute_data_init(&sha);
+        sha256_update(&sha, block, sizeof(block));
+        sha256_finalize(&sha, NULL);
+        sha256_output(&sha, nodes[nchunks - 1 + i].bytes);
+    }
+    for(int i = nchunks - 2; i >= 0; i--)
+        hash_pair_plain(&nodes[2 * i + 1], &nodes[2 * i + 2], &nodes[i]);
+
+    struct bpkg_obj *bpkg = bpkg_load(path);
+    const uint32_t slots[2] = { 0, 2 };
+    for(int p = 0; p < 2; p++) {
+        bpkg_get_opts()->ring_slots = slots[p];
+        struct merkle_tree *tree = merkle_tree_build(bpkg);
+        for(uint32_t i = 0; i < nchunks; i++)
+            assert_memory_equal(&tree->leaves[i]->computed_hash, &nodes[nchunks - 1 + i], DIGEST_SIZE);
+        assert_memory_equal(&tree->root->computed_hash, &nodes[0], DIGEST_SIZE);
+        merkle_tree_destroy(tree);
+
+        struct bpkg_verify res;
+        assert_int_equal(bpkg_verify_stream(bpkg, &res), 0);
+        assert_memory_equal(&res.root, &nodes[0], DIGEST_SIZE);
+        bpkg_verify_destroy(&res);
+    }
+    bpkg_get_opts()->ring_slots = 0;
+
+    bpkg_obj_destroy(bpkg);
+    remove(path);
+    remove(data_path);
+}
+
+
 int main(void) {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(load_valid_bpkg_test),
@@ -222,6 +1541,30 @@ int main(void) {
         cmocka_unit_test(get_hashes_of_ancestor_test),
         cmocka_unit_test(get_hashes_of_fake_ancestor_test),
         cmocka_unit_test(get_hashes_of_empty_ancestor_test),
+        cmocka_unit_test(merkle_tree_build_threads_test),
+        cmocka_unit_test(merkle_tree_build_mmap_test),
+        cmocka_unit_test(merkle_tree_hash_only_test),
+        cmocka_unit_test(flat_engine_min_hashes_test),
+        cmocka_unit_test(binary_hashes_test),
+        cmocka_unit_test(sha256_backends_test),
+        cmocka_unit_test(sha256_multi_test),
+        cmocka_unit_test(verify_stream_test),
+        cmocka_unit_test(verify_modes_test),
+        cmocka_unit_test(parser_rules_test),
+        cmocka_unit_test(arena_test),
+        cmocka_unit_test(bpkg2_format_test),
+        cmocka_unit_test(large_package_test),
+        cmocka_unit_test(chunk_ranges_test),
+        cmocka_unit_test(verify_cache_test),
+        cmocka_unit_test(merkle_tree_update_test),
+        cmocka_unit_test(hash_index_test),
+        cmocka_unit_test(merkle_tree_lazy_test),
+        cmocka_unit_test(batch_test),
+        cmocka_unit_test(uring_reader_test),
+        cmocka_unit_test(page_mode_test),
+        cmocka_unit_test(pipeline_test),
+        cmocka_unit_test(hole_map_test),
+        cmocka_unit_test(zero_digest_test),
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
\ No newline at end of file